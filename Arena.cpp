@@ -0,0 +1,80 @@
+/*
+
+Blade Of Darkness Remake GPL Source Code
+
+Copyright (C) 2017 Alexander Samusev.
+
+This file is part of the Blade Of Darkness Remake GPL Source Code (BladeRemake Source Code).
+
+BladeRemake is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+#include "Arena.h"
+
+#include <stdlib.h>
+
+FArena::FArena( size_t _BlockSize )
+    : Blocks( NULL )
+    , Ptr( NULL )
+    , End( NULL )
+    , BlockSize( _BlockSize )
+    , TotalSize( 0 )
+{
+}
+
+FArena::~FArena() {
+    Free();
+}
+
+void * FArena::AllocBlock( size_t _Size, size_t _Alignment ) {
+    // Oversized allocations get their own block
+    size_t Size = sizeof( FBlock ) + _Alignment + _Size;
+    if ( Size < BlockSize ) {
+        Size = BlockSize;
+    }
+
+    FBlock * Block = ( FBlock * )malloc( Size );
+    assert( Block != NULL );
+    Block->Next = Blocks;
+    Block->Size = Size;
+    Blocks = Block;
+    TotalSize += Size;
+
+    byte * p = ( byte * )( ( ( size_t )( Block + 1 ) + _Alignment - 1 ) & ~( _Alignment - 1 ) );
+    Ptr = p + _Size;
+    End = ( byte * )Block + Size;
+    return p;
+}
+
+const char * FArena::CopyString( const char * _Str, int _Length ) {
+    char * s = ( char * )Alloc( _Length + 1, 1 );
+    memcpy( s, _Str, _Length );
+    s[ _Length ] = 0;
+    return s;
+}
+
+void FArena::Free() {
+    FBlock * Block = Blocks;
+    while ( Block ) {
+        FBlock * Next = Block->Next;
+        free( Block );
+        Block = Next;
+    }
+    Blocks = NULL;
+    Ptr = NULL;
+    End = NULL;
+    TotalSize = 0;
+}
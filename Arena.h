@@ -0,0 +1,132 @@
+/*
+
+Blade Of Darkness Remake GPL Source Code
+
+Copyright (C) 2017 Alexander Samusev.
+
+This file is part of the Blade Of Darkness Remake GPL Source Code (BladeRemake Source Code).
+
+BladeRemake is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+#pragma once
+
+#include <Engine/Core/Public/Array.h>
+
+#include <new>
+#include <type_traits>
+#include <string.h>
+
+// Array allocated from FArena. Doesn't own the memory: it's released together with the arena.
+template< typename T >
+struct TArenaArray {
+    T * Data;
+    int Count;
+
+    int Length() const { return Count; }
+    T * ToPtr() const { return Data; }
+    T & operator[]( int _Index ) const { assert( _Index >= 0 && _Index < Count ); return Data[ _Index ]; }
+    T & Last() const { return Data[ Count - 1 ]; }
+};
+
+// Linear allocator. Memory is taken from large blocks and released all at once by Free().
+// Objects allocated from the arena never have their destructors called.
+class FArena {
+public:
+    FArena( size_t _BlockSize = 256 << 10 );
+    ~FArena();
+
+    void * Alloc( size_t _Size, size_t _Alignment = 16 );
+
+    // Allocate zeroed object
+    template< typename T >
+    T * New();
+
+    // Allocate zeroed array
+    template< typename T >
+    TArenaArray< T > AllocArray( int _Count );
+
+    template< typename T >
+    TArenaArray< T > CopyArray( const T * _Src, int _Count );
+
+    // Copy string with terminating zero
+    const char * CopyString( const char * _Str, int _Length );
+
+    // Release all blocks
+    void Free();
+
+    // Total size of allocated blocks
+    size_t GetAllocatedBytes() const { return TotalSize; }
+
+private:
+    FArena( const FArena & ) = delete;
+    FArena & operator=( const FArena & ) = delete;
+
+    struct FBlock {
+        FBlock * Next;
+        size_t Size;
+    };
+
+    void * AllocBlock( size_t _Size, size_t _Alignment );
+
+    FBlock * Blocks;
+    byte * Ptr;
+    byte * End;
+    size_t BlockSize;
+    size_t TotalSize;
+};
+
+AN_FORCEINLINE void * FArena::Alloc( size_t _Size, size_t _Alignment ) {
+    byte * p = ( byte * )( ( ( size_t )Ptr + _Alignment - 1 ) & ~( _Alignment - 1 ) );
+    if ( !Ptr || p + _Size > End ) {
+        return AllocBlock( _Size, _Alignment );
+    }
+    Ptr = p + _Size;
+    return p;
+}
+
+template< typename T >
+T * FArena::New() {
+    static_assert( std::is_trivially_destructible< T >::value, "Arena objects must be trivially destructible" );
+    void * Memory = Alloc( sizeof( T ), alignof( T ) < 16 ? 16 : alignof( T ) );
+    memset( Memory, 0, sizeof( T ) );
+    return new ( Memory ) T;
+}
+
+template< typename T >
+TArenaArray< T > FArena::AllocArray( int _Count ) {
+    static_assert( std::is_trivially_destructible< T >::value, "Arena objects must be trivially destructible" );
+    TArenaArray< T > Array;
+    Array.Count = _Count > 0 ? _Count : 0;
+    Array.Data = NULL;
+    if ( Array.Count > 0 ) {
+        Array.Data = ( T * )Alloc( sizeof( T ) * Array.Count, alignof( T ) );
+        memset( Array.Data, 0, sizeof( T ) * Array.Count );
+    }
+    return Array;
+}
+
+template< typename T >
+TArenaArray< T > FArena::CopyArray( const T * _Src, int _Count ) {
+    TArenaArray< T > Array;
+    Array.Count = _Count > 0 ? _Count : 0;
+    Array.Data = NULL;
+    if ( Array.Count > 0 ) {
+        Array.Data = ( T * )Alloc( sizeof( T ) * Array.Count, alignof( T ) );
+        memcpy( Array.Data, _Src, sizeof( T ) * Array.Count );
+    }
+    return Array;
+}
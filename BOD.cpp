@@ -25,6 +25,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "BOD.h"
 #include "BladeWorld.h"
 #include "BladeLevel.h"
+#include "BladeResidency.h"
 #include "BladeTextures.h"
 #include "BladeCSV.h"
 #include "BladeSF.h"
@@ -74,6 +75,10 @@ static FCVarBool    demo_colorgrading( "demo_colorgrading", "0" );
 static FVariable    demo_gamepath( "demo_gamepath", "E:\\Games\\Blade Of Darkness" );
 static FVariable    demo_gamelevel( "demo_gamelevel", "Maps/Mine_M5/mine.lvl" );
 static FVariable    demo_music( "demo_music", "Sounds/MAPA2.mp3" );
+static FCVarBool    demo_async_load( "demo_async_load", "1" );
+static FCVarBool    demo_streaming( "demo_streaming", "0" );
+static FCVarInt     demo_streaming_hops( "demo_streaming_hops", "2" );
+static FCVarInt     demo_streaming_budget( "demo_streaming_budget", "256" );   // Megabytes
 
 // Common objects
 static FWindow *                Window;             // Primary game window
@@ -82,9 +87,14 @@ static FSceneNode *             CameraNode;         // View camera
 static FCameraComponent *       Camera;             // View camera
 static FTextureResource *       RenderTexture;      // Render target texture
 static FRenderTarget *          RenderTarget;       // Render target owner
-static FChunkedMeshComponent *  ChunkedMesh;        // Optimized world mesh storage for fast world-ray intersection
+static FWorldComponent *        WorldComponent;     // Scene root component, owns the level world
 static FBladeTunes              Tunes;
 static FBladeModel              Model;
+static FAsyncLevelLoader        LevelLoader;        // Background level loading
+static bool                     bLevelLoaded;
+static FLevelFiles              LevelFiles;         // Files of the streamed level
+static FSectorResidency         Residency;          // Sector streaming around the camera
+static FSectorTracker           CameraSector;       // Camera sector, tracked from frame to frame
 
 // For camera record debugging
 static FCameraRecord amazona_barbaro[2];        // amazona   -> barbaro,   barbaro   -> amazona
@@ -99,6 +109,15 @@ static const char * MakePath( const char * _Path ) {
     return Tmp.Str();
 }
 
+// Attach level world to the scene
+static void SetLevelWorld( std::shared_ptr< FBladeWorld > _World ) {
+    if ( !_World ) {
+        _World = std::make_shared< FBladeWorld >();
+    }
+
+    WorldComponent->SetWorld( _World );
+}
+
 static void LoadConfigFile() {
     FFileAbstract * File = FFiles::OpenFileFromUrl( "blade.cfg", FFileAbstract::M_Read );
     if ( File ) {
@@ -181,14 +200,18 @@ static void CreateAudioForSector( const FBladeSF::FGhostSector & _Sector ) {
     Out() << "AUDIO GROUP:" << _Sector.Group << _Sector.Sound;
 }
 
+static void CreateGhostSectors( const FBladeSF & _SF ) {
+    for ( int i = 0 ; i < _SF.GhostSectors.Length() ; i++ ) {
+        CreateAudioForSector( _SF.GhostSectors[i] );
+    }
+}
+
 static void LoadGhostSectors( const char * _FileName ) {
     FBladeSF SF;
 
     SF.LoadSF( _FileName );
 
-    for ( int i = 0 ; i < SF.GhostSectors.Length() ; i++ ) {
-        CreateAudioForSector( SF.GhostSectors[i] );
-    }
+    CreateGhostSectors( SF );
 }
 
 static void LoadMusic() {
@@ -221,63 +244,54 @@ static void LoadMusic() {
     Source->Play();
 }
 
+static bool HasPortalTo( const FBladeWorld::FSector & _Sector, int _ToSector ) {
+    for ( int i = 0 ; i < _Sector.Portals.Length() ; i++ ) {
+        if ( _Sector.Portals[i]->ToSector == _ToSector ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// World data is only read here, the world can be queried from other threads meanwhile
 static void CreateAreasAndPortals() {
+    FBladeWorld * World = WorldComponent->GetWorld();
     TPodArray< FSpatialAreaComponent * > Areas;
 
-    Areas.Resize( World.Sectors.Length() );
+    Areas.Resize( World->Sectors.Length() );
     for ( int i = 0 ; i < Areas.Length() ; i++ ) {
         Areas[i] = Scene->CreateComponent< FSpatialAreaComponent >();
-        Areas[i]->SetPosition( World.Sectors[i].Bounds.Center() );
-        Areas[i]->SetBox( World.Sectors[i].Bounds.Size() + Float3(0.01f) );
+        Areas[i]->SetPosition( World->Sectors[i].Bounds.Center() );
+        Areas[i]->SetBox( World->Sectors[i].Bounds.Size() + Float3(0.01f) );
         Areas[i]->SetUseReferencePoint( true );
-        Areas[i]->SetReferencePoint( World.Sectors[i].Centroid );
+        Areas[i]->SetReferencePoint( World->Sectors[i].Centroid );
     }
 
-    for ( int i = 0 ; i < World.Sectors.Length() ; i++ ) {
-        FBladeWorld::FSector & Sector = World.Sectors[i];
-        for ( int j = 0 ; j < Sector.Portals.Length() ; j++ ) {
-            Sector.Portals[j]->Marked = false;
-        }
-    }
-
-    PolygonF Winding;
-    for ( int i = 0 ; i < World.Sectors.Length() ; i++ ) {
-        FBladeWorld::FSector & Sector = World.Sectors[i];
+    for ( int i = 0 ; i < World->Sectors.Length() ; i++ ) {
+        const FBladeWorld::FSector & Sector = World->Sectors[i];
 
         for ( int j = 0 ; j < Sector.Portals.Length() ; j++ ) {
-            FBladeWorld::FPortal * Portal = Sector.Portals[j];
+            const FBladeWorld::FPortal * Portal = Sector.Portals[j];
 
-            if ( Portal->Marked ) {
+            // One spatial portal per pair: skip the portal if it was created from the sector behind it
+            if ( Portal->ToSector < i && HasPortalTo( World->Sectors[Portal->ToSector], i ) ) {
                 continue;
             }
 
-            FBladeWorld::FSector & Next = World.Sectors[Portal->ToSector];
-            for ( int k = 0 ; k < Next.Portals.Length() ; k++ ) {
-                FBladeWorld::FPortal * NextPortal = Next.Portals[k];
-                if ( NextPortal->ToSector != i ) {
-                    continue;
-                }
-                NextPortal->Marked = true;
-            }
-
-            Winding.Resize( Portal->Winding.Length() );
-            for ( int k = 0 ; k < Winding.Length() ; k++ ) {
-                Winding[k] = Float3( Portal->Winding[k] * BLADE_COORD_SCALE_D );
-            }
-
             FSpatialPortalComponent * SpatialPortal = Scene->CreateComponent< FSpatialPortalComponent >();
             SpatialPortal->SetAreas( Areas[i], Areas[Portal->ToSector] );
-            SpatialPortal->SetWinding( Winding.ToPtr(), Winding.Length() );
+            SpatialPortal->SetWinding( Portal->Winding.ToPtr(), Portal->Winding.Length() );
         }
     }
 }
 
 static void CreateCamera() {
+    FBladeWorld * World = WorldComponent->GetWorld();
     FMonitor * PrimaryMonitor = GPlatformPort->GetPrimaryMonitor();
 
     // Create camera object
     CameraNode = Scene->CreateChild( "Camera" );
-    CameraNode->SetPosition( World.Bounds.Center() );
+    CameraNode->SetPosition( World->Bounds.Center() );
 
     // Attach audio listener to camera
     CameraNode->CreateComponent< FAudioListenerComponent >();
@@ -478,7 +492,7 @@ static void CreateCamera() {
     Renderable->SetMesh( Mesh );
     Renderable->EnableShadowCast( true );
 
-    FTextureResource * Texture = GResourceManager->GetResource< FTextureResource >( "Blade/mipmapchecker.png" );//World.Faces[ 0 ]->TextureName.Str() );
+    FTextureResource * Texture = GResourceManager->GetResource< FTextureResource >( "Blade/mipmapchecker.png" );//World->Faces[ 0 ]->TextureName.Str() );
     //if ( !Texture->Load() ) {
     //    Texture = DefaultTexture;
     //}
@@ -490,14 +504,14 @@ static void CreateCamera() {
 
         //    Float4 AmbientColor;
         //    const float ColorNormalizer = 1.0f / 255.0f;
-        //    //AmbientColor.X = World.Sectors[ Face->SectorIndex ].AmbientColor[0] * ColorNormalizer;
-        //    //AmbientColor.Y = World.Sectors[ Face->SectorIndex ].AmbientColor[1] * ColorNormalizer;
-        //    //AmbientColor.Z = World.Sectors[ Face->SectorIndex ].AmbientColor[2] * ColorNormalizer;
-        //    AmbientColor.w = World.Sectors[ Face->SectorIndex ].AmbientIntensity;// * 5;
+        //    //AmbientColor.X = World->Sectors[ Face->SectorIndex ].AmbientColor[0] * ColorNormalizer;
+        //    //AmbientColor.Y = World->Sectors[ Face->SectorIndex ].AmbientColor[1] * ColorNormalizer;
+        //    //AmbientColor.Z = World->Sectors[ Face->SectorIndex ].AmbientColor[2] * ColorNormalizer;
+        //    AmbientColor.w = World->Sectors[ Face->SectorIndex ].AmbientIntensity;// * 5;
 
-        //    AmbientColor.X = ConvertToRGB( World.Sectors[ Face->SectorIndex ].AmbientColor[ 0 ] * ColorNormalizer );
-        //    AmbientColor.Y = ConvertToRGB( World.Sectors[ Face->SectorIndex ].AmbientColor[ 1 ] * ColorNormalizer );
-        //    AmbientColor.Z = ConvertToRGB( World.Sectors[ Face->SectorIndex ].AmbientColor[ 2 ] * ColorNormalizer );
+        //    AmbientColor.X = ConvertToRGB( World->Sectors[ Face->SectorIndex ].AmbientColor[ 0 ] * ColorNormalizer );
+        //    AmbientColor.Y = ConvertToRGB( World->Sectors[ Face->SectorIndex ].AmbientColor[ 1 ] * ColorNormalizer );
+        //    AmbientColor.Z = ConvertToRGB( World->Sectors[ Face->SectorIndex ].AmbientColor[ 2 ] * ColorNormalizer );
 
         //    #ifndef UNLIT
         //    AmbientColor.w *= 5;
@@ -531,7 +545,8 @@ AN_FORCEINLINE float ComputeGrayscaleColor( const float & _Red, const float & _G
 }
 
 static void CreateSunLight() {
-    if ( !World.HasSky ) {
+    FBladeWorld * World = WorldComponent->GetWorld();
+    if ( !World->HasSky ) {
         return;
     }
 
@@ -543,18 +558,18 @@ static void CreateSunLight() {
     FLightComponent * Light = Node->CreateComponent< FLightComponent >();
     Light->SetType( FLightComponent::T_Direction );
 
-    //Light->SetColor( World.Atmospheres[2].Color[0]/* / 255.0f*/ * World.Atmospheres[2].Intensity,
-    //                 World.Atmospheres[2].Color[1]/* / 255.0f*/ * World.Atmospheres[2].Intensity,
-    //                 World.Atmospheres[2].Color[2]/* / 255.0f*/ * World.Atmospheres[2].Intensity );
+    //Light->SetColor( World->Atmospheres[2].Color[0]/* / 255.0f*/ * World->Atmospheres[2].Intensity,
+    //                 World->Atmospheres[2].Color[1]/* / 255.0f*/ * World->Atmospheres[2].Intensity,
+    //                 World->Atmospheres[2].Color[2]/* / 255.0f*/ * World->Atmospheres[2].Intensity );
     //Light->SetColor( Float3(ComputeGrayscaleColor(SkyColorAvg.r,SkyColorAvg.g,SkyColorAvg.b) * Tunes.SunBrightness) );
     Light->SetColor( SkyColorAvg * Tunes.SunBrightness );
     Light->SetDirection( Float3( 0.707107f, -0.707107f, 0.0f ) );
     Light->SetRenderMask( 1 );
 
     //Node = Scene->CreateChild( "EnvMap" );
-    //Node->SetPosition( World.Bounds.Center() );
+    //Node->SetPosition( World->Bounds.Center() );
     //FEnvCaptureComponent * EnvCapture = Node->CreateComponent< FEnvCaptureComponent >();
-    //EnvCapture->SetBox( World.Bounds.Size() + 1.0f );
+    //EnvCapture->SetBox( World->Bounds.Size() + 1.0f );
     //EnvCapture->SetColor( Float3(0.5f) );
     //EnvCapture->SetWeight( 1.0f );
 }
@@ -562,17 +577,18 @@ static void CreateSunLight() {
 //#define LABYR
 
 static void CreateEnvCaptures() {
+    FBladeWorld * World = WorldComponent->GetWorld();
     Float4 AmbientColor;
     const float ColorNormalizer = 1.0f / 255.0f;
 
-    for ( int i = 0 ; i < World.Sectors.Length() ; i++ ) {
-        BvAxisAlignedBox & AABB = World.Sectors[i].Bounds;
+    for ( int i = 0 ; i < World->Sectors.Length() ; i++ ) {
+        BvAxisAlignedBox & AABB = World->Sectors[i].Bounds;
 
         Float3 Position = AABB.Center();
 
-        AmbientColor.X = ConvertToRGB( World.Sectors[ i ].AmbientColor[ 0 ] * ColorNormalizer );
-        AmbientColor.Y = ConvertToRGB( World.Sectors[ i ].AmbientColor[ 1 ] * ColorNormalizer );
-        AmbientColor.Z = ConvertToRGB( World.Sectors[ i ].AmbientColor[ 2 ] * ColorNormalizer );
+        AmbientColor.X = ConvertToRGB( World->Sectors[ i ].AmbientColor[ 0 ] * ColorNormalizer );
+        AmbientColor.Y = ConvertToRGB( World->Sectors[ i ].AmbientColor[ 1 ] * ColorNormalizer );
+        AmbientColor.Z = ConvertToRGB( World->Sectors[ i ].AmbientColor[ 2 ] * ColorNormalizer );
 
 #define SIMULATE_HDRI
 #ifdef SIMULATE_HDRI
@@ -585,7 +601,7 @@ static void CreateEnvCaptures() {
 
         //AmbientColor *= 0.1f;
 
-        //AmbientColor *= World.Sectors[ i ].AmbientIntensity;
+        //AmbientColor *= World->Sectors[ i ].AmbientIntensity;
         float Lum = ComputeGrayscaleColor( AmbientColor.X, AmbientColor.Y, AmbientColor.Z );
         if ( Lum < 0.01f ) {
             // too dark
@@ -596,8 +612,10 @@ static void CreateEnvCaptures() {
         Node->SetPosition( Position );
 
         bool HasSky = false;
-        for ( int f = 0 ; f < World.Sectors[i].Faces.Length() && !HasSky ; f++ ) {
-            if ( World.Sectors[i].Faces[f]->Type == FBladeWorld::FT_Skydome ) {
+        const int FirstFace = World->Sectors[i].FirstFace;
+        const int LastFace = FirstFace + World->Sectors[i].NumFaces;
+        for ( int f = FirstFace ; f < LastFace && !HasSky ; f++ ) {
+            if ( World->FaceTypes[f] == FBladeWorld::FT_Skydome ) {
                 HasSky = true;
             }
         }
@@ -630,11 +648,10 @@ static void CreateEnvCaptures() {
         }
 
         bool LittleDistance = false;
-        Double3 PositionD(Position);
-        for ( int f = 0 ; f < World.Sectors[i].Faces.Length() && !LittleDistance ; f++ ) {
-            const PlaneD & Plane = World.Sectors[i].Faces[f]->Plane;
+        for ( int f = FirstFace ; f < LastFace && !LittleDistance ; f++ ) {
+            const PlaneF & Plane = World->FacePlanes[f];
 
-            if ( Plane.Dist( PositionD ).Abs() < 0.3 ) {
+            if ( Plane.Dist( Position ).Abs() < 0.3f ) {
                 LittleDistance = true;
             }
         }
@@ -654,15 +671,16 @@ static void CreateEnvCaptures() {
 
 #ifdef LABYR
     FSceneNode * Node = Scene->CreateChild( "EnvMap" );
-    Node->SetPosition( World.Bounds.Center() );
+    Node->SetPosition( World->Bounds.Center() );
     FEnvCaptureComponent * EnvCapture = Node->CreateComponent< FEnvCaptureComponent >();
-    EnvCapture->SetBox( World.Bounds.Size() + 1.0f );
+    EnvCapture->SetBox( World->Bounds.Size() + 1.0f );
     EnvCapture->SetColor( SkyColorAvg * Tunes.SunBrightness * 0.1f );
     EnvCapture->SetWeight( 1.0f );
 #endif
 }
 
 static void CreateWorldGeometry() {
+    FBladeWorld * World = WorldComponent->GetWorld();
     BvAxisAlignedBox Bounds;
 
     // Create default texture
@@ -675,8 +693,8 @@ static void CreateWorldGeometry() {
 
     // Upload world mesh
     FStaticMeshResource * WorldMesh = GResourceManager->CreateUnnamedResource< FStaticMeshResource >();
-    WorldMesh->SetVertexData( World.MeshVertices.ToPtr(), World.MeshVertices.Length(), World.MeshIndices.ToPtr(), World.MeshIndices.Length() );
-    WorldMesh->SetMeshOffsets( World.MeshOffsets.ToPtr(), World.MeshOffsets.Length() );
+    WorldMesh->SetVertexData( World->MeshVertices.ToPtr(), World->MeshVertices.Length(), World->MeshIndices.ToPtr(), World->MeshIndices.Length() );
+    WorldMesh->SetMeshOffsets( World->MeshOffsets.ToPtr(), World->MeshOffsets.Length() );
 
 //#define WORLD_AS_ONE_MESH
 #ifdef WORLD_AS_ONE_MESH
@@ -689,7 +707,7 @@ static void CreateWorldGeometry() {
     FSceneNode * WorldNode = Scene;//Scene->CreateChild( "World" );
     FStaticMeshComponent * WorldRenderable = WorldNode->CreateComponent< FStaticMeshComponent >();
     WorldRenderable->SetMesh( WorldMesh );
-    WorldRenderable->SetBounds( World.Bounds );
+    WorldRenderable->SetBounds( World->Bounds );
     WorldRenderable->SetUseCustomBounds( true );
     WorldRenderable->EnableShadowCast( false );
 
@@ -713,27 +731,35 @@ static void CreateWorldGeometry() {
     FMaterialInstance * SkyboxMaterialInstance = SkyboxMaterial->CreateInstance();
     SkyboxMaterialInstance->Set( SkyboxMaterialInstance->AddressOf( "SmpCubemap" ), SkyboxTexture );
 
+    // Material instances are shared by all faces with the same texture
+    TPodArray< FMaterialInstance * > MaterialInstances;
+    MaterialInstances.Resize( World->TextureNames.Length() );
+    for ( int i = 0 ; i < MaterialInstances.Length() ; i++ ) {
+        MaterialInstances[i] = NULL;
+    }
+
     // Create world object
     FSceneNode * WorldNode = Scene;//Scene->CreateChild( "World" );
-    for ( int i = 0 ; i < World.MeshOffsets.Length() ; i++ ) {
-        FMeshOffset & Ofs = World.MeshOffsets[i];
-        FBladeWorld::FFace * Face = World.MeshFaces[i];
+    for ( int i = 0 ; i < World->MeshOffsets.Length() ; i++ ) {
+        FMeshOffset & Ofs = World->MeshOffsets[i];
+        int FaceIndex = World->MeshFaces[i];
+        FBladeWorld::FFace * Face = World->Faces[FaceIndex];
 
         FStaticMeshComponent * WorldRenderable = WorldNode->CreateComponent< FStaticMeshComponent >();
         WorldRenderable->SetMesh( WorldMesh );
         WorldRenderable->SetDrawRange( Ofs.IndexCount, Ofs.StartIndexLocation, Ofs.BaseVertexLocation );
         Bounds.Clear();
         for ( int k = 0 ; k < Ofs.IndexCount ; k++ ) {
-            Bounds.AddPoint( World.MeshVertices[ Ofs.BaseVertexLocation + World.MeshIndices[ Ofs.StartIndexLocation + k ] ].Position );
+            Bounds.AddPoint( World->MeshVertices[ Ofs.BaseVertexLocation + World->MeshIndices[ Ofs.StartIndexLocation + k ] ].Position );
         }
         WorldRenderable->SetBounds( Bounds );
         WorldRenderable->SetUseCustomBounds( true );
         //WorldRenderable->EnableShadowCast( Face->CastShadows );
         WorldRenderable->EnableShadowCast( false );
         WorldRenderable->SetSurfaceType( SURF_PLANAR );
-        WorldRenderable->SetSurfacePlane( PlaneF(Face->Plane) );
+        WorldRenderable->SetSurfacePlane( World->FacePlanes[FaceIndex] );
         
-        if ( Face->Type == FBladeWorld::FT_Skydome || Face->TextureName.Length() == 0 ) {
+        if ( World->FaceTypes[FaceIndex] == FBladeWorld::FT_Skydome || Face->TextureId == 0 ) {
             WorldRenderable->SetMaterialInstance( SkyboxMaterialInstance );
         } else {
 
@@ -741,20 +767,24 @@ static void CreateWorldGeometry() {
             //    ...
             //}
 
-            FTextureResource * Texture = GResourceManager->GetResource< FTextureResource >( Face->TextureName.Str() );
-            if ( !Texture->Load() ) {
-                Texture = DefaultTexture;
-            }
+            FMaterialInstance *& MaterialInstance = MaterialInstances[ Face->TextureId ];
 
-            FMaterialInstance * MaterialInstance = Material->CreateInstance();
-            MaterialInstance->Set( MaterialInstance->AddressOf( "SmpBaseColor" ), Texture );
+            if ( !MaterialInstance ) {
+                FTextureResource * Texture = GResourceManager->GetResource< FTextureResource >( World->TextureNames[ Face->TextureId ] );
+                if ( !Texture->Load() ) {
+                    Texture = DefaultTexture;
+                }
+
+                MaterialInstance = Material->CreateInstance();
+                MaterialInstance->Set( MaterialInstance->AddressOf( "SmpBaseColor" ), Texture );
+            }
 
             //Float4 AmbientColor;
             //const float ColorNormalizer = 1.0f / 255.0f;
-            //AmbientColor.X = ConvertToRGB( World.Sectors[ Face->SectorIndex ].AmbientColor[ 0 ] * ColorNormalizer );
-            //AmbientColor.Y = ConvertToRGB( World.Sectors[ Face->SectorIndex ].AmbientColor[ 1 ] * ColorNormalizer );
-            //AmbientColor.Z = ConvertToRGB( World.Sectors[ Face->SectorIndex ].AmbientColor[ 2 ] * ColorNormalizer );
-            //Float4 Color = AmbientColor * World.Sectors[ Face->SectorIndex ].AmbientIntensity;
+            //AmbientColor.X = ConvertToRGB( World->Sectors[ Face->SectorIndex ].AmbientColor[ 0 ] * ColorNormalizer );
+            //AmbientColor.Y = ConvertToRGB( World->Sectors[ Face->SectorIndex ].AmbientColor[ 1 ] * ColorNormalizer );
+            //AmbientColor.Z = ConvertToRGB( World->Sectors[ Face->SectorIndex ].AmbientColor[ 2 ] * ColorNormalizer );
+            //Float4 Color = AmbientColor * World->Sectors[ Face->SectorIndex ].AmbientIntensity;
             //float Lum = ComputeGrayscaleColor( Color.r,Color.g,Color.b );
 
             //if ( Lum < 0.01f ) {
@@ -768,14 +798,18 @@ static void CreateWorldGeometry() {
     }
 #endif
 
-    // Shadow caster as single mesh
-    if ( World.ShadowCasterMeshOffset.IndexCount > 0 ) {
+    // Shadow casters of each sector as single mesh
+    for ( int SectorIndex = 0 ; SectorIndex < World->Sectors.Length() ; SectorIndex++ ) {
+        const FMeshOffset & Range = World->Sectors[ SectorIndex ].IndexRange[ FBladeWorld::FF_CastShadows ];
+        if ( Range.IndexCount == 0 ) {
+            continue;
+        }
         FStaticMeshComponent * ShadowCaster = WorldNode->CreateComponent< FStaticMeshComponent >();
         ShadowCaster->SetMesh( WorldMesh );
-        ShadowCaster->SetDrawRange( World.ShadowCasterMeshOffset.IndexCount, World.ShadowCasterMeshOffset.StartIndexLocation, World.ShadowCasterMeshOffset.BaseVertexLocation );
+        ShadowCaster->SetDrawRange( Range.IndexCount, Range.StartIndexLocation, Range.BaseVertexLocation );
         Bounds.Clear();
-        for ( int k = 0 ; k < World.ShadowCasterMeshOffset.IndexCount ; k++ ) {
-            Bounds.AddPoint( World.MeshVertices[ World.ShadowCasterMeshOffset.BaseVertexLocation + World.MeshIndices[ World.ShadowCasterMeshOffset.StartIndexLocation + k ] ].Position );
+        for ( int k = 0 ; k < Range.IndexCount ; k++ ) {
+            Bounds.AddPoint( World->MeshVertices[ Range.BaseVertexLocation + World->MeshIndices[ Range.StartIndexLocation + k ] ].Position );
         }
         ShadowCaster->SetBounds( Bounds );
         ShadowCaster->SetUseCustomBounds( true );
@@ -784,12 +818,37 @@ static void CreateWorldGeometry() {
     }
 
     CreateEnvCaptures();
+}
 
-    // Create chunked mesh for world picking
-#ifdef DEBUG_WORLD_PICKING
-    ChunkedMesh = WorldNode->CreateComponent< FChunkedMeshComponent >();
-    ChunkedMesh->Build();
+// World sectors are created and released by the residency manager around the camera
+static void CreateStreamingWorld() {
+    // Create default texture
+    FTextureResource * DefaultTexture = GResourceManager->GetResource< FTextureResource >( "Blade/mipmapchecker.png" );
+    FTextureResource::FLoadParameters LoadParameters;
+    LoadParameters.BuildMipmaps = true;
+    LoadParameters.SRGB = true;
+    DefaultTexture->SetLoadParameters( LoadParameters );
+    DefaultTexture->Load();
+
+    // Create materials
+#ifdef UNLIT
+    FMaterialResource * Material = GResourceManager->GetResource< FMaterialResource >( "Blade/UnlitMaterial.json" );
+#else
+    FMaterialResource * Material = GResourceManager->GetResource< FMaterialResource >( "Blade/StandardMaterial.json" );
 #endif
+    Material->Load();
+
+    FMaterialResource * SkyboxMaterial = GResourceManager->GetResource< FMaterialResource >( "Blade/Skybox.json" );
+    SkyboxMaterial->Load();
+
+    FMaterialInstance * SkyboxMaterialInstance = SkyboxMaterial->CreateInstance();
+    SkyboxMaterialInstance->Set( SkyboxMaterialInstance->AddressOf( "SmpCubemap" ), SkyboxTexture );
+
+    FSceneNode * WorldNode = Scene;
+
+    Residency.SetMaxHops( demo_streaming_hops.GetInteger() );
+    Residency.SetMemoryBudget( ( size_t )demo_streaming_budget.GetInteger() << 20 );
+    Residency.Initialize( WorldComponent->GetWorld(), WorldNode, LevelFiles.Bitmaps, Material, SkyboxMaterialInstance, DefaultTexture );
 }
 
 static void CreateDebugMesh() {
@@ -797,9 +856,10 @@ static void CreateDebugMesh() {
     FPrimitiveBatchComponent * Prim = Node->CreateComponent< FPrimitiveBatchComponent >();
 
     Prim->SetColor( 1, 0, 0, 1 );
-    //Prim->DrawAABB( World.Bounds );
+    //Prim->DrawAABB( World->Bounds );
 
 #ifdef DEBUG_BLADE_MP_SECTORS
+    FBladeWorld * World = WorldComponent->GetWorld();
     FBladeMap Map;
 
     LoadMP( Map );
@@ -828,22 +888,23 @@ static void CreateDebugMesh() {
 
     Prim->SetPrimitive( P_Points );
     Prim->SetColor( 1,0,0,1 );
-    for ( int i = 0 ; i < World.Vertices.Length() ; i++ ) {
-        Prim->DrawCircle( Float3( World.Vertices[i].X*0.001f,-World.Vertices[i].Y*0.001f,-World.Vertices[i].Z*0.001f ), 0.1f );
+    for ( int i = 0 ; i < World->Vertices.Length() ; i++ ) {
+        Prim->DrawCircle( Float3( World->Vertices[i].X*0.001f,-World->Vertices[i].Y*0.001f,-World->Vertices[i].Z*0.001f ), 0.1f );
     }
     Prim->Flush();
 #endif
 
 #ifdef DEBUG_BLADE_FACE_PORTAL
+    FBladeWorld * World = WorldComponent->GetWorld();
     Prim->SetPrimitive( P_LineLoop );
     Prim->SetZTest( true );
-    for ( int i = 0 ; i < World.Sectors.Length() ; i++ ) {
-        for ( int j = 0 ; j < World.Sectors[i].Faces.Length() ; j++ ) {
-            FBladeWorld::FFace * f = World.Sectors[i].Faces[j];
-            if ( f->Type == FBladeWorld::FT_Portal ) {
-                for ( int k = 0 ; k < f->Indices.Length() ; k++ ) {
-                    Double3 & v = World.Vertices[ f->Indices[k] ];
-                    Prim->EmitPoint( v.X*0.001f, -v.Y*0.001f, -v.Z*0.001f );
+    for ( int i = 0 ; i < World->Sectors.Length() ; i++ ) {
+        for ( int j = 0 ; j < World->Sectors[i].Portals.Length() ; j++ ) {
+            FBladeWorld::FPortal * Portal = World->Sectors[i].Portals[j];
+            if ( World->FaceTypes[ Portal->Face->Index ] == FBladeWorld::FT_Portal ) {
+                for ( int k = Portal->Winding.Length() - 1 ; k >= 0 ; k-- ) {
+                    Float3 & v = Portal->Winding[ k ];
+                    Prim->EmitPoint( v.X, v.Y, v.Z );
                 }
                 Prim->Flush();
             }
@@ -893,33 +954,6 @@ static void CreateDebugMesh() {
 #endif
 }
 
-// TODO:   
-static int FindSector( const Double3 & Pos ) {
-    bool Inside;
-    int SectorIndex = -1;
-    EPlaneSide Offset;
-    for ( int i = 0 ; i < World.Sectors.Length() ; i++ ) {
-        FBladeWorld::FSector & Sector = World.Sectors[i];
-
-        Inside = true;
-        for ( int f = 0 ; f < Sector.Faces.Length() ; f++ ) {
-            FBladeWorld::FFace * Face = Sector.Faces[f];
-
-            Offset = Face->Plane.SideOffset( Pos, 0.0 );
-            if ( Offset != EPlaneSide::Front ) {
-                Inside = false;
-                break;
-            }
-        }
-
-        if ( Inside ) {
-            SectorIndex = i;
-            break;
-        }
-    }
-    return SectorIndex;
-}
-
 static void DebugCharacterSelection( float _TimeStep ) {
 #ifdef DEBUG_CHARACTER_SELECTION
     static FCameraRecord * Record = &barbaro_caballero[0];
@@ -1018,14 +1052,18 @@ static void DebugCharacterSelection( float _TimeStep ) {
 
 static void DebugWorldPicking() {
 #ifdef DEBUG_WORLD_PICKING
+    FBladeWorld * World = WorldComponent->GetWorld();
     ImVec2 MousePos = ImGui::GetMousePos();
     FSegment Segment = Camera->RetrieveRay( MousePos.X, MousePos.Y );
-    FChunkedMeshComponent::FRaycastResult Result;
+    FWorldRaycastResult Result;
 
-    bool Intersected = ChunkedMesh->Raycast( Segment.start, Segment.end, Result );
+    // Raycast locates the sector of the segment start and walks the sector graph from there, no picking
+    // structure over the world mesh is needed. With streaming only resident sectors are hit.
+    std::shared_ptr< const FWorldQuery > Query = World->GetQuery();
+    bool Intersected = Query && Query->Raycast( Segment.start, Segment.end, Result );
     if ( Intersected ) {
 
-        Float3 Vec = ( Segment.end - Segment.start ) * Result.Distance;
+        Float3 Vec = ( Segment.end - Segment.start ) * Result.Fraction;
         float VecLength = FMath::Length( Vec );
         const float SphereRadius = 0.6f;
         Float3 Pos = Segment.start + ( VecLength > 0.0f ? ( Vec / VecLength ) * ( VecLength - 0.01f ) : Float3(0.0f) ); // Shift little epsilon
@@ -1062,13 +1100,13 @@ static void DebugWorldPicking() {
             StaticMesh->SetMaterialInstance( PickerMaterial );
         }
         Mover->SetPosition( Pos );
-        int Sector = FindSector( Pos );
+        int Sector = Result.Sector;
         if ( Sector >= 0 ) {
             Float4 AmbientColor;
-            AmbientColor.X = World.Sectors[ Sector ].AmbientColor[0] / 255.0f;
-            AmbientColor.Y = World.Sectors[ Sector ].AmbientColor[1] / 255.0f;
-            AmbientColor.Z = World.Sectors[ Sector ].AmbientColor[2] / 255.0f;
-            AmbientColor.w = World.Sectors[ Sector ].AmbientIntensity;// * 5;
+            AmbientColor.X = World->Sectors[ Sector ].AmbientColor[0] / 255.0f;
+            AmbientColor.Y = World->Sectors[ Sector ].AmbientColor[1] / 255.0f;
+            AmbientColor.Z = World->Sectors[ Sector ].AmbientColor[2] / 255.0f;
+            AmbientColor.w = World->Sectors[ Sector ].AmbientIntensity;// * 5;
 
 #ifndef UNLIT
             AmbientColor.w *= 5;
@@ -1081,6 +1119,7 @@ static void DebugWorldPicking() {
 }
 
 static void DebugKeypress( float _TimeStep ) {
+    FBladeWorld * World = WorldComponent->GetWorld();
     if ( Window->IsKeyPressed( Key_F, false ) ) {
         r_faceCull.SetBool( !r_faceCull.GetBool() );
     }
@@ -1106,7 +1145,7 @@ static void DebugKeypress( float _TimeStep ) {
         r_spatialCull.ToggleBool();
     }
 
-    if ( World.HasSky ) {
+    if ( World->HasSky ) {
         const float TurnSpeed = _TimeStep;
 
         if ( Window->IsKeyDown( Key_LEFTARROW ) ) {
@@ -1179,6 +1218,7 @@ static void UpdateCameraMovement( float _TimeStep ) {
 
 static void DebugSectorPortals( const FBladeWorld::FSector & Sector ) {
 #ifdef DEBUG_PORTALS
+    FBladeWorld * World = WorldComponent->GetWorld();
     static FPrimitiveBatchComponent * DebugPortals = NULL;
 
     if ( !DebugPortals ) {
@@ -1190,31 +1230,24 @@ static void DebugSectorPortals( const FBladeWorld::FSector & Sector ) {
     DebugPortals->SetZTest( false );
 
     // Draw sector faces
-    for ( int j = 0 ; j < Sector.Faces.Length() ; j++ ) {
-        FBladeWorld::FFace & f = *Sector.Faces[ j ];
-        if ( f.Type == FBladeWorld::FT_Portal ) {
-            continue;
-        }
-        if ( !f.Vertices.Length() ) {
-            // Sky or simple face
-            DebugPortals->SetColor( 1,1,0,0.2f);
-            DebugPortals->SetPrimitive( P_TriangleFan );
-            for ( int k = f.Indices.Length()-1 ; k >=0  ; k-- ) {
-                Double3 & v = World.Vertices[ f.Indices[ k ] ];
-
-                DebugPortals->EmitPoint( v.X*0.001f, -v.Y*0.001f, -v.Z*0.001f );
+    DebugPortals->SetPrimitive( P_Triangles );
+    for ( int Group = 0 ; Group < 2 ; Group++ ) {
+        for ( int j = Sector.FirstMeshOffset[ Group ] ; j < Sector.FirstMeshOffset[ Group ] + Sector.NumMeshOffsets[ Group ] ; j++ ) {
+            const FMeshOffset & Offset = World->MeshOffsets[ j ];
+            const int Type = World->FaceTypes[ World->MeshFaces[ j ] ];
+            if ( Type == FBladeWorld::FT_Face || Type == FBladeWorld::FT_Subface ) {
+                // Face with holes
+                DebugPortals->SetColor( 1,1,1,0.2f);
+            } else {
+                // Sky or simple face
+                DebugPortals->SetColor( 1,1,0,0.2f);
             }
-        } else {
-            // Face with holes
-            DebugPortals->SetPrimitive( P_Triangles );
-            DebugPortals->SetColor( 1,1,1,0.2f);
-            for ( int k = f.Indices.Length()-1 ; k >=0  ; k-- ) {
-                Double3 & v = f.Vertices[ f.Indices[ k ] ];
-
-                DebugPortals->EmitPoint( v.X*0.001f, -v.Y*0.001f, -v.Z*0.001f );
+            for ( unsigned int k = 0 ; k < Offset.IndexCount ; k++ ) {
+                const Float3 & v = World->MeshVertices[ Offset.BaseVertexLocation + World->MeshIndices[ Offset.StartIndexLocation + k ] ].Position;
+                DebugPortals->EmitPoint( v.X, v.Y, v.Z );
             }
+            DebugPortals->Flush();
         }
-        DebugPortals->Flush();
     }
 
     // Draw sector portals
@@ -1223,21 +1256,11 @@ static void DebugSectorPortals( const FBladeWorld::FSector & Sector ) {
         DebugPortals->SetColor( 0,0,1,0.2f);
         DebugPortals->SetPrimitive( P_TriangleFan );
         for ( int k = 0 ; k < Portal->Winding.Length() ; k++ ) {
-            Double3 & v = Portal->Winding[ k ];
-            DebugPortals->EmitPoint( v.X*0.001f, -v.Y*0.001f, -v.Z*0.001f );
+            Float3 & v = Portal->Winding[ k ];
+            DebugPortals->EmitPoint( v.X, v.Y, v.Z );
         }
         DebugPortals->Flush();
     }
-
-    //DebugPortals->SetPrimitive( P_LineLoop );
-    //for ( int j = 0 ; j < Sector.Portals.Length() ; j++ ) {
-    //    FBladeWorld::FFace & f = *Sector.Portals[ j ].Face;
-    //    for ( int k = 0 ; k < f.Indices.Length() ; k++ ) {
-    //        Double3 & v = World.Vertices[ f.Indices[ k ] ];
-    //        DebugPortals->EmitPoint( v.X*0.001f, -v.Y*0.001f, -v.Z*0.001f );
-    //    }
-    //    DebugPortals->Flush();
-    //}
 #endif
 }
 
@@ -1261,7 +1284,7 @@ void FGame::OnInitialize() {
 
     Scene = FCore::TNew< FScene >();
 
-    Scene->GetOrCreateComponent< FWorldComponent >();
+    WorldComponent = Scene->GetOrCreateComponent< FWorldComponent >();
     Scene->GetOrCreateComponent< FPhysicsComponent >();
 
     //GAudioSystem->SetMasterGain( 0.0f );
@@ -1367,13 +1390,47 @@ Model.LoadModel( "E:/Games/Blade of Darkness/3DChars/Skl.BOD" );
     
     
     
-    LoadLevel( MakePath( demo_gamelevel.GetString() ) );
+    if ( demo_streaming.GetBool() ) {
+        // Only the skydome and sector index are loaded here, sectors are streamed in OnUpdate
+        std::shared_ptr< FBladeWorld > LevelWorld = OpenLevel( MakePath( demo_gamelevel.GetString() ), LevelFiles );
+        if ( !LevelWorld ) {
+            Out() << "Failed to open level";
+        }
+        SetLevelWorld( LevelWorld );
+        LoadGhostSectors( MakePath( SFName.Str() ) );
+
+        OnLevelLoaded();
+        return;
+    }
+
+    if ( demo_async_load.GetBool() ) {
+        // MakePath returns a static buffer
+        FString LevelName = MakePath( demo_gamelevel.GetString() );
+
+        // Textures and world geometry are loaded in background. Scene is completed in OnUpdate.
+        LevelLoader.Start( LevelName.Str(), MakePath( SFName.Str() ) );
+        return;
+    }
+
+    SetLevelWorld( LoadLevel( MakePath( demo_gamelevel.GetString() ) ) );
     LoadGhostSectors( MakePath( SFName.Str() ) );
+
+    OnLevelLoaded();
+}
+
+void FGame::OnLevelLoaded() {
     LoadMusic();
-    CreateAreasAndPortals();
+    if ( !demo_streaming.GetBool() ) {
+        // Sector portals are not known until sectors are loaded
+        CreateAreasAndPortals();
+    }
     CreateCamera();
     CreateSunLight();
-    CreateWorldGeometry();
+    if ( demo_streaming.GetBool() ) {
+        CreateStreamingWorld();
+    } else {
+        CreateWorldGeometry();
+    }
     CreateDebugMesh();
 
     Scene->SetDebugDrawFlags( 0 );// EDebugDrawFlags::DRAW_LIGHTS );
@@ -1426,9 +1483,16 @@ Model.LoadModel( "E:/Games/Blade of Darkness/3DChars/Skl.BOD" );
     Window->SetSwapControlMode( ESwapControl::Synchronized );
 
     ImGui_Create( Window );
+
+    bLevelLoaded = true;
 }
 
 void FGame::OnShutdown() {
+    LevelLoader.Cancel();
+
+    // Stop the loader thread while the world and scene are alive
+    Residency.Shutdown();
+
     Scene.Reset();
 
     ImGui_Release();
@@ -1635,14 +1699,47 @@ void FGame::OnUpdateGui( FUpdateGuiEvent & _Event ) {
 void FGame::OnUpdate( float _TimeStep ) {
     static int PrevSectorIndex = -1;
 
+    if ( !bLevelLoaded ) {
+        static int PrevPercent = -1;
+
+        if ( !LevelLoader.Update() ) {
+            FAsyncLevelLoader::EState State = LevelLoader.GetState();
+            if ( State == FAsyncLevelLoader::S_Canceled || State == FAsyncLevelLoader::S_Failed ) {
+                Out() << "Failed to load level";
+                Terminate();
+                return;
+            }
+
+            int Percent = LevelLoader.GetProgress() * 100;
+            if ( Percent != PrevPercent ) {
+                Out() << "Loading level:" << Percent << "%";
+                PrevPercent = Percent;
+            }
+            return;
+        }
+
+        SetLevelWorld( LevelLoader.GetWorld() );
+        CreateGhostSectors( LevelLoader.GetGhostSectors() );
+
+        OnLevelLoaded();
+        return;
+    }
+
     DebugKeypress( _TimeStep );
     DebugCharacterSelection( _TimeStep );
     DebugWorldPicking();
     UpdateCameraMovement( _TimeStep );
 
-    int SectorIndex = FindSector( Double3( CameraNode->GetPosition() ) );
+    FBladeWorld * World = WorldComponent->GetWorld();
+
+    int SectorIndex = CameraSector.Update( World->GetQuery(), CameraNode->GetPosition() );
+
+    if ( demo_streaming.GetBool() ) {
+        Residency.Update( SectorIndex );
+    }
+
     if ( SectorIndex >= 0 && SectorIndex != PrevSectorIndex ) {
-        FBladeWorld::FSector & Sector = World.Sectors[SectorIndex];
+        FBladeWorld::FSector & Sector = World->Sectors[SectorIndex];
 
         PrevSectorIndex = SectorIndex;
 
@@ -48,4 +48,8 @@ public:
     void OnChar( FCharEvent & _Event );
     void OnMouseMove( FMouseMoveEvent & _Event );
     void OnUpdateGui( FUpdateGuiEvent & _Event );
+
+private:
+    // Create scene objects for loaded level
+    void OnLevelLoaded();
 };
@@ -30,6 +30,9 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 FTextureResource * SkyboxTexture;
 Float3 SkyColorAvg;
+FWorldCache GWorldCache;
+
+static FCVarInt     world_cache_size( "world_cache_size", "2" );
 
 // Skip sequences of //
 static void FixPath( char * _Path ) {
@@ -44,7 +47,8 @@ static void FixPath( char * _Path ) {
     }
 }
 
-void LoadLevel( const char * _FileName ) {
+// Read file names from .LVL file
+bool ParseLevel( const char * _FileName, FLevelFiles & _Files ) {
     char Str[256];
     char Key[256];
     char Value[256];
@@ -52,9 +56,13 @@ void LoadLevel( const char * _FileName ) {
 
     FString FileLocation = FString( _FileName ).StripFilename();
 
+    _Files.Bitmaps.Clear();
+    _Files.Dome.Clear();
+    _Files.World.Clear();
+
     FFileAbstract * File = FFiles::OpenFileFromUrl( _FileName, FFileAbstract::M_Read );
     if ( !File ) {
-        return;
+        return false;
     }
 
     while ( File->Gets( Str, sizeof( Str ) - 1 ) ) {
@@ -80,11 +88,11 @@ void LoadLevel( const char * _FileName ) {
         Out() << "OPTIMIZED:" << FinalFileName;
 
         if ( !FString::CmpCase( Key, "Bitmaps" ) ) {
-            LoadTextures( FinalFileName.Str() );
+            _Files.Bitmaps.Append( FinalFileName );
         } else if ( !FString::CmpCase( Key, "WorldDome" ) ) {
-            SkyboxTexture = LoadDome( FinalFileName.Str(), &SkyColorAvg );
+            _Files.Dome = FinalFileName;
         } else if ( !FString::CmpCase( Key, "World" ) ) {
-            World.LoadWorld( FinalFileName.Str() );
+            _Files.World = FinalFileName;
         } else {
             Out() << "LoadLevel: Unknown key" << Key;
         }
@@ -92,10 +100,282 @@ void LoadLevel( const char * _FileName ) {
 
     FFiles::CloseFile( File );
 
-    if ( !SkyboxTexture ) {
+    if ( _Files.Dome.Length() == 0 ) {
         // Try to load default dome
-        FString DomeName = _FileName;
-        DomeName.StripExt().Concat( "_d.mmp" );
-        SkyboxTexture = LoadDome( DomeName.Str(), &SkyColorAvg );
+        _Files.Dome = _FileName;
+        _Files.Dome.StripExt().Concat( "_d.mmp" );
+    }
+
+    return true;
+}
+
+std::shared_ptr< FBladeWorld > FWorldCache::Find( const char * _LevelName ) {
+    for ( int i = 0 ; i < Entries.Length() ; i++ ) {
+        if ( !FString::Icmp( Entries[ i ].LevelName.Str(), _LevelName ) ) {
+            Entries[ i ].LastUsed = ++Counter;
+            return Entries[ i ].World;
+        }
+    }
+    return NULL;
+}
+
+void FWorldCache::Add( const char * _LevelName, std::shared_ptr< FBladeWorld > _World ) {
+    const int Capacity = FMath::Max( world_cache_size.GetInteger(), 0 );
+
+    for ( int i = 0 ; i < Entries.Length() ; i++ ) {
+        if ( !FString::Icmp( Entries[ i ].LevelName.Str(), _LevelName ) ) {
+            Entries[ i ].World = _World;
+            Entries[ i ].LastUsed = ++Counter;
+            return;
+        }
+    }
+
+    // Evict least recently used worlds. Worlds that are still owned by a scene stay alive until the scene releases them.
+    while ( Entries.Length() > 0 && Entries.Length() >= Capacity ) {
+        int Oldest = 0;
+        for ( int i = 1 ; i < Entries.Length() ; i++ ) {
+            if ( Entries[ i ].LastUsed < Entries[ Oldest ].LastUsed ) {
+                Oldest = i;
+            }
+        }
+        Entries.Remove( Oldest );
+    }
+
+    if ( Capacity == 0 ) {
+        return;
+    }
+
+    FEntry Entry;
+    Entry.LevelName = _LevelName;
+    Entry.World = _World;
+    Entry.LastUsed = ++Counter;
+    Entries.Append( Entry );
+}
+
+void FWorldCache::Clear() {
+    Entries.Clear();
+}
+
+// Texture coordinates of the world depend on texture sizes. Only texture headers are read.
+static void SetTextureSizes( FBladeWorld * _World, const FLevelFiles & _Files ) {
+    TArray< FTextureInfo > Infos;
+
+    for ( int i = 0 ; i < _Files.Bitmaps.Length() ; i++ ) {
+        ReadTextureInfos( _Files.Bitmaps[ i ].Str(), Infos );
+    }
+
+    for ( int i = 0 ; i < Infos.Length() ; i++ ) {
+        _World->SetTextureSize( Infos[ i ].Name.Str(), Infos[ i ].Width, Infos[ i ].Height );
+    }
+}
+
+// Open .LVL file for sector streaming. Textures are not loaded, sectors are loaded on demand.
+// Streamed worlds are not cached, they are owned by the residency manager's scene.
+std::shared_ptr< FBladeWorld > OpenLevel( const char * _FileName, FLevelFiles & _Files ) {
+    if ( !ParseLevel( _FileName, _Files ) ) {
+        return NULL;
+    }
+
+    SkyboxTexture = LoadDome( _Files.Dome.Str(), &SkyColorAvg );
+
+    std::shared_ptr< FBladeWorld > World = std::make_shared< FBladeWorld >();
+
+    SetTextureSizes( World.get(), _Files );
+
+    if ( _Files.World.Length() == 0 || !World->OpenWorld( _Files.World.Str() ) ) {
+        return NULL;
+    }
+
+    return World;
+}
+
+std::shared_ptr< FBladeWorld > LoadLevel( const char * _FileName ) {
+    FLevelFiles Files;
+
+    if ( !ParseLevel( _FileName, Files ) ) {
+        return NULL;
+    }
+
+    for ( int i = 0 ; i < Files.Bitmaps.Length() ; i++ ) {
+        LoadTextures( Files.Bitmaps[ i ].Str() );
+    }
+
+    SkyboxTexture = LoadDome( Files.Dome.Str(), &SkyColorAvg );
+
+    std::shared_ptr< FBladeWorld > World = GWorldCache.Find( _FileName );
+
+    if ( !World ) {
+        World = std::make_shared< FBladeWorld >();
+
+        SetTextureSizes( World.get(), Files );
+
+        if ( Files.World.Length() == 0 || !World->LoadWorld( Files.World.Str() ) ) {
+            return NULL;
+        }
+
+        GWorldCache.Add( _FileName, World );
+    }
+
+    return World;
+}
+
+FAsyncLevelLoader::FAsyncLevelLoader()
+    : State( S_Idle )
+    , bCancel( false )
+    , bCachedWorld( false )
+    , NumDecodeSteps( 0 )
+    , NumDecodeStepsDone( 0 )
+    , bWorldLoaded( false )
+    , NextUpload( 0 )
+    , bDomeUploaded( false )
+{
+}
+
+FAsyncLevelLoader::~FAsyncLevelLoader() {
+    Cancel();
+    Wait();
+}
+
+void FAsyncLevelLoader::Start( const char * _LevelName, const char * _SFName ) {
+    Cancel();
+    Wait();
+
+    LevelName = _LevelName;
+    SFName = _SFName ? _SFName : "";
+
+    // Worlds are looked up in the cache on the main thread, the loader thread only builds a new one
+    World = GWorldCache.Find( _LevelName );
+    bCachedWorld = World != NULL;
+    if ( !World ) {
+        World = std::make_shared< FBladeWorld >();
+    }
+
+    Textures.Clear();
+    GhostSectors.GhostSectors.Clear();
+    bCancel = false;
+    NumDecodeSteps = 0;
+    NumDecodeStepsDone = 0;
+    bWorldLoaded = false;
+    NextUpload = 0;
+    bDomeUploaded = false;
+    State = S_Loading;
+
+    Thread = std::thread( &FAsyncLevelLoader::LoadThread, this );
+}
+
+void FAsyncLevelLoader::Cancel() {
+    bCancel = true;
+}
+
+void FAsyncLevelLoader::Wait() {
+    if ( Thread.joinable() ) {
+        Thread.join();
+    }
+}
+
+// Worker side: the world is built on this thread (using the job pool for faces), while textures,
+// skydome and ghost sectors are decoded on a second thread, so file reading overlaps face building.
+void FAsyncLevelLoader::LoadThread() {
+    FLevelFiles Files;
+
+    if ( !ParseLevel( LevelName.Str(), Files ) ) {
+        Out() << "Failed to load level" << LevelName;
+        State = S_Failed;
+        return;
+    }
+
+    NumDecodeSteps = Files.Bitmaps.Length() + 2;
+
+    std::thread Decoder( [this, &Files]() {
+        for ( int i = 0 ; i < Files.Bitmaps.Length() && !bCancel ; i++ ) {
+            DecodeTextures( Files.Bitmaps[ i ].Str(), Textures, &bCancel );
+            NumDecodeStepsDone++;
+        }
+
+        if ( !bCancel ) {
+            DecodeDome( Files.Dome.Str(), Dome, &SkyColorAvg );
+        }
+        NumDecodeStepsDone++;
+
+        if ( !bCancel && SFName.Length() > 0 ) {
+            GhostSectors.LoadSF( SFName.Str() );
+        }
+        NumDecodeStepsDone++;
+    } );
+
+    bool bFailed = false;
+    if ( !bCancel && !bCachedWorld ) {
+        SetTextureSizes( World.get(), Files );
+        bFailed = Files.World.Length() == 0 || !World->LoadWorld( Files.World.Str() );
+    }
+    bWorldLoaded = true;
+
+    Decoder.join();
+
+    if ( bFailed && !bCancel ) {
+        Out() << "Failed to load world of level" << LevelName;
+        World.reset();
+        State = S_Failed;
+        return;
+    }
+
+    State = bCancel ? S_Canceled : S_Uploading;
+}
+
+// Main thread side: upload decoded resources a few at a time, so the window keeps updating
+bool FAsyncLevelLoader::Update( int _MaxUploads ) {
+    if ( State != S_Uploading ) {
+        return State == S_Done;
+    }
+
+    Wait();
+
+    for ( int i = 0 ; i < _MaxUploads && NextUpload < Textures.Length() ; i++ ) {
+        if ( bCancel ) {
+            State = S_Canceled;
+            return false;
+        }
+        UploadTexture( Textures[ NextUpload++ ] );
+    }
+
+    if ( NextUpload < Textures.Length() ) {
+        return false;
+    }
+
+    if ( !bDomeUploaded ) {
+        SkyboxTexture = Dome.bValid ? UploadDome( Dome ) : NULL;
+        bDomeUploaded = true;
     }
+
+    Textures.Clear();
+
+    if ( !bCachedWorld ) {
+        GWorldCache.Add( LevelName.Str(), World );
+    }
+
+    State = S_Done;
+    return true;
+}
+
+float FAsyncLevelLoader::GetProgress() const {
+    // Loading on worker threads takes the first 80%, uploading the rest
+    const int DecodeSteps = NumDecodeSteps;
+
+    float Progress = 0.0f;
+
+    if ( State == S_Loading ) {
+        if ( DecodeSteps > 0 ) {
+            Progress += 0.4f * NumDecodeStepsDone / DecodeSteps;
+        }
+        if ( bWorldLoaded ) {
+            Progress += 0.4f;
+        }
+        return Progress;
+    }
+
+    if ( State == S_Uploading ) {
+        return 0.8f + ( Textures.Length() > 0 ? 0.2f * NextUpload / Textures.Length() : 0.0f );
+    }
+
+    return State == S_Done ? 1.0f : 0.0f;
 }
@@ -26,8 +26,122 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include <Engine/Renderer/Public/TextureResource.h>
 
-// Load .LVL file
-void LoadLevel( const char * _FileName );
+#include "BladeTextures.h"
+#include "BladeSF.h"
+
+#include <thread>
+#include <atomic>
+#include <memory>
+
+struct FBladeWorld;
+
+// Files referenced by .LVL file
+struct FLevelFiles {
+    TArray< FString > Bitmaps;
+    FString Dome;
+    FString World;
+};
+
+// Read file names from .LVL file
+bool ParseLevel( const char * _FileName, FLevelFiles & _Files );
+
+// Recently used worlds with their compiled meshes, so returning to a level doesn't load its world again.
+// Worlds are keyed by .LVL file name and evicted in LRU order, world_cache_size worlds are kept.
+// Use from the main thread.
+class FWorldCache {
+public:
+    // Returns NULL if the world of the level is not cached
+    std::shared_ptr< FBladeWorld > Find( const char * _LevelName );
+
+    void Add( const char * _LevelName, std::shared_ptr< FBladeWorld > _World );
+
+    void Clear();
+
+private:
+    struct FEntry {
+        FString LevelName;
+        std::shared_ptr< FBladeWorld > World;
+        int64_t LastUsed;
+    };
+
+    TArray< FEntry > Entries;
+    int64_t Counter = 0;
+};
+
+extern FWorldCache GWorldCache;
+
+// Load .LVL file. Returns world of the level, NULL if the level can't be read.
+std::shared_ptr< FBladeWorld > LoadLevel( const char * _FileName );
+
+// Load skydome and open the world of .LVL file for sector streaming (see FBladeWorld::OpenWorld).
+// Returns NULL if the world can't be opened.
+std::shared_ptr< FBladeWorld > OpenLevel( const char * _FileName, FLevelFiles & _Files );
+
+// Level loading in background. Files are parsed, textures decoded and the world is built on worker
+// threads. Engine resources are created by Update on the main thread. Don't access the world until
+// loading is done. Worlds found in GWorldCache are not loaded again.
+class FAsyncLevelLoader {
+public:
+    enum EState {
+        S_Idle,
+        S_Loading,          // Worker threads are running
+        S_Uploading,        // Waiting for Update to upload resources
+        S_Done,
+        S_Canceled,
+        S_Failed
+    };
+
+    FAsyncLevelLoader();
+    ~FAsyncLevelLoader();
+
+    // Start loading .LVL file and optional .SF file with ghost sectors
+    void Start( const char * _LevelName, const char * _SFName );
+
+    // Request to stop loading. Worker threads stop at the next texture or loading stage.
+    void Cancel();
+
+    // Call from the main thread every frame. Uploads at most _MaxUploads textures per call.
+    // Returns true when the level is ready.
+    bool Update( int _MaxUploads = 16 );
+
+    EState GetState() const { return State; }
+
+    // Loading progress in [0, 1]
+    float GetProgress() const;
+
+    // Ghost sectors loaded from .SF file. Valid when loading is done.
+    const FBladeSF & GetGhostSectors() const { return GhostSectors; }
+
+    // Loaded world. Valid when loading is done.
+    std::shared_ptr< FBladeWorld > GetWorld() const { return World; }
+
+private:
+    FAsyncLevelLoader( const FAsyncLevelLoader & ) = delete;
+    FAsyncLevelLoader & operator=( const FAsyncLevelLoader & ) = delete;
+
+    void LoadThread();
+    void Wait();
+
+    std::thread Thread;
+    std::atomic< EState > State;
+    std::atomic< bool > bCancel;
+    FString LevelName;
+    FString SFName;
+
+    // Decoded data
+    std::shared_ptr< FBladeWorld > World;
+    bool bCachedWorld;
+    TArray< FDecodedTexture > Textures;
+    FDecodedDome Dome;
+    FBladeSF GhostSectors;
+
+    // Progress
+    std::atomic< int > NumDecodeSteps;
+    std::atomic< int > NumDecodeStepsDone;
+    std::atomic< bool > bWorldLoaded;
+    int NextUpload;
+    bool bDomeUploaded;
+};
 
 extern FTextureResource * SkyboxTexture;
 extern Float3 SkyColorAvg;
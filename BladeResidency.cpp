@@ -0,0 +1,559 @@
+/*
+
+Blade Of Darkness Remake GPL Source Code
+
+Copyright (C) 2017 Alexander Samusev.
+
+This file is part of the Blade Of Darkness Remake GPL Source Code (BladeRemake Source Code).  
+
+BladeRemake is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+#include "BladeResidency.h"
+
+#include <Engine/Resource/Public/ResourceManager.h>
+
+FSectorResidency::FSectorResidency()
+    : World( NULL )
+    , Node( NULL )
+    , Material( NULL )
+    , SkyMaterialInstance( NULL )
+    , DefaultTexture( NULL )
+    , Frame( 0 )
+    , MaxHops( 2 )
+    , MemoryBudget( 256 << 20 )
+    , ResidentBytes( 0 )
+    , NumResidentSectors( 0 )
+    , NextJob( 0 )
+    , bShutdown( false )
+{
+}
+
+FSectorResidency::~FSectorResidency() {
+    Shutdown();
+}
+
+void FSectorResidency::Initialize( FBladeWorld * _World,
+                                   FSceneNode * _Node,
+                                   const TArray< FString > & _TextureFiles,
+                                   FMaterialResource * _Material,
+                                   FMaterialInstance * _SkyMaterialInstance,
+                                   FTextureResource * _DefaultTexture ) {
+    Shutdown();
+
+    World = _World;
+    Node = _Node;
+    TextureFiles = _TextureFiles;
+    Material = _Material;
+    SkyMaterialInstance = _SkyMaterialInstance;
+    DefaultTexture = _DefaultTexture;
+
+    Sectors.Resize( World->Sectors.Length() );
+    for ( int i = 0 ; i < Sectors.Length() ; i++ ) {
+        FSector & Sector = Sectors[ i ];
+        Sector.State = SS_Unloaded;
+        Sector.LastUsedFrame = -1;
+        Sector.Mesh = NULL;
+        Sector.MeshResource = NULL;
+        Sector.MeshBytes = 0;
+    }
+
+    Frame = 0;
+    ResidentBytes = 0;
+    NumResidentSectors = 0;
+    bShutdown = false;
+
+    Thread = std::thread( &FSectorResidency::LoaderThread, this );
+}
+
+void FSectorResidency::Shutdown() {
+    if ( Thread.joinable() ) {
+        {
+            std::unique_lock< std::mutex > Lock( Mutex );
+            bShutdown = true;
+        }
+        WakeUp.notify_all();
+        Thread.join();
+    }
+
+    for ( int i = 0 ; i < Results.Length() ; i++ ) {
+        delete Results[ i ].Mesh;
+        delete Results[ i ].Texture;
+    }
+    Results.Clear();
+    Jobs.Clear();
+    NextJob = 0;
+
+    for ( int i = 0 ; i < Sectors.Length() ; i++ ) {
+        EvictSector( i );
+    }
+    Sectors.Clear();
+
+    for ( int i = 0 ; i < Textures.Length() ; i++ ) {
+        delete Textures[ i ].Decoded;
+    }
+    Textures.Clear();
+
+    WantedSectors.Clear();
+    World = NULL;
+}
+
+void FSectorResidency::PushJob( const FJob & _Job ) {
+    {
+        std::unique_lock< std::mutex > Lock( Mutex );
+        Jobs.Append( _Job );
+    }
+    WakeUp.notify_one();
+}
+
+// Loader side. Jobs are executed in the order they were pushed, so nearest sectors are loaded first.
+void FSectorResidency::LoaderThread() {
+    for ( ;; ) {
+        FJob Job;
+
+        {
+            std::unique_lock< std::mutex > Lock( Mutex );
+
+            WakeUp.wait( Lock, [this]() { return bShutdown || NextJob < Jobs.Length(); } );
+
+            if ( bShutdown ) {
+                return;
+            }
+
+            Job = Jobs[ NextJob++ ];
+            if ( NextJob == Jobs.Length() ) {
+                Jobs.Clear();
+                NextJob = 0;
+            }
+        }
+
+        FJobResult Result;
+        Result.Type = Job.Type;
+        Result.Index = Job.Index;
+        Result.bSuccess = false;
+        Result.Mesh = NULL;
+        Result.Texture = NULL;
+
+        if ( Job.Type == JT_LoadSector ) {
+            Result.Mesh = new FBladeWorld::FSectorMesh;
+            Result.bSuccess = World->LoadSector( Job.Index, Result.Mesh );
+
+            // Texture table of the world grows while sectors are loaded, so names are passed with the result
+            if ( Result.bSuccess ) {
+                for ( int i = 0 ; i < Result.Mesh->Materials.Length() ; i++ ) {
+                    const int TextureId = Result.Mesh->Materials[ i ];
+                    if ( TextureId >= Result.TextureNames.Length() ) {
+                        Result.TextureNames.Resize( TextureId + 1 );
+                    }
+                    Result.TextureNames[ TextureId ] = World->TextureNames[ TextureId ];
+                }
+            }
+        } else {
+            Result.Texture = new FDecodedTexture;
+            for ( int i = 0 ; i < TextureFiles.Length() && !Result.bSuccess ; i++ ) {
+                Result.bSuccess = DecodeTexture( TextureFiles[ i ].Str(), Job.TextureName.Str(), *Result.Texture );
+            }
+        }
+
+        std::unique_lock< std::mutex > Lock( Mutex );
+        Results.Append( Result );
+    }
+}
+
+void FSectorResidency::Update( int _CameraSector, int _MaxUploads ) {
+    if ( !World ) {
+        return;
+    }
+
+    Frame++;
+
+    ProcessResults();
+
+    UpdateWantedSectors( _CameraSector );
+
+    EvictOverBudget();
+
+    RequestSectors();
+
+    // Create components, nearest sectors first
+    int NumUploads = 0;
+    for ( int i = 0 ; i < WantedSectors.Length() && NumUploads < _MaxUploads ; i++ ) {
+        if ( Sectors[ WantedSectors[ i ] ].State == SS_Loaded && CreateSectorComponents( WantedSectors[ i ] ) ) {
+            NumUploads++;
+        }
+    }
+}
+
+void FSectorResidency::ProcessResults() {
+    TArray< FJobResult > Done;
+
+    {
+        std::unique_lock< std::mutex > Lock( Mutex );
+        Done = Results;
+        Results.Clear();
+    }
+
+    for ( int r = 0 ; r < Done.Length() ; r++ ) {
+        FJobResult & Result = Done[ r ];
+
+        if ( Result.Type == JT_DecodeTexture ) {
+            FTexture & Texture = Textures[ Result.Index ];
+
+            if ( !Result.bSuccess ) {
+                delete Result.Texture;
+                Result.Texture = NULL;
+            }
+
+            Texture.Decoded = Result.Texture;
+
+            if ( Texture.RefCount > 0 ) {
+                CreateTextureResource( Result.Index );
+            } else {
+                // All sectors that use the texture were evicted while decoding
+                delete Texture.Decoded;
+                Texture.Decoded = NULL;
+                Texture.State = TS_Unloaded;
+            }
+            continue;
+        }
+
+        FSector & Sector = Sectors[ Result.Index ];
+
+        if ( !Result.bSuccess ) {
+            Out() << "WARNING: Couldn't load sector" << Result.Index;
+            delete Result.Mesh;
+            Sector.State = SS_Failed;
+            continue;
+        }
+
+        FBladeWorld::FSectorMesh * Mesh = Result.Mesh;
+
+        Sector.Mesh = Mesh;
+        Sector.Neighbors = Mesh->Neighbors;
+        // Streamed sectors don't leave data in the world, the mesh and its copy in the query snapshot
+        // are all the sector holds
+        Sector.MeshBytes = Mesh->Vertices.Length() * ( sizeof( FMeshVertex ) + sizeof( Float3 ) )
+                         + Mesh->Indices.Length() * sizeof( unsigned int ) * 2
+                         + Mesh->MeshOffsets.Length() * ( sizeof( FMeshOffset ) + sizeof( int ) + sizeof( byte ) )
+                         + Mesh->Neighbors.Length() * sizeof( int );
+        Sector.State = SS_Loaded;
+
+        // Raycasts hit the sector from now on
+        World->SetSectorTriangles( Result.Index, Mesh );
+
+        ResidentBytes += Sector.MeshBytes;
+
+        // Reference textures of the sector. Texture id 0 is drawn with the sky material.
+        Sector.Textures.Clear();
+        for ( int i = 0 ; i < Mesh->Materials.Length() ; i++ ) {
+            const int TextureId = Mesh->Materials[ i ];
+
+            if ( TextureId == 0 ) {
+                continue;
+            }
+
+            bool bReferenced = false;
+            for ( int t = 0 ; t < Sector.Textures.Length() && !bReferenced ; t++ ) {
+                bReferenced = Sector.Textures[ t ] == TextureId;
+            }
+            if ( bReferenced ) {
+                continue;
+            }
+
+            Sector.Textures.Append( TextureId );
+
+            while ( Textures.Length() <= TextureId ) {
+                FTexture Texture;
+                Texture.State = TS_Unloaded;
+                Texture.RefCount = 0;
+                Texture.Decoded = NULL;
+                Texture.Resource = NULL;
+                Texture.MaterialInstance = NULL;
+                Texture.Bytes = 0;
+                Textures.Append( Texture );
+            }
+
+            FTexture & Texture = Textures[ TextureId ];
+
+            Texture.Name = Result.TextureNames[ TextureId ];
+            Texture.RefCount++;
+
+            if ( Texture.State == TS_Unloaded ) {
+                Texture.State = TS_Decoding;
+
+                FJob Job;
+                Job.Type = JT_DecodeTexture;
+                Job.Index = TextureId;
+                Job.TextureName = Texture.Name;
+                PushJob( Job );
+            }
+        }
+    }
+}
+
+// Breadth-first walk over portals of the sectors with known neighbors. The wanted set grows as
+// sectors are loaded and their portals become known.
+void FSectorResidency::UpdateWantedSectors( int _CameraSector ) {
+    WantedSectors.Clear();
+
+    if ( _CameraSector < 0 || _CameraSector >= Sectors.Length() ) {
+        // Keep resident sectors until the camera is back in the world
+        return;
+    }
+
+    // Sectors are marked as visited with the current frame
+    Sectors[ _CameraSector ].LastUsedFrame = Frame;
+    WantedSectors.Append( _CameraSector );
+
+    int HopBegin = 0;
+    for ( int Hop = 0 ; Hop < MaxHops ; Hop++ ) {
+        const int HopEnd = WantedSectors.Length();
+
+        for ( int i = HopBegin ; i < HopEnd ; i++ ) {
+            const TPodArray< int > & Neighbors = Sectors[ WantedSectors[ i ] ].Neighbors;
+
+            for ( int n = 0 ; n < Neighbors.Length() ; n++ ) {
+                const int Neighbor = Neighbors[ n ];
+
+                if ( Neighbor < 0 || Neighbor >= Sectors.Length() || Sectors[ Neighbor ].LastUsedFrame == Frame ) {
+                    continue;
+                }
+
+                Sectors[ Neighbor ].LastUsedFrame = Frame;
+                WantedSectors.Append( Neighbor );
+            }
+        }
+
+        HopBegin = HopEnd;
+    }
+}
+
+// Request loading of wanted sectors, nearest first. Over the budget only the camera sector is loaded.
+void FSectorResidency::RequestSectors() {
+    for ( int i = 0 ; i < WantedSectors.Length() ; i++ ) {
+        FSector & Sector = Sectors[ WantedSectors[ i ] ];
+
+        if ( Sector.State != SS_Unloaded ) {
+            continue;
+        }
+
+        if ( i > 0 && ResidentBytes >= MemoryBudget ) {
+            break;
+        }
+
+        Sector.State = SS_Loading;
+
+        FJob Job;
+        Job.Type = JT_LoadSector;
+        Job.Index = WantedSectors[ i ];
+        PushJob( Job );
+    }
+}
+
+void FSectorResidency::CreateTextureResource( int _TextureId ) {
+    FTexture & Texture = Textures[ _TextureId ];
+
+    if ( Texture.Decoded ) {
+        Texture.Bytes = ( size_t )Texture.Decoded->Width * Texture.Decoded->Height * 4 * 4 / 3; // RGBA with mipmaps
+        Texture.Resource = ::UploadTexture( *Texture.Decoded );
+
+        delete Texture.Decoded;
+        Texture.Decoded = NULL;
+    } else {
+        Out() << "WARNING: Texture not found" << Texture.Name;
+        Texture.Bytes = 0;
+        Texture.Resource = DefaultTexture;
+    }
+
+    // Material instance is kept for the texture id. Texture resources are named, so the instance
+    // refers to the same texture object after it was purged and uploaded again.
+    if ( !Texture.MaterialInstance ) {
+        Texture.MaterialInstance = Material->CreateInstance();
+    }
+    Texture.MaterialInstance->Set( Texture.MaterialInstance->AddressOf( "SmpBaseColor" ), Texture.Resource );
+
+    Texture.State = TS_Resident;
+
+    ResidentBytes += Texture.Bytes;
+}
+
+void FSectorResidency::ReleaseTexture( int _TextureId ) {
+    FTexture & Texture = Textures[ _TextureId ];
+
+    assert( Texture.RefCount > 0 );
+
+    if ( --Texture.RefCount > 0 || Texture.State != TS_Resident ) {
+        // Decoding textures are dropped when the decoded data arrives
+        return;
+    }
+
+    if ( Texture.Resource != DefaultTexture ) {
+        Texture.Resource->Purge();
+    }
+    Texture.Resource = NULL;
+    Texture.State = TS_Unloaded;
+
+    ResidentBytes -= Texture.Bytes;
+    Texture.Bytes = 0;
+}
+
+// Create one component per run of the same shadow flag and material, and a shadow caster for the sector.
+// Returns false if sector textures are not uploaded yet.
+bool FSectorResidency::CreateSectorComponents( int _SectorIndex ) {
+    FSector & Sector = Sectors[ _SectorIndex ];
+
+    for ( int i = 0 ; i < Sector.Textures.Length() ; i++ ) {
+        if ( Textures[ Sector.Textures[ i ] ].State != TS_Resident ) {
+            return false;
+        }
+    }
+
+    const FBladeWorld::FSectorMesh & Mesh = *Sector.Mesh;
+
+    if ( Mesh.Indices.Length() > 0 ) {
+        Sector.MeshResource = GResourceManager->CreateUnnamedResource< FStaticMeshResource >();
+        Sector.MeshResource->SetVertexData( Mesh.Vertices.ToPtr(), Mesh.Vertices.Length(), Mesh.Indices.ToPtr(), Mesh.Indices.Length() );
+        Sector.MeshResource->SetMeshOffsets( Mesh.MeshOffsets.ToPtr(), Mesh.MeshOffsets.Length() );
+    }
+
+    FMeshOffset ShadowCasterRange;
+    ShadowCasterRange.BaseVertexLocation = 0;
+    ShadowCasterRange.StartIndexLocation = 0;
+    ShadowCasterRange.IndexCount = 0;
+
+    BvAxisAlignedBox Bounds;
+
+    for ( int i = 0 ; i < Mesh.MeshOffsets.Length() ; ) {
+        const int TextureId = Mesh.Materials[ i ];
+        const int Flags = Mesh.Flags[ i ] & FBladeWorld::FF_CastShadows;
+
+        // Mesh offsets are sorted by shadow flag and material, so runs are contiguous
+        FMeshOffset Range = Mesh.MeshOffsets[ i ];
+        int Next = i + 1;
+        while ( Next < Mesh.MeshOffsets.Length()
+                && Mesh.Materials[ Next ] == TextureId
+                && ( Mesh.Flags[ Next ] & FBladeWorld::FF_CastShadows ) == Flags ) {
+            Range.IndexCount += Mesh.MeshOffsets[ Next ].IndexCount;
+            Next++;
+        }
+        i = Next;
+
+        if ( Flags ) {
+            if ( ShadowCasterRange.IndexCount == 0 ) {
+                ShadowCasterRange = Range;
+            } else {
+                ShadowCasterRange.IndexCount += Range.IndexCount;
+            }
+        }
+
+        Bounds.Clear();
+        for ( int k = 0 ; k < Range.IndexCount ; k++ ) {
+            Bounds.AddPoint( Mesh.Vertices[ Range.BaseVertexLocation + Mesh.Indices[ Range.StartIndexLocation + k ] ].Position );
+        }
+
+        FStaticMeshComponent * Component = Node->CreateComponent< FStaticMeshComponent >();
+        Component->SetMesh( Sector.MeshResource );
+        Component->SetDrawRange( Range.IndexCount, Range.StartIndexLocation, Range.BaseVertexLocation );
+        Component->SetBounds( Bounds );
+        Component->SetUseCustomBounds( true );
+        Component->EnableShadowCast( false );
+        Component->SetMaterialInstance( TextureId == 0 ? SkyMaterialInstance : Textures[ TextureId ].MaterialInstance );
+        Sector.Components.Append( Component );
+    }
+
+    if ( ShadowCasterRange.IndexCount > 0 ) {
+        FStaticMeshComponent * ShadowCaster = Node->CreateComponent< FStaticMeshComponent >();
+        ShadowCaster->SetMesh( Sector.MeshResource );
+        ShadowCaster->SetDrawRange( ShadowCasterRange.IndexCount, ShadowCasterRange.StartIndexLocation, ShadowCasterRange.BaseVertexLocation );
+        ShadowCaster->SetBounds( Mesh.Bounds );
+        ShadowCaster->SetUseCustomBounds( true );
+        ShadowCaster->EnableShadowCast( true );
+        ShadowCaster->EnableLightPass( false );
+        Sector.Components.Append( ShadowCaster );
+    }
+
+    // Mesh data is on the GPU now
+    delete Sector.Mesh;
+    Sector.Mesh = NULL;
+
+    Sector.State = SS_Resident;
+    NumResidentSectors++;
+
+    return true;
+}
+
+void FSectorResidency::EvictSector( int _SectorIndex ) {
+    FSector & Sector = Sectors[ _SectorIndex ];
+
+    if ( Sector.State != SS_Loaded && Sector.State != SS_Resident ) {
+        return;
+    }
+
+    for ( int i = 0 ; i < Sector.Components.Length() ; i++ ) {
+        Sector.Components[ i ]->Destroy();
+    }
+    Sector.Components.Clear();
+
+    if ( Sector.MeshResource ) {
+        Sector.MeshResource->Purge();
+        Sector.MeshResource = NULL;
+    }
+
+    delete Sector.Mesh;
+    Sector.Mesh = NULL;
+
+    for ( int i = 0 ; i < Sector.Textures.Length() ; i++ ) {
+        ReleaseTexture( Sector.Textures[ i ] );
+    }
+    Sector.Textures.Clear();
+
+    World->SetSectorTriangles( _SectorIndex, NULL );
+
+    ResidentBytes -= Sector.MeshBytes;
+    Sector.MeshBytes = 0;
+
+    if ( Sector.State == SS_Resident ) {
+        NumResidentSectors--;
+    }
+
+    // Neighbors are kept, they don't change when the sector is loaded again
+    Sector.State = SS_Unloaded;
+}
+
+// Evict least recently used sectors that are not wanted in this frame
+void FSectorResidency::EvictOverBudget() {
+    while ( ResidentBytes > MemoryBudget ) {
+        int Victim = -1;
+
+        for ( int i = 0 ; i < Sectors.Length() ; i++ ) {
+            const FSector & Sector = Sectors[ i ];
+
+            if ( ( Sector.State != SS_Loaded && Sector.State != SS_Resident ) || Sector.LastUsedFrame == Frame ) {
+                continue;
+            }
+
+            if ( Victim < 0 || Sector.LastUsedFrame < Sectors[ Victim ].LastUsedFrame ) {
+                Victim = i;
+            }
+        }
+
+        if ( Victim < 0 ) {
+            break;
+        }
+
+        EvictSector( Victim );
+    }
+}
@@ -0,0 +1,170 @@
+/*
+
+Blade Of Darkness Remake GPL Source Code
+
+Copyright (C) 2017 Alexander Samusev.
+
+This file is part of the Blade Of Darkness Remake GPL Source Code (BladeRemake Source Code).  
+
+BladeRemake is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+#pragma once
+
+#include "BladeWorld.h"
+#include "BladeTextures.h"
+
+#include <Engine/Scene/Public/Scene.h>
+#include <Engine/Renderer/Public/StaticMeshComponent.h>
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+// Streams world sectors around the camera. Sectors within N portal hops of the camera sector are kept
+// resident with their textures and materials, other sectors are evicted in LRU order when the memory
+// budget is exceeded. Sectors are parsed and triangulated and textures are decoded on a loader thread,
+// engine resources and scene components are created and destroyed by Update on the main thread.
+// The world must be opened with FBladeWorld::OpenWorld, the loader thread owns sector loading then.
+class FSectorResidency {
+public:
+    FSectorResidency();
+    ~FSectorResidency();
+
+    // Start streaming. Sector components are created in _Node. Faces without texture use _SkyMaterialInstance,
+    // textures missing in _TextureFiles are replaced by _DefaultTexture.
+    void Initialize( FBladeWorld * _World,
+                     FSceneNode * _Node,
+                     const TArray< FString > & _TextureFiles,
+                     FMaterialResource * _Material,
+                     FMaterialInstance * _SkyMaterialInstance,
+                     FTextureResource * _DefaultTexture );
+
+    // Stop the loader thread and release all sectors
+    void Shutdown();
+
+    // Portal hops from the camera sector that are kept resident
+    void SetMaxHops( int _MaxHops ) { MaxHops = _MaxHops; }
+
+    // Soft limit for mesh and texture memory. Sectors within N hops are never evicted.
+    void SetMemoryBudget( size_t _Bytes ) { MemoryBudget = _Bytes; }
+
+    // Call from the main thread every frame. Creates components of at most _MaxUploads sectors per call.
+    // _CameraSector can be -1 if the camera is outside of the world.
+    void Update( int _CameraSector, int _MaxUploads = 4 );
+
+    // Mesh and texture bytes of resident sectors
+    size_t GetResidentBytes() const { return ResidentBytes; }
+
+    int GetNumResidentSectors() const { return NumResidentSectors; }
+
+private:
+    FSectorResidency( const FSectorResidency & ) = delete;
+    FSectorResidency & operator=( const FSectorResidency & ) = delete;
+
+    enum ESectorState {
+        SS_Unloaded,
+        SS_Loading,         // Queued for the loader thread
+        SS_Loaded,          // Mesh is ready, waiting for textures
+        SS_Resident,        // Components are created
+        SS_Failed
+    };
+
+    enum ETextureState {
+        TS_Unloaded,
+        TS_Decoding,
+        TS_Resident
+    };
+
+    struct FSector {
+        ESectorState State;
+        int64_t LastUsedFrame;
+        FBladeWorld::FSectorMesh * Mesh;        // Loaded mesh until components are created
+        FStaticMeshResource * MeshResource;
+        TPodArray< FStaticMeshComponent * > Components;
+        TPodArray< int > Textures;              // Referenced texture ids
+        TPodArray< int > Neighbors;
+        size_t MeshBytes;
+    };
+
+    struct FTexture {
+        ETextureState State;
+        FString Name;
+        int RefCount;
+        FDecodedTexture * Decoded;              // Decoded pixels until upload
+        FTextureResource * Resource;
+        FMaterialInstance * MaterialInstance;
+        size_t Bytes;
+    };
+
+    enum EJobType {
+        JT_LoadSector,
+        JT_DecodeTexture
+    };
+
+    struct FJob {
+        EJobType Type;
+        int Index;
+        FString TextureName;
+    };
+
+    struct FJobResult {
+        EJobType Type;
+        int Index;
+        bool bSuccess;
+        FBladeWorld::FSectorMesh * Mesh;
+        TArray< FString > TextureNames;         // Names of the texture ids used by the mesh, indexed by texture id
+        FDecodedTexture * Texture;
+    };
+
+    void LoaderThread();
+    void PushJob( const FJob & _Job );
+
+    void ProcessResults();
+    void UpdateWantedSectors( int _CameraSector );
+    bool CreateSectorComponents( int _SectorIndex );
+    void CreateTextureResource( int _TextureId );
+    void ReleaseTexture( int _TextureId );
+    void EvictSector( int _SectorIndex );
+    void EvictOverBudget();
+    void RequestSectors();
+
+    FBladeWorld * World;
+    FSceneNode * Node;
+    TArray< FString > TextureFiles;
+    FMaterialResource * Material;
+    FMaterialInstance * SkyMaterialInstance;
+    FTextureResource * DefaultTexture;
+
+    TArray< FSector > Sectors;
+    TArray< FTexture > Textures;
+    TPodArray< int > WantedSectors;             // Sectors within N hops, nearest first
+    int64_t Frame;
+    int MaxHops;
+    size_t MemoryBudget;
+    size_t ResidentBytes;
+    int NumResidentSectors;
+
+    // Loader thread
+    std::thread Thread;
+    std::mutex Mutex;
+    std::condition_variable WakeUp;
+    TArray< FJob > Jobs;
+    int NextJob;
+    TArray< FJobResult > Results;
+    bool bShutdown;
+};
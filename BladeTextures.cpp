@@ -56,17 +56,74 @@ FTextureResource * LoadTexture( const char * _TextureName, const byte * _TrueCol
     return Texture;
 }
 
-// Load textures from .MMP file
-void LoadTextures( const char * _FileName ) {
+// Convert texture data to true color
+static bool DecodeTextureData( int _Type, int _Width, int _Height, byte * _TextureData, FDecodedTexture & _Decoded ) {
+    _Decoded.Width = _Width;
+    _Decoded.Height = _Height;
+
+    switch ( _Type ) {
+    case TT_Palette:
+    {
+        byte * Palette = _TextureData + _Width * _Height;
+
+        _Decoded.TrueColor.Resize( _Width * _Height * 3 );
+        byte * TrueColor = _Decoded.TrueColor.ToPtr();
+
+        for ( int j = 0; j < _Height; ++j ) {
+            for ( int k = j*_Width; k < ( j + 1 )*_Width; ++k ) {
+                TrueColor[ k * 3 + 2 ] = Palette[ _TextureData[ k ] * 3     ] << 2;
+                TrueColor[ k * 3 + 1 ] = Palette[ _TextureData[ k ] * 3 + 1 ] << 2;
+                TrueColor[ k * 3     ] = Palette[ _TextureData[ k ] * 3 + 2 ] << 2;
+            }
+        }
+        return true;
+    }
+    case TT_Grayscaled:
+    {
+        _Decoded.TrueColor.Resize( _Width * _Height * 3 );
+        byte * TrueColor = _Decoded.TrueColor.ToPtr();
+
+        for ( int j = 0; j < _Height; ++j ) {
+            for ( int k = j*_Width; k < ( j + 1 )*_Width; ++k ) {
+                TrueColor[ k * 3     ] = _TextureData[ k ];
+                TrueColor[ k * 3 + 1 ] = _TextureData[ k ];
+                TrueColor[ k * 3 + 2 ] = _TextureData[ k ];
+            }
+        }
+        return true;
+    }
+    case TT_TrueColor:
+    {
+        // Swap to bgr
+        int Count = _Width * _Height * 3;
+        for ( int j = 0; j < Count ; j += 3 ) {
+            FCore::SwapArgs( _TextureData[ j ], _TextureData[ j + 2 ] );
+        }
+        _Decoded.TrueColor.Resize( Count );
+        memcpy( _Decoded.TrueColor.ToPtr(), _TextureData, Count );
+        return true;
+    }
+    default:
+        Out() << "Unknown texture type";
+        return false;
+    }
+}
+
+// Decode textures from .MMP file to true color
+bool DecodeTextures( const char * _FileName, TArray< FDecodedTexture > & _Textures, const std::atomic< bool > * _Cancel ) {
     FFileAbstract * File = FFiles::OpenFileFromUrl( _FileName, FFileAbstract::M_Read );
 
     if ( !File ) {
-        return;
+        return false;
     }
 
     int32_t TexturesCount;
     File->ReadSwapInt32( TexturesCount );
     for ( int i = 0 ; i < TexturesCount ; i++ ) {
+        if ( _Cancel && _Cancel->load() ) {
+            break;
+        }
+
         int16_t UnknownInt16;
 
         File->ReadSwapInt16( UnknownInt16 );
@@ -95,58 +152,145 @@ void LoadTextures( const char * _FileName ) {
 
         File->Read( TextureData, TextureDataLength );
 
-        switch ( Type ) {
-        case TT_Palette:
-        {
-            byte * Palette = TextureData + Width * Height;
-            byte * TrueColor = new byte[ Width * Height * 3 ];
+        _Textures.Append( FDecodedTexture() );
+        FDecodedTexture & Decoded = _Textures.Last();
+        Decoded.Name = TextureName;
 
-            for ( int j = 0; j < Height; ++j ) {
-                for ( int k = j*Width; k < ( j + 1 )*Width; ++k ) {
-                    TrueColor[ k * 3 + 2 ] = Palette[ TextureData[ k ] * 3     ] << 2;
-                    TrueColor[ k * 3 + 1 ] = Palette[ TextureData[ k ] * 3 + 1 ] << 2;
-                    TrueColor[ k * 3     ] = Palette[ TextureData[ k ] * 3 + 2 ] << 2;
-                }
-            }
+        if ( !DecodeTextureData( Type, Width, Height, TextureData, Decoded ) ) {
+            _Textures.Resize( _Textures.Length() - 1 );
+        }
 
-            LoadTexture( TextureName.Str(), TrueColor, Width, Height );
+        delete[] TextureData;
+    }
+    FFiles::CloseFile( File );
 
-            delete[] TrueColor;
-            break;
-        }
-        case TT_Grayscaled:
-        {
-            byte * TrueColor = new byte[ Width * Height * 3 ];
-            for ( int j = 0; j < Height; ++j ) {
-                for ( int k = j*Width; k < ( j + 1 )*Width; ++k ) {
-                    TrueColor[ k * 3     ] = TextureData[ k ];
-                    TrueColor[ k * 3 + 1 ] = TextureData[ k ];
-                    TrueColor[ k * 3 + 2 ] = TextureData[ k ];
-                }
-            }
+    return true;
+}
 
-            LoadTexture( TextureName.Str(), TrueColor, Width, Height );
+// Read texture headers from .MMP file. Texture data is skipped.
+bool ReadTextureInfos( const char * _FileName, TArray< FTextureInfo > & _Textures ) {
+    FFileAbstract * File = FFiles::OpenFileFromUrl( _FileName, FFileAbstract::M_Read );
 
-            delete[] TrueColor;
-            break;
-        }
-        case TT_TrueColor:
-        {
-            // Swap to bgr
-            int Count = Width * Height * 3;
-            for ( int j = 0; j < Count ; j += 3 ) {
-                FCore::SwapArgs( TextureData[ j ], TextureData[ j + 2 ] );
-            }
-            LoadTexture( TextureName.Str(), TextureData, Width, Height );
-            break;
-        }
-        default:
-            Out() << "Unknown texture type";
+    if ( !File ) {
+        return false;
+    }
+
+    int32_t TexturesCount;
+    File->ReadSwapInt32( TexturesCount );
+    for ( int i = 0 ; i < TexturesCount ; i++ ) {
+        int16_t UnknownInt16;
+
+        File->ReadSwapInt16( UnknownInt16 );
+
+        int32_t Checksum;
+        File->ReadSwapInt32( Checksum );
+
+        int32_t Size;
+        File->ReadSwapInt32( Size );
+
+        FString TextureName;
+        File->ReadString( TextureName );
+
+        int32_t Type;
+        File->ReadSwapInt32( Type );
+
+        int32_t Width;
+        File->ReadSwapInt32( Width );
+
+        int32_t Height;
+        File->ReadSwapInt32( Height );
+
+        int32_t TextureDataLength = Size - 12;
+
+        File->Seek( TextureDataLength, FFileAbstract::SeekCur );
+
+        _Textures.Append( FTextureInfo() );
+        FTextureInfo & Info = _Textures.Last();
+        Info.Name = TextureName;
+        Info.Width = Width;
+        Info.Height = Height;
+    }
+    FFiles::CloseFile( File );
+
+    return true;
+}
+
+// Decode single texture from .MMP file. Data of other textures is skipped.
+bool DecodeTexture( const char * _FileName, const char * _TextureName, FDecodedTexture & _Texture ) {
+    FFileAbstract * File = FFiles::OpenFileFromUrl( _FileName, FFileAbstract::M_Read );
+
+    if ( !File ) {
+        return false;
+    }
+
+    bool bFound = false;
+
+    int32_t TexturesCount;
+    File->ReadSwapInt32( TexturesCount );
+    for ( int i = 0 ; i < TexturesCount ; i++ ) {
+        int16_t UnknownInt16;
+
+        File->ReadSwapInt16( UnknownInt16 );
+
+        int32_t Checksum;
+        File->ReadSwapInt32( Checksum );
+
+        int32_t Size;
+        File->ReadSwapInt32( Size );
+
+        FString TextureName;
+        File->ReadString( TextureName );
+
+        int32_t Type;
+        File->ReadSwapInt32( Type );
+
+        int32_t Width;
+        File->ReadSwapInt32( Width );
+
+        int32_t Height;
+        File->ReadSwapInt32( Height );
+
+        int32_t TextureDataLength = Size - 12;
+
+        if ( FString::Icmp( TextureName.Str(), _TextureName ) ) {
+            File->Seek( TextureDataLength, FFileAbstract::SeekCur );
+            continue;
         }
 
+        byte * TextureData = new byte[ TextureDataLength ];
+
+        File->Read( TextureData, TextureDataLength );
+
+        _Texture.Name = TextureName;
+
+        bFound = DecodeTextureData( Type, Width, Height, TextureData, _Texture );
+
         delete[] TextureData;
+        break;
     }
     FFiles::CloseFile( File );
+
+    return bFound;
+}
+
+// Upload decoded texture. Must be called from the main thread.
+FTextureResource * UploadTexture( FDecodedTexture & _Texture ) {
+    FTextureResource * Texture = LoadTexture( _Texture.Name.Str(), _Texture.TrueColor.ToPtr(), _Texture.Width, _Texture.Height );
+
+    _Texture.TrueColor.Free();
+
+    return Texture;
+}
+
+// Load textures from .MMP file
+void LoadTextures( const char * _FileName ) {
+    TArray< FDecodedTexture > Textures;
+
+    DecodeTextures( _FileName, Textures );
+
+    for ( int i = 0 ; i < Textures.Length() ; i++ ) {
+        UploadTexture( Textures[ i ] );
+    }
 }
 
 AN_FORCEINLINE float ConvertToRGB( const float & _sRGB ) {
@@ -163,16 +307,28 @@ AN_FORCEINLINE float ConvertToRGB( const float & _sRGB ) {
 #endif
 }
 
-// Load Skydome from .MMP file
-FTextureResource * LoadDome( const char * _FileName, Float3 * _SkyColorAvg ) {
+FDecodedDome::FDecodedDome() {
+    memset( Lods, 0, sizeof( Lods ) );
+    Desc.Lods = Lods;
+}
+
+FDecodedDome::~FDecodedDome() {
+    for ( int DomeFace = 0 ; DomeFace < 6 ; DomeFace++ ) {
+        delete [] (float *)Lods[DomeFace].Pixels;
+        Lods[DomeFace].Pixels = NULL;
+    }
+}
+
+// Decode Skydome from .MMP file to float cubemap faces
+bool DecodeDome( const char * _FileName, FDecodedDome & _Dome, Float3 * _SkyColorAvg ) {
     FFileAbstract * File = FFiles::OpenFileFromUrl( _FileName, FFileAbstract::M_Read );
 
     if ( !File ) {
-        return NULL;
+        return false;
     }
 
-    FTextureDesc Desc;
-    FTextureLodDesc Lods[ 6 ];
+    FTextureDesc & Desc = _Dome.Desc;
+    FTextureLodDesc * Lods = _Dome.Lods;
     Desc.ByteLength = 0;
     Desc.NumLods = 1;
     Desc.Dimension = SAMPLER_DIM_CUBEMAP;
@@ -182,8 +338,6 @@ FTextureResource * LoadDome( const char * _FileName, Float3 * _SkyColorAvg ) {
     Desc.NumLayers = 6;
     Desc.Lods = Lods;
 
-    memset( Lods, 0, sizeof( Lods ) );
-
     int32_t TexturesCount;
     File->ReadSwapInt32( TexturesCount );
     for ( int i = 0 ; i < TexturesCount ; i++ ) {
@@ -323,16 +477,35 @@ FTextureResource * LoadDome( const char * _FileName, Float3 * _SkyColorAvg ) {
     }
     FFiles::CloseFile( File );
 
+    _Dome.bValid = true;
+
+    return true;
+}
+
+// Upload decoded skydome. Must be called from the main thread.
+FTextureResource * UploadDome( FDecodedDome & _Dome ) {
     FTextureResource * Texture = GResourceManager->CreateUnnamedResource< FTextureResource >();
-    Texture->UploadImage( Desc );
+    Texture->UploadImage( _Dome.Desc );
 
     for ( int DomeFace = 0 ; DomeFace < 6 ; DomeFace++ ) {
-        delete [] (float *)Desc.Lods[DomeFace].Pixels;
+        delete [] (float *)_Dome.Lods[DomeFace].Pixels;
+        _Dome.Lods[DomeFace].Pixels = NULL;
     }
 
     return Texture;
 }
 
+// Load Skydome from .MMP file
+FTextureResource * LoadDome( const char * _FileName, Float3 * _SkyColorAvg ) {
+    FDecodedDome Dome;
+
+    if ( !DecodeDome( _FileName, Dome, _SkyColorAvg ) ) {
+        return NULL;
+    }
+
+    return UploadDome( Dome );
+}
+
 FTextureResource * CreateWhiteCubemap() {
     FTextureDesc Desc;
     FTextureLodDesc Lods[ 6 ];
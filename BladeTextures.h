@@ -26,13 +26,62 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include <Engine/Renderer/Public/TextureResource.h>
 
+#include <atomic>
+
+// Texture decoded to true color, ready for upload
+struct FDecodedTexture {
+    FString Name;
+    TPodArray< byte > TrueColor;
+    int Width;
+    int Height;
+};
+
+// Texture name and size read from .MMP file
+struct FTextureInfo {
+    FString Name;
+    int Width;
+    int Height;
+};
+
+// Skydome decoded to float cubemap faces, ready for upload
+struct FDecodedDome {
+    FTextureDesc Desc;
+    FTextureLodDesc Lods[ 6 ];
+    bool bValid = false;
+
+    FDecodedDome();
+    ~FDecodedDome();
+
+private:
+    FDecodedDome( const FDecodedDome & ) = delete;
+    FDecodedDome & operator=( const FDecodedDome & ) = delete;
+};
+
 // Load texture from memory
 FTextureResource * LoadTexture( const char * _TextureName, const byte * _TrueColor, int _Width, int _Height ) ;
 
 // Load textures from .MMP file
 void LoadTextures( const char * _FileName );
 
+// Decode textures from .MMP file. Doesn't touch engine resources, can be called from any thread.
+bool DecodeTextures( const char * _FileName, TArray< FDecodedTexture > & _Textures, const std::atomic< bool > * _Cancel = NULL );
+
+// Read names and sizes of textures in .MMP file without decoding them. Can be called from any thread.
+bool ReadTextureInfos( const char * _FileName, TArray< FTextureInfo > & _Textures );
+
+// Decode single texture from .MMP file. Returns false if the file has no such texture. Can be called from any thread.
+bool DecodeTexture( const char * _FileName, const char * _TextureName, FDecodedTexture & _Texture );
+
+// Upload decoded texture and release its pixels. Must be called from the main thread.
+FTextureResource * UploadTexture( FDecodedTexture & _Texture );
+
 // Load Skydome from .MMP file
 FTextureResource * LoadDome( const char * _FileName, Float3 * _SkyColorAvg = NULL );
 
+// Decode Skydome from .MMP file. Doesn't touch engine resources, can be called from any thread.
+bool DecodeDome( const char * _FileName, FDecodedDome & _Dome, Float3 * _SkyColorAvg = NULL );
+
+// Upload decoded skydome and release its pixels. Must be called from the main thread.
+FTextureResource * UploadDome( FDecodedDome & _Dome );
+
 FTextureResource * CreateWhiteCubemap();
@@ -23,13 +23,34 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 
 #include "BladeWorld.h"
-#include "FileDump.h"
+#include "MappedFile.h"
+#include "JobPool.h"
+#include "MeshOptimizer.h"
+#include "TexCoordGen.h"
 
 #include <Engine/Utilites/Public/PolygonClipper.h>
 #include <Engine/IO/Public/FileUrl.h>
 #include <Engine/Core/Public/Sort.h>
+#include <Engine/Utilites/Public/CmdManager.h>
 
-FBladeWorld World;
+#include <cmath>
+#include <cctype>
+#include <chrono>
+
+static FCVarBool    world_cache( "world_cache", "1" );
+static FCVarBool    world_weld( "world_weld", "1" );
+static FCVarBool    world_optimize_mesh( "world_optimize_mesh", "1" );
+static FCVarInt     world_texcoord_benchmark( "world_texcoord_benchmark", "0" );    // Iterations, 0 - disabled
+static FCVarInt     world_locate_benchmark( "world_locate_benchmark", "0" );        // Random points and path steps, 0 - disabled
+
+// Post-process options stored in the world cache
+enum EPostProcessOptions {
+    PP_WeldVertices = 1,
+    PP_OptimizeMesh = 2
+};
+
+// FIFO cache size used for mesh optimization statistics
+static const int VERTEX_CACHE_STATS_SIZE = 16;
 
 const Double3 BLADE_COORD_SCALE_D( 0.001, -0.001, -0.001 );
 const Float3 BLADE_COORD_SCALE_F( 0.001f, -0.001f, -0.001f );
@@ -94,134 +115,86 @@ static void PrintPolygons( const TArray< FClipperPolygon > & _Polygons ) {
 }
 #endif
 
+FBladeWorld::FBladeWorld()
+    : HasSky( false )
+    , BuilderOwner( NULL )
+{
+    Bounds.Clear();
+}
+
 FBladeWorld::~FBladeWorld() {
     FreeWorld();
 }
 
-void FBladeWorld::LoadWorld( const char * _FileName ) {
-    File = FFiles::OpenFileFromUrl( _FileName, FFileAbstract::M_Read );
+bool FBladeWorld::LoadWorld( const char * _FileName ) {
+    FMappedFile Mapping;
 
-    if ( !File ) {
-        return;
+    if ( !Mapping.Open( _FileName ) ) {
+        return false;
     }
 
     FreeWorld();
 
-    int32_t AtmospheresCount;
-    File->ReadSwapInt32( AtmospheresCount );
-    Atmospheres.Resize( AtmospheresCount );
-    for ( int i = 0 ; i < AtmospheresCount ; i++ ) {
-        FBladeMap::FAtmosphereEntry & Atmo = Atmospheres[ i ];
-        File->ReadString( Atmo.Name );
-        File->Read( &Atmo.Color[ 0 ], 3 );
-        File->ReadSwapFloat( Atmo.Intensity );
-    }
-
-    int32_t VerticesCount;
-    File->ReadSwapInt32( VerticesCount );
-    Vertices.Resize( VerticesCount );
-    for ( int i = 0 ; i < VerticesCount ; i++ ) {
-        File->ReadSwapDouble( Vertices[i].X.Value );
-        File->ReadSwapDouble( Vertices[i].Y.Value );
-        File->ReadSwapDouble( Vertices[i].Z.Value );
-    }
-
-    int32_t SectorsCount;
-    File->ReadSwapInt32( SectorsCount );
-    Sectors.Resize( SectorsCount );
-
-    for ( int SectorIndex = 0 ; SectorIndex < Sectors.Length() ; SectorIndex++ ) {
-        FSector & Sector = Sectors[ SectorIndex ];
-
-        SetDumpLog( true );
-
-        DumpFileOffset( File );
-
-        FString UnknownName;
-        File->ReadString( UnknownName );
-
-        Out() << "Loading sector:" << UnknownName;
-
-        File->Read( &Sector.AmbientColor[ 0 ], 3 );
-        File->ReadSwapFloat( Sector.AmbientIntensity );        
-
-        SetDumpLog( false );
-
-        DumpFloat( File );
-
-        for ( int i = 0 ; i < 24 ; i++ ) {
-            if ( DumpByte( File ) != 0 ) {
-                Out() << "not zero";
-            }
-        }
-
-        for ( int i = 0 ; i < 8 ; i++ ) {
-            if ( DumpByte( File ) != 0xCD ) {
-                Out() << "not CD";
-            }
-        }
-
-        for ( int i = 0 ; i < 4 ; i++ ) {
-            if ( DumpByte( File ) != 0 ) {
-                Out() << "not zero";
-            }
-        }
-
-        byte r,g,b;
-        r = DumpByte( File );
-        g = DumpByte( File );
-        b = DumpByte( File );
+    // Compiled world is stored next to the .BW file
+    FString CacheName = _FileName;
+    CacheName.StripExt().Concat( ".wcache" );
 
-        Out() << r << g << b;
+    uint64_t SourceHash = BladeHash64( Mapping.GetData(), Mapping.GetSize() ) ^ GetTextureSizesHash();
 
-        DumpFloat( File );
-        DumpFloat( File );
+    uint32_t Options = GetPostProcessOptions();
 
-        for ( int i = 0 ; i < 24 ; i++ ) {
-            if ( DumpByte( File ) != 0 ) {
-                Out() << "not zero";
-            }
-        }
+    if ( world_cache.GetBool() && LoadCache( CacheName.Str(), SourceHash, Mapping.GetSize(), Options ) ) {
+        Out() << "Loaded compiled world" << CacheName;
+        BuildSectorLinks();
+        PublishQuery();
+        return true;
+    }
 
-        for ( int i = 0 ; i < 8 ; i++ ) {
-            if ( DumpByte( File ) != 0xCD ) {
-                Out() << "not CD";
-            }
-        }
+    // Texture id 0 is reserved for faces without texture
+    AddTexture( "", 0 );
 
-        for ( int i = 0 ; i < 4 ; i++ ) {
-            if ( DumpByte( File ) != 0 ) {
-                Out() << "not zero";
-            }
-        }
+    Cursor = FMemoryCursor( Mapping.GetData(), Mapping.GetSize() );
 
-        // Light direction?
-        Sector.LightDir.X = DumpDouble( File );
-        Sector.LightDir.Y = -DumpDouble( File );
-        Sector.LightDir.Z = -DumpDouble( File );
-        Sector.LightDir.NormalizeSelf();
+    if ( !ReadWorldHeader() ) {
+        Cursor = FMemoryCursor();
+        FreeWorld();
+        return false;
+    }
 
-        SetDumpLog( true );
+    for ( int SectorIndex = 0 ; SectorIndex < Sectors.Length() ; SectorIndex++ ) {
+        FSector & Sector = Sectors[ SectorIndex ];
 
-        int32_t FaceCount;
-        File->ReadSwapInt32( FaceCount );
+        int32_t FaceCount = ReadSectorHeader( Sector );
 
-        if (FaceCount<4||FaceCount>100 ) {
+        if (FaceCount<4||FaceCount>100||Cursor.IsOverflow() ) {
             Out() << "WARNING: FILE READ ERROR.. SOMETHING GO WRONG!";
             Sectors.Resize(SectorIndex);
             assert(0);
             break;
         }
 
-        Sector.Faces.Resize( FaceCount );
+        // Faces of the sector are contiguous in the face table
+        Sector.FirstFace = Faces.Length();
+        Sector.NumFaces = FaceCount;
 
         for ( int FaceIndex = 0 ; FaceIndex < FaceCount ; FaceIndex++ ) {
-            Sector.Faces[FaceIndex] = CreateFace();
-            Sector.Faces[FaceIndex]->SectorIndex = SectorIndex;
-            LoadFace( Sector.Faces[FaceIndex] );
+            LoadFace( SectorIndex );
+        }
+
+        if ( Cursor.IsOverflow() ) {
+            Out() << "WARNING: UNEXPECTED END OF FILE";
+            Sectors.Resize( SectorIndex + 1 );
+            break;
         }
+
+        Sector.bLoaded = true;
     }
 
+    // Clip and triangulate recorded faces
+    BuildFaces();
+
+    CalcSectorBounds();
+
 #if 0
     typedef enum FileEndChanks {
         FEC_Unk1 = 0x00003A99, //15001
@@ -287,48 +260,168 @@ void FBladeWorld::LoadWorld( const char * _FileName ) {
         Strings[i] = DumpString( File );
     }
 #endif
-    FFiles::CloseFile( File );
+    Cursor = FMemoryCursor();
 
     WorldGeometryPostProcess();
+
+    CompactWorld();
+
+    BuildSectorLinks();
+    PublishQuery();
+
+    if ( world_cache.GetBool() ) {
+        SaveCache( CacheName.Str(), SourceHash, Mapping.GetSize(), Options );
+    }
+
+    return true;
+}
+
+// Atmospheres, vertices and sector count
+bool FBladeWorld::ReadWorldHeader() {
+    int32_t AtmospheresCount = Cursor.ReadInt32();
+    if ( !Cursor.CanRead( AtmospheresCount, 8 ) ) {
+        Out() << "WARNING: FILE READ ERROR.. SOMETHING GO WRONG!";
+        return false;
+    }
+    Atmospheres.Resize( AtmospheresCount );
+    for ( int i = 0 ; i < AtmospheresCount ; i++ ) {
+        FBladeMap::FAtmosphereEntry & Atmo = Atmospheres[ i ];
+        Cursor.ReadString( Atmo.Name );
+        Cursor.Read( &Atmo.Color[ 0 ], 3 );
+        Atmo.Intensity = Cursor.ReadFloat();
+    }
+
+    int32_t VerticesCount = Cursor.ReadInt32();
+    if ( !Cursor.CanRead( VerticesCount, sizeof( Double3 ) ) ) {
+        Out() << "WARNING: FILE READ ERROR.. SOMETHING GO WRONG!";
+        return false;
+    }
+    Vertices.Resize( VerticesCount );
+    Cursor.ReadArray( Vertices.ToPtr(), VerticesCount );
+
+    int32_t SectorsCount = Cursor.ReadInt32();
+    if ( SectorsCount < 0 ) {
+        SectorsCount = 0;
+    }
+    Sectors.Resize( SectorsCount );
+
+    for ( int SectorIndex = 0 ; SectorIndex < Sectors.Length() ; SectorIndex++ ) {
+        Sectors[ SectorIndex ].bLoaded = false;
+    }
+
+    return true;
+}
+
+// Sector properties. Returns number of sector faces, the faces follow the header.
+int FBladeWorld::ReadSectorHeader( FSector & _Sector ) {
+    FString UnknownName;
+    Cursor.ReadString( UnknownName );
+
+    Cursor.Read( &_Sector.AmbientColor[ 0 ], 3 );
+    _Sector.AmbientIntensity = Cursor.ReadFloat();
+
+    Cursor.ReadFloat();
+
+    for ( int i = 0 ; i < 24 ; i++ ) {
+        if ( Cursor.ReadByte() != 0 ) {
+            Out() << "not zero";
+        }
+    }
+
+    for ( int i = 0 ; i < 8 ; i++ ) {
+        if ( Cursor.ReadByte() != 0xCD ) {
+            Out() << "not CD";
+        }
+    }
+
+    for ( int i = 0 ; i < 4 ; i++ ) {
+        if ( Cursor.ReadByte() != 0 ) {
+            Out() << "not zero";
+        }
+    }
+
+    // Unknown color
+    Cursor.ReadByte();
+    Cursor.ReadByte();
+    Cursor.ReadByte();
+
+    Cursor.ReadFloat();
+    Cursor.ReadFloat();
+
+    for ( int i = 0 ; i < 24 ; i++ ) {
+        if ( Cursor.ReadByte() != 0 ) {
+            Out() << "not zero";
+        }
+    }
+
+    for ( int i = 0 ; i < 8 ; i++ ) {
+        if ( Cursor.ReadByte() != 0xCD ) {
+            Out() << "not CD";
+        }
+    }
+
+    for ( int i = 0 ; i < 4 ; i++ ) {
+        if ( Cursor.ReadByte() != 0 ) {
+            Out() << "not zero";
+        }
+    }
+
+    // Light direction?
+    _Sector.LightDir.X = Cursor.ReadDouble();
+    _Sector.LightDir.Y = -Cursor.ReadDouble();
+    _Sector.LightDir.Z = -Cursor.ReadDouble();
+    _Sector.LightDir.NormalizeSelf();
+
+    return Cursor.ReadInt32();
 }
 
-FBladeWorld::FFace * FBladeWorld::CreateFace() {
-    Faces.Append( new FFace );
-    return Faces.Last();
+FBladeWorld::FFace * FBladeWorld::CreateFace( int _Type, int _SectorIndex ) {
+    FFace * Face = FaceArena.New< FFace >();
+    Face->Index = Faces.Length();
+    Faces.Append( Face );
+
+    FacePlanes.Append( PlaneF() );
+    FaceSectors.Append( _SectorIndex );
+    FaceTypes.Append( _Type );
+    FaceFlags.Append( 0 );
+
+    return Face;
 }
 FBladeWorld::FPortal * FBladeWorld::CreatePortal() {
-    Portals.Append( new FPortal );
+    Portals.Append( PortalArena.New< FPortal >() );
     return Portals.Last();
 }
 
 FBladeWorld::FBSPNode * FBladeWorld::CreateBSPNode() {
-    BSPNodes.Append( new FBSPNode );
+    BSPNodes.Append( NodeArena.New< FBSPNode >() );
     return BSPNodes.Last();
 }
 
-void FBladeWorld::LoadFace( FFace * _Face ) {
-    File->ReadSwapInt32( _Face->Type );
+void FBladeWorld::LoadFace( int _SectorIndex ) {
+    int Type = Cursor.ReadInt32();
 
-    switch ( _Face->Type ) {
+    FFace * Face = CreateFace( Type, _SectorIndex );
+
+    switch ( Type ) {
         case FT_SimpleFace:
             Out() << "SimpleFace";
-            LoadSimpleFace( _Face );
+            LoadSimpleFace( Face );
             break;
         case FT_Portal:
             Out() << "Portal";
-            LoadPortalFace( _Face );
+            LoadPortalFace( Face );
             break;
         case FT_Face:
             Out() << "Face";
-            LoadFaceWithHole( _Face );
+            LoadFaceWithHole( Face );
             break;
         case FT_FaceBSP:
             Out() << "FaceBSP";
-            LoadFaceBSP( _Face );
+            LoadFaceBSP( Face );
             break;
         case FT_Skydome:
             Out() << "Skydome";
-            LoadSkydomeFace( _Face );
+            LoadSkydomeFace( Face );
             break;
         default:
             assert(0);
@@ -336,577 +429,1487 @@ void FBladeWorld::LoadFace( FFace * _Face ) {
     }
 }
 
-void FBladeWorld::ReadIndices( TPodArray< unsigned int > & _Indices ) {
-    int32_t NumIndices;
-    File->ReadSwapInt32( NumIndices );
-    _Indices.Resize( NumIndices );
-    for ( int k = 0 ; k < NumIndices ; k++ ) {
-        File->ReadSwapUInt32( _Indices[k] );
+void FBladeWorld::ReadIndices( TArenaArray< unsigned int > & _Indices, FArena & _Arena ) {
+    int32_t NumIndices = Cursor.ReadInt32();
+    if ( !Cursor.CanRead( NumIndices, sizeof( uint32_t ) ) ) {
+        Out() << "WARNING" << NumIndices << "SOMETHING GO WRONG!";
+        assert( 0 );
+        NumIndices = 0;
+    }
+    _Indices = _Arena.AllocArray< unsigned int >( NumIndices );
+    Cursor.ReadArray( _Indices.ToPtr(), NumIndices );
+
+    // Indices refer to the vertex table. Drop the array and stop reading if one of them is out of range.
+    for ( int k = 0 ; k < _Indices.Length() ; k++ ) {
+        if ( _Indices[ k ] >= ( unsigned int )GetFileVertices().Length() ) {
+            Out() << "WARNING: vertex index" << _Indices[ k ] << "out of range";
+            Cursor.Skip( Cursor.Remaining() + 1 );   // raise overflow
+            _Indices.Count = 0;
+            break;
+        }
     }
 }
 
 void FBladeWorld::ReadWinding( PolygonD & _Winding ) {
-    int32_t NumVertices;
-    int Index;
-    File->ReadSwapInt32( NumVertices );
+    int32_t NumVertices = Cursor.ReadInt32();
     if ( NumVertices == 0 || NumVertices > 32 ) {
         Out() << "WARNING" << NumVertices << "SOMETHING GO WRONG!";
         assert( 0 );
     }
+    TFileView< int32_t > Indices = Cursor.View< int32_t >( NumVertices );
+    NumVertices = Indices.Length();
+    for ( int k = 0 ; k < NumVertices ; k++ ) {
+        if ( Indices[ k ] < 0 || Indices[ k ] >= GetFileVertices().Length() ) {
+            Out() << "WARNING: vertex index" << Indices[ k ] << "out of range";
+            Cursor.Skip( Cursor.Remaining() + 1 );   // raise overflow
+            NumVertices = 0;
+            break;
+        }
+    }
     _Winding.Resize( NumVertices );
     for ( int k = 0 ; k < NumVertices ; k++ ) {
-        File->ReadSwapInt32( Index );
-        _Winding[ NumVertices - k - 1 ] = Vertices[ Index ];
+        _Winding[ NumVertices - k - 1 ] = GetFileVertices()[ Indices[ k ] ];
     }
 }
 
-void FBladeWorld::LoadSimpleFace( FFace * _Face ) {
-    // Face plane
-    File->ReadSwapVector( _Face->Plane.Normal );
-    File->ReadSwapDouble( _Face->Plane.D.Value );
+// Read face plane in file space and store it in world space
+PlaneD FBladeWorld::ReadFacePlane( int _FaceIndex ) {
+    PlaneD Plane;
+    Cursor.ReadPlane( Plane );
+    FacePlanes[ _FaceIndex ] = ConvertPlane( Plane );
+    return Plane;
+}
 
-    // FIXME: What is it?
-    File->ReadSwapUInt64( _Face->UnknownSignature );
-    if ( _Face->UnknownSignature != 3 ) {
-        Out() << "Face signature" << _Face->UnknownSignature;
+void FBladeWorld::SetPortalWinding( FPortal * _Portal, const PolygonD & _Winding ) {
+    _Portal->Winding = DataArena.AllocArray< Float3 >( _Winding.Length() );
+    for ( int k = 0 ; k < _Winding.Length() ; k++ ) {
+        _Portal->Winding[ k ] = ConvertPosition( _Winding[ k ] );
     }
+}
 
-    File->ReadString( _Face->TextureName );
-
-    File->ReadSwapVector( _Face->TexCoordAxis[0] );
-    File->ReadSwapVector( _Face->TexCoordAxis[1] );
-    File->ReadSwapFloat( _Face->TexCoordOffset[0] );
-    File->ReadSwapFloat( _Face->TexCoordOffset[1] );
-
-    _Face->TexCoordOffset[0] = -_Face->TexCoordOffset[0];
-    _Face->TexCoordOffset[1] = -_Face->TexCoordOffset[1];
+// Sector index behind the portal
+int FBladeWorld::ReadPortalTarget() {
+    int32_t ToSector = Cursor.ReadInt32();
+    if ( ToSector < 0 || ToSector >= Sectors.Length() ) {
+        Out() << "WARNING: portal to sector" << ToSector << "out of range";
+        Cursor.Skip( Cursor.Remaining() + 1 );   // raise overflow
+        return 0;
+    }
+    return ToSector;
+}
 
-    // 8 zero bytes?
-    SetDumpLog( false );
-    for ( int k = 0 ; k < 8 ; k++ ) {
-        if ( DumpByte( File ) != 0 ) {
-            Out() << "not zero!";
-        }
+void FBladeWorld::ReadPortalPlanes( TArenaArray< PlaneD > & _Planes ) {
+    int32_t Count = Cursor.ReadInt32();
+    if ( !Cursor.CanRead( Count, sizeof( PlaneD ) ) ) {
+        Out() << "WARNING" << Count << "SOMETHING GO WRONG!";
+        assert( 0 );
+        Count = 0;
     }
-    SetDumpLog( true );
+    _Planes = LoadArena.AllocArray< PlaneD >( Count );
+    Cursor.ReadArray( _Planes.ToPtr(), Count );
+}
 
-    // Winding
-    ReadIndices( _Face->Indices );
+int FBladeWorld::ReadTextureId( FMemoryCursor & _Cursor ) {
+    int Length;
+    const char * Name = _Cursor.ReadStringView( Length );
+    return AddTexture( Name ? Name : "", Name ? Length : 0 );
 }
 
-void FBladeWorld::LoadPortalFace( FFace * _Face ) {
-    // Face plane
-    File->ReadSwapVector( _Face->Plane.Normal );
-    File->ReadSwapDouble( _Face->Plane.D.Value );
+int FBladeWorld::AddTexture( const char * _Name, int _Length ) {
+    std::string Key( _Name, _Length );
 
-    // Winding
-    ReadIndices( _Face->Indices );
+    auto It = TextureIds.find( Key );
+    if ( It != TextureIds.end() ) {
+        return It->second;
+    }
 
-    FPortal * Portal = CreatePortal();
+    int Id = TextureNames.Length();
+    TextureNames.Append( DataArena.CopyString( _Name, _Length ) );
+    TextureIds[ Key ] = Id;
+    return Id;
+}
 
-    Portal->Face = _Face;
-    File->ReadSwapInt32( Portal->ToSector );
-    Portal->Winding.Resize( _Face->Indices.Length() );
-    for ( int k = 0 ; k < _Face->Indices.Length() ; k++ ) {
-        Portal->Winding[ _Face->Indices.Length() - k - 1 ] = Vertices[ _Face->Indices[k] ];
+// Texture names are compared case insensitive with .MMP texture names
+static std::string TextureSizeKey( const char * _Name ) {
+    std::string Key( _Name );
+    for ( size_t i = 0 ; i < Key.size() ; i++ ) {
+        Key[ i ] = ( char )tolower( ( unsigned char )Key[ i ] );
     }
+    return Key;
+}
 
-    Sectors[ _Face->SectorIndex ].Portals.Append( Portal );
+void FBladeWorld::SetTextureSize( const char * _Name, int _Width, int _Height ) {
+    if ( _Width <= 0 || _Height <= 0 ) {
+        return;
+    }
+    FTextureSize & Size = TextureSizes[ TextureSizeKey( _Name ) ];
+    Size.Width = _Width;
+    Size.Height = _Height;
+}
 
-    // FIXME: What is it?
-    SetDumpLog( false );
-    DumpUnknownBytes( File, 8 );
-    SetDumpLog( true );
+void FBladeWorld::GetTextureSize( int _TextureId, int & _Width, int & _Height ) const {
+    auto It = TextureSizes.find( TextureSizeKey( TextureNames[ _TextureId ] ) );
+    if ( It != TextureSizes.end() ) {
+        _Width = It->second.Width;
+        _Height = It->second.Height;
+    } else {
+        _Width = 256;
+        _Height = 256;
+    }
+}
 
-    File->ReadString( _Face->TextureName );
+// Texture sizes change texture coordinates of the compiled world. Hash doesn't depend on the order of sizes.
+uint64_t FBladeWorld::GetTextureSizesHash() const {
+    uint64_t Hash = 0;
+    for ( auto It = TextureSizes.begin() ; It != TextureSizes.end() ; ++It ) {
+        uint64_t EntryHash = BladeHash64( ( const byte * )It->first.c_str(), It->first.size() );
+        EntryHash ^= ( uint64_t( It->second.Width ) << 32 ) | uint32_t( It->second.Height );
+        Hash += BladeHash64( ( const byte * )&EntryHash, sizeof( EntryHash ) );
+    }
+    return Hash;
+}
 
-    File->ReadSwapVector( _Face->TexCoordAxis[0] );
-    File->ReadSwapVector( _Face->TexCoordAxis[1] );
-    File->ReadSwapFloat( _Face->TexCoordOffset[0] );
-    File->ReadSwapFloat( _Face->TexCoordOffset[1] );
+int FBladeWorld::FindTexture( const char * _Name ) const {
+    auto It = TextureIds.find( _Name );
+    return It != TextureIds.end() ? It->second : -1;
+}
 
-    _Face->TexCoordOffset[0] = -_Face->TexCoordOffset[0];
-    _Face->TexCoordOffset[1] = -_Face->TexCoordOffset[1];
+// Bounding planes of the sector. Returns false if they are not known.
+bool FBladeWorld::GetSectorPlanes( int _SectorIndex, const PlaneF *& _Planes, int & _NumPlanes ) const {
+    if ( SectorOffsets.Length() > 0 ) {
+        // Opened with OpenWorld: bounding planes are recorded by the sector scan
+        _Planes = SectorPlanes.ToPtr() + SectorOffsets[ _SectorIndex ].FirstPlane;
+        _NumPlanes = SectorOffsets[ _SectorIndex ].NumFaces;
+        return true;
+    }
 
-    // 8 zero bytes?
-    SetDumpLog( false );
-    for ( int k = 0 ; k < 8 ; k++ ) {
-        if ( DumpByte( File ) != 0 ) {
-            Out() << "not zero!";
-        }
+    if ( !Sectors[ _SectorIndex ].bLoaded ) {
+        return false;
     }
-    SetDumpLog( true );
+
+    _Planes = FacePlanes.ToPtr() + Sectors[ _SectorIndex ].FirstFace;
+    _NumPlanes = Sectors[ _SectorIndex ].NumFaces;
+    return true;
 }
 
-void FBladeWorld::LoadFaceWithHole( FFace * _Face ) {
-    // Face plane
-    File->ReadSwapVector( _Face->Plane.Normal );
-    File->ReadSwapDouble( _Face->Plane.D.Value );
+// Sectors are convex: the point is inside if it is in front of all sector planes
+bool FBladeWorld::IsInsideSector( int _SectorIndex, const Float3 & _Position ) const {
+    const PlaneF * Planes;
+    int NumPlanes;
 
-    // FIXME: What is it?
-    File->ReadSwapUInt64( _Face->UnknownSignature );
-    if ( _Face->UnknownSignature != 3 ) {
-        Out() << "Face signature" << _Face->UnknownSignature;
+    if ( !GetSectorPlanes( _SectorIndex, Planes, NumPlanes ) ) {
+        return false;
     }
 
-    File->ReadString( _Face->TextureName );
+    for ( int f = 0 ; f < NumPlanes ; f++ ) {
+        if ( Planes[ f ].SideOffset( _Position, 0.0f ) != EPlaneSide::Front ) {
+            return false;
+        }
+    }
 
-    File->ReadSwapVector( _Face->TexCoordAxis[0] );
-    File->ReadSwapVector( _Face->TexCoordAxis[1] );
-    File->ReadSwapFloat( _Face->TexCoordOffset[0] );
-    File->ReadSwapFloat( _Face->TexCoordOffset[1] );
+    return true;
+}
 
-    _Face->TexCoordOffset[0] = -_Face->TexCoordOffset[0];
-    _Face->TexCoordOffset[1] = -_Face->TexCoordOffset[1];
+std::shared_ptr< const FWorldQuery > FBladeWorld::GetQuery() const {
+    return std::atomic_load( &Query );
+}
 
-    // 8 zero bytes?
-    SetDumpLog( false );
-    for ( int k = 0 ; k < 8 ; k++ ) {
-        if ( DumpByte( File ) != 0 ) {
-            Out() << "not zero!";
+int FBladeWorld::LocateSector( const Float3 & _Position ) const {
+    std::shared_ptr< const FWorldQuery > CurrentQuery = GetQuery();
+    return CurrentQuery ? CurrentQuery->LocateSector( _Position ) : -1;
+}
+
+// Reference search over all sectors
+int FBladeWorld::LocateSectorLinear( const Float3 & _Position ) const {
+    for ( int SectorIndex = 0 ; SectorIndex < Sectors.Length() ; SectorIndex++ ) {
+        if ( IsInsideSector( SectorIndex, _Position ) ) {
+            return SectorIndex;
         }
     }
-    SetDumpLog( true );
+    return -1;
+}
 
-    // Winding
-    PolygonD Winding;
-    ReadWinding( Winding );
+// Sector links of a world loaded with LoadWorld. OpenWorld records them on the sector scan.
+void FBladeWorld::BuildSectorLinks() {
+    SectorFirstLink.Resize( Sectors.Length() + 1 );
+    SectorLinks.Clear();
 
-    // Winding hole
-    PolygonD Hole;
-    ReadWinding( Hole );
+    for ( int SectorIndex = 0 ; SectorIndex < Sectors.Length() ; SectorIndex++ ) {
+        const FSector & Sector = Sectors[ SectorIndex ];
 
-    FClipper Clipper;
+        SectorFirstLink[ SectorIndex ] = SectorLinks.Length();
 
-    PlaneD Plane = _Face->Plane;//Winding.CalcPlane();
+        for ( int i = 0 ; i < Sector.Portals.Length() ; i++ ) {
+            const int ToSector = Sector.Portals[ i ]->ToSector;
+            if ( ToSector >= 0 && ToSector < Sectors.Length() ) {
+                SectorLinks.Append( ToSector );
+            }
+        }
+    }
 
-    Clipper.SetNormal( Plane.Normal );
-    Clipper.AddContour3D( Winding.ToPtr(), Winding.Length(), true );
-    Clipper.AddContour3D( Hole.ToPtr(), Hole.Length(), false );
+    SectorFirstLink[ Sectors.Length() ] = SectorLinks.Length();
+}
 
-    TArray< FClipperPolygon > ResultPolygons;
-    Clipper.Execute( FClipper::CLIP_DIFF, ResultPolygons );
+// Bounds of sector faces and portals. Face triangulations cover the face windings, other faces refer
+// to world vertices. Call after BuildFaces, before CompactWorld.
+void FBladeWorld::CalcSectorBounds() {
+    SectorBounds.Resize( Sectors.Length() );
 
-    //PrintPolygons( ResultPolygons );
+    for ( int SectorIndex = 0 ; SectorIndex < Sectors.Length() ; SectorIndex++ ) {
+        const FSector & Sector = Sectors[ SectorIndex ];
+        BvAxisAlignedBox & Bounds = SectorBounds[ SectorIndex ];
 
-    typedef TTriangulator< Double2, Double2 > FTriangulator;
-    FTriangulator Triangulator;
-    TPodArray< FTriangulator::FPolygon * > Polygons;
-    TArray< Double2 > ResultVertices;
-    for ( int i = 0 ; i < ResultPolygons.Length() ; i++ ) {
-        FTriangulator::FPolygon * Polygon = new FTriangulator::FPolygon;
+        Bounds.Clear();
 
-        Polygon->OuterContour = ResultPolygons[i].Outer.ToPtr();
-        Polygon->OuterContourEnd = ResultPolygons[i].Outer.ToPtr() + ResultPolygons[i].Outer.Length();
+        for ( int FaceIndex = Sector.FirstFace ; FaceIndex < Sector.FirstFace + Sector.NumFaces ; FaceIndex++ ) {
+            const FFace * Face = Faces[ FaceIndex ];
 
-        Polygon->HoleContours.Resize( ResultPolygons[i].Holes.Length() );
-        Polygon->HoleContoursEnd.Resize( ResultPolygons[i].Holes.Length() );
-        for ( int j = 0 ; j < ResultPolygons[i].Holes.Length() ; j++ ) {
-            Polygon->HoleContours[j] = ResultPolygons[i].Holes[j].ToPtr();
-            Polygon->HoleContoursEnd[j] = ResultPolygons[i].Holes[j].ToPtr() + ResultPolygons[i].Holes[j].Length();
+            if ( Face->Vertices.Length() > 0 ) {
+                for ( int k = 0 ; k < Face->Vertices.Length() ; k++ ) {
+                    Bounds.AddPoint( ConvertPosition( Face->Vertices[ k ] ) );
+                }
+            } else {
+                for ( int k = 0 ; k < Face->Indices.Length() ; k++ ) {
+                    Bounds.AddPoint( ConvertPosition( Vertices[ Face->Indices[ k ] ] ) );
+                }
+            }
         }
-
-        Polygon->Normal.X = 0;
-        Polygon->Normal.Y = 0;
-        Polygon->Normal.Z = 1;
-
-        Polygons.Append( Polygon );
     }
-    Triangulator.TriangulatePolygons( Polygons, ResultVertices, _Face->Indices );
+}
 
-    // free polygons
-    for ( int i = 0 ; i < Polygons.Length() ; i++ ) {
-        FTriangulator::FPolygon * Polygon = Polygons[ i ];
-        delete Polygon;
-    }
+// Query snapshot is replaced as a whole. Threads that hold the previous one keep using it until they
+// release it.
+void FBladeWorld::PublishQuery() {
+    std::shared_ptr< const FWorldQuery > NewQuery = std::make_shared< FWorldQuery >( *this );
 
-    const Double3x3 & TransformMatrix = Clipper.GetTransform3D();
+    std::atomic_store( &Query, NewQuery );
 
-    _Face->Vertices.Resize( ResultVertices.Length() );
-    for ( int k = 0 ; k < ResultVertices.Length() ; k++ ) {
-        _Face->Vertices[k] = TransformMatrix * Double3( ResultVertices[k], Plane.Dist() );
+    if ( world_locate_benchmark.GetInteger() > 0 ) {
+        BenchmarkLocateSector( NewQuery, world_locate_benchmark.GetInteger() );
     }
+}
 
-    FPortal * Portal = CreatePortal();
+// Sector planes and links don't change after OpenWorld, the new snapshot shares them and the triangles
+// of other sectors with the current one. Sectors can be loaded and evicted on different threads, so
+// the snapshot is replaced only if nobody replaced it meanwhile.
+void FBladeWorld::PublishSectorTriangles( int _SectorIndex, const std::shared_ptr< const FWorldSectorTriangles > & _Triangles ) {
+    std::shared_ptr< const FWorldQuery > CurrentQuery = GetQuery();
 
-    Portal->Face = _Face;
-    File->ReadSwapInt32( Portal->ToSector );
-    Portal->Winding = Hole;
+    for ( ;; ) {
+        if ( !CurrentQuery || _SectorIndex < 0 || _SectorIndex >= CurrentQuery->GetNumSectors() ) {
+            return;
+        }
 
-    Sectors[ _Face->SectorIndex ].Portals.Append( Portal );
+        std::shared_ptr< const FWorldQuery > NewQuery = std::make_shared< FWorldQuery >( *CurrentQuery, _SectorIndex, _Triangles );
 
-    int32_t Count;
-    File->ReadSwapInt32( Count );
-    Portal->Planes.Resize( Count );
-    for ( int k = 0 ; k < Count ; k++ ) {
-        File->ReadSwapVector( Portal->Planes[ k ].Normal );
-        File->ReadSwapDouble( Portal->Planes[ k ].D.Value );
+        if ( std::atomic_compare_exchange_weak( &Query, &CurrentQuery, NewQuery ) ) {
+            return;
+        }
     }
 }
 
-static int VerticesOffset( const PlaneD & _Plane, const TPodArray< Double3 > & _Vertices ) {
-    int Front = 0;
-    int Back = 0;
-
-    for ( int i = 0 ; i < _Vertices.Length() ; i++ ) {
-        EPlaneSide Side = _Plane.SideOffset( _Vertices[i], 0.0 );
+void FBladeWorld::SetSectorTriangles( int _SectorIndex, const FSectorMesh * _Mesh ) {
+    std::shared_ptr< FWorldSectorTriangles > Triangles;
 
-        if ( Side == EPlaneSide::Front ) {
-            Front++;
-        }
-        if ( Side == EPlaneSide::Back ) {
-            Back++;
+    if ( _Mesh && _Mesh->Indices.Length() > 0 ) {
+        Triangles = std::make_shared< FWorldSectorTriangles >();
+        for ( int i = 0 ; i < _Mesh->MeshOffsets.Length() ; i++ ) {
+            Triangles->Append( _Mesh->Vertices.ToPtr(), _Mesh->Indices.ToPtr(), _Mesh->MeshOffsets[ i ], -1 );
         }
     }
 
-    if ( Front > Back ) {
-        return 0;
-    }
-
-    return 1;
+    PublishSectorTriangles( _SectorIndex, Triangles );
 }
 
-void FBladeWorld::FilterWinding_r( FBladeWorld::FFace * _Face, FBSPNode * _Node, FBSPNode * _Leaf ) {
-    if ( _Node->Type == NT_Leaf ) {
-        return;
+// Compare tree search and batch search of the query snapshot with the linear search on random points
+// in the world bounds
+void FBladeWorld::BenchmarkLocateSector( const std::shared_ptr< const FWorldQuery > & _Query, int _NumPoints ) const {
+    typedef std::chrono::steady_clock FClock;
+
+    TPodArray< Float3 > Points;
+    Points.Resize( _NumPoints );
+
+    // Random points are not coherent, LocateSectors has to group them. Fixed seed, results are comparable
+    // between runs.
+    uint32_t Seed = 0x2545F491;
+    for ( int i = 0 ; i < _NumPoints ; i++ ) {
+        for ( int Axis = 0 ; Axis < 3 ; Axis++ ) {
+            Seed ^= Seed << 13;
+            Seed ^= Seed >> 17;
+            Seed ^= Seed << 5;
+            const float t = ( Seed & 0xffffff ) / float( 0xffffff );
+            Points[ i ][ Axis ] = Bounds.Mins[ Axis ] + ( Bounds.Maxs[ Axis ] - Bounds.Mins[ Axis ] ) * t;
+        }
     }
 
-    int Offset = VerticesOffset( _Node->Plane, _Leaf->Vertices );
+    TPodArray< int > Linear;
+    TPodArray< int > Tree;
+    TPodArray< int > Batch;
+    Linear.Resize( _NumPoints );
+    Tree.Resize( _NumPoints );
+    Batch.Resize( _NumPoints );
 
-    if ( Offset == 1 ) {        
-        if ( _Node->Type == NT_TexInfo ) {
-            _Leaf->TextureName = _Node->TextureName;
-            _Leaf->TexCoordAxis[ 0 ] = _Node->TexCoordAxis[ 0 ];
-            _Leaf->TexCoordAxis[ 1 ] = _Node->TexCoordAxis[ 1 ];
-            _Leaf->TexCoordOffset[ 0 ] = _Node->TexCoordOffset[ 0 ];
-            _Leaf->TexCoordOffset[ 1 ] = _Node->TexCoordOffset[ 1 ];
+    FClock::time_point Start = FClock::now();
+    for ( int i = 0 ; i < _NumPoints ; i++ ) {
+        Linear[ i ] = LocateSectorLinear( Points[ i ] );
+    }
+    FClock::time_point Middle = FClock::now();
+    for ( int i = 0 ; i < _NumPoints ; i++ ) {
+        Tree[ i ] = _Query->LocateSector( Points[ i ] );
+    }
+    FClock::time_point End = FClock::now();
+    _Query->LocateSectors( Points.ToPtr(), _NumPoints, Batch.ToPtr() );
+    FClock::time_point BatchEnd = FClock::now();
+
+    int NumInside = 0;
+    int NumMismatches = 0;
+    for ( int i = 0 ; i < _NumPoints ; i++ ) {
+        if ( Linear[ i ] >= 0 ) {
+            NumInside++;
         }
-        FilterWinding_r( _Face, _Node->Children[1], _Leaf );
-    }    
-}
-
-void FBladeWorld::CreateWindings_r( FBladeWorld::FFace * _Face, const TArray< FClipperContour > & _Holes, PolygonD * _Winding, FBSPNode * _Node ) {
-    if ( _Node->Type == NT_Leaf ) {
-        assert( _Winding != NULL );
-
-        FClipper Clipper;
-        Clipper.SetNormal( _Face->Plane.Normal );
-        Clipper.AddContour3D( _Winding->ToPtr(), _Winding->Length(), true );
-
-        for ( int i = 0 ; i < _Holes.Length() ; i++ ) {
-            Clipper.AddContour2D( _Holes[ i ].ToPtr(), _Holes[ i ].Length(), false, true );
+        if ( Linear[ i ] != Tree[ i ] || Linear[ i ] != Batch[ i ] ) {
+            NumMismatches++;
         }
+    }
 
-        TArray< FClipperPolygon > ResultPolygons;
-        Clipper.Execute( FClipper::CLIP_DIFF, ResultPolygons );
-
-        //PrintPolygons( ResultPolygons );
-
-        typedef TTriangulator< Double2, Double2 > FTriangulator;
-        FTriangulator Triangulator;
-        TPodArray< FTriangulator::FPolygon * > Polygons;
-        TArray< Double2 > ResultVertices;
-        TPodArray< unsigned int > ResultIndices;
-        for ( int i = 0 ; i < ResultPolygons.Length() ; i++ ) {
-            FTriangulator::FPolygon * Polygon = new FTriangulator::FPolygon;
-
-            Polygon->OuterContour = ResultPolygons[ i ].Outer.ToPtr();
-            Polygon->OuterContourEnd = ResultPolygons[ i ].Outer.ToPtr() + ResultPolygons[ i ].Outer.Length();
-
-            Polygon->HoleContours.Resize( ResultPolygons[ i ].Holes.Length() );
-            Polygon->HoleContoursEnd.Resize( ResultPolygons[ i ].Holes.Length() );
-            for ( int j = 0 ; j < ResultPolygons[ i ].Holes.Length() ; j++ ) {
-                Polygon->HoleContours[ j ] = ResultPolygons[ i ].Holes[ j ].ToPtr();
-                Polygon->HoleContoursEnd[ j ] = ResultPolygons[ i ].Holes[ j ].ToPtr() + ResultPolygons[ i ].Holes[ j ].Length();
-            }
+    const float LinearTime = std::chrono::duration< float, std::micro >( Middle - Start ).count() / _NumPoints;
+    const float TreeTime = std::chrono::duration< float, std::micro >( End - Middle ).count() / _NumPoints;
+    const float BatchTime = std::chrono::duration< float, std::micro >( BatchEnd - End ).count() / _NumPoints;
 
-            Polygon->Normal.X = 0;
-            Polygon->Normal.Y = 0;
-            Polygon->Normal.Z = 1;
+    Out() << "Sector location:" << Sectors.Length() << "sectors," << _NumPoints << "points," << NumInside << "inside, linear"
+          << LinearTime << "us, tree" << TreeTime << "us, batch" << BatchTime << "us, batch speedup" << TreeTime / FMath::Max( BatchTime, 1e-6f )
+          << "," << NumMismatches << "mismatches";
 
-            Polygons.Append( Polygon );
-        }
-        Triangulator.TriangulatePolygons( Polygons, ResultVertices, ResultIndices );
+    // Coherent path: a walk with short steps from the first point inside the world, like a moving camera.
+    // The walk turns when the next step leaves the world.
+    int First = 0;
+    while ( First < _NumPoints && Linear[ First ] < 0 ) {
+        First++;
+    }
+    if ( First == _NumPoints ) {
+        return;
+    }
 
-        // free polygons
-        for ( int i = 0 ; i < Polygons.Length() ; i++ ) {
-            FTriangulator::FPolygon * Polygon = Polygons[ i ];
-            delete Polygon;
+    const float StepLength = 0.05f;
+    Float3 Step( 0.0f );
+    Float3 Position = Points[ First ];
+    for ( int i = 0 ; i < _NumPoints ; i++ ) {
+        Float3 Next = Position + Step;
+        if ( i == 0 || _Query->LocateSector( Next ) < 0 ) {
+            const Float3 & Target = Points[ ( First + i + 1 ) % _NumPoints ];
+            const float Distance = FMath::Length( Target - Position );
+            Step = Distance > 0.0f ? ( Target - Position ) * ( StepLength / Distance ) : Float3( 0.0f );
+            Next = Position;
         }
+        Points[ i ] = Position = Next;
+    }
 
-        const Double3x3 & TransformMatrix = Clipper.GetTransform3D();
+    FSectorTracker Tracker;
 
-        _Node->Vertices.Resize( ResultVertices.Length() );
-        for ( int k = 0 ; k < ResultVertices.Length() ; k++ ) {
-            _Node->Vertices[ k ] = TransformMatrix * Double3( ResultVertices[ k ], _Face->Plane.Dist() );
+    Middle = FClock::now();
+    for ( int i = 0 ; i < _NumPoints ; i++ ) {
+        Linear[ i ] = _Query->LocateSector( Points[ i ] );
+    }
+    End = FClock::now();
+    for ( int i = 0 ; i < _NumPoints ; i++ ) {
+        Tree[ i ] = Tracker.Update( _Query, Points[ i ] );
+    }
+    FClock::time_point TrackEnd = FClock::now();
+    _Query->LocateSectors( Points.ToPtr(), _NumPoints, Batch.ToPtr() );
+    BatchEnd = FClock::now();
+
+    NumMismatches = 0;
+    for ( int i = 0 ; i < _NumPoints ; i++ ) {
+        if ( Linear[ i ] != Tree[ i ] || Linear[ i ] != Batch[ i ] ) {
+            NumMismatches++;
         }
-        _Node->Indices = ResultIndices;
-
-        Leafs.Append( _Node );
-
-        return;
     }
 
-    PolygonD * Front = NULL;
-    PolygonD * Back = NULL;
-
-    assert( _Winding != NULL );
-    _Winding->Split( _Node->Plane, &Front, &Back, 0.0 );
+    const float PathTreeTime = std::chrono::duration< float, std::micro >( End - Middle ).count() / _NumPoints;
+    const float TrackTime = std::chrono::duration< float, std::micro >( TrackEnd - End ).count() / _NumPoints;
+    const float PathBatchTime = std::chrono::duration< float, std::micro >( BatchEnd - TrackEnd ).count() / _NumPoints;
 
-    CreateWindings_r( _Face, _Holes, Front, _Node->Children[0] );
-    CreateWindings_r( _Face, _Holes, Back, _Node->Children[1] );
-
-    delete Front;
-    delete Back;
+    Out() << "Sector tracking:" << _NumPoints << "path points, tree" << PathTreeTime << "us, tracker" << TrackTime << "us, batch"
+          << PathBatchTime << "us," << NumMismatches << "mismatches";
 }
 
-void FBladeWorld::LoadFaceBSP( FFace * _Face ) {
+void FBladeWorld::LoadSimpleFace( FFace * _Face ) {
     // Face plane
-    File->ReadSwapVector( _Face->Plane.Normal );
-    File->ReadSwapDouble( _Face->Plane.D.Value );
+    ReadFacePlane( _Face->Index );
 
     // FIXME: What is it?
-    File->ReadSwapUInt64( _Face->UnknownSignature );
+    _Face->UnknownSignature = Cursor.ReadUInt64();
     if ( _Face->UnknownSignature != 3 ) {
         Out() << "Face signature" << _Face->UnknownSignature;
     }
 
-    File->ReadString( _Face->TextureName );
+    _Face->TextureId = ReadTextureId( Cursor );
 
-    File->ReadSwapVector( _Face->TexCoordAxis[0] );
-    File->ReadSwapVector( _Face->TexCoordAxis[1] );
-    File->ReadSwapFloat( _Face->TexCoordOffset[0] );
-    File->ReadSwapFloat( _Face->TexCoordOffset[1] );
+    Cursor.ReadVector( _Face->TexCoordAxis[0] );
+    Cursor.ReadVector( _Face->TexCoordAxis[1] );
+    _Face->TexCoordOffset[0] = Cursor.ReadFloat();
+    _Face->TexCoordOffset[1] = Cursor.ReadFloat();
 
     _Face->TexCoordOffset[0] = -_Face->TexCoordOffset[0];
     _Face->TexCoordOffset[1] = -_Face->TexCoordOffset[1];
 
     // 8 zero bytes?
-    SetDumpLog( false );
     for ( int k = 0 ; k < 8 ; k++ ) {
-        if ( DumpByte( File ) != 0 ) {
+        if ( Cursor.ReadByte() != 0 ) {
             Out() << "not zero!";
         }
     }
-    SetDumpLog( true );
 
     // Winding
-    ReadIndices( _Face->Indices );
+    ReadIndices( _Face->Indices, DataArena );
+}
+
+void FBladeWorld::LoadPortalFace( FFace * _Face ) {
+    // Face plane
+    ReadFacePlane( _Face->Index );
+
+    // Winding
+    ReadIndices( _Face->Indices, DataArena );
 
-    PolygonD Winding;
+    FPortal * Portal = CreatePortal();
 
-    Winding.Resize( _Face->Indices.Length() );
+    Portal->Face = _Face;
+    Portal->ToSector = ReadPortalTarget();
+    Portal->Winding = DataArena.AllocArray< Float3 >( _Face->Indices.Length() );
     for ( int k = 0 ; k < _Face->Indices.Length() ; k++ ) {
-        Winding[ k ] = Vertices[ _Face->Indices[ k ] ];
+        Portal->Winding[ _Face->Indices.Length() - k - 1 ] = ConvertPosition( GetFileVertices()[ _Face->Indices[k] ] );
     }
-    Winding.Reverse();
 
-    PlaneD Plane = _Face->Plane;
+    Sectors[ FaceSectors[ _Face->Index ] ].Portals.Append( Portal );
 
-    TArray< FClipperContour > Holes;
+    // FIXME: What is it?
+    Cursor.Skip( 8 );
 
-    int NumHoles;
-    File->ReadSwapInt32( NumHoles );
-    if ( NumHoles > 0 ) {
-        FClipper HolesUnion;
-        PolygonD Hole;
+    _Face->TextureId = ReadTextureId( Cursor );
 
-        HolesUnion.SetNormal( Plane.Normal );
+    Cursor.ReadVector( _Face->TexCoordAxis[0] );
+    Cursor.ReadVector( _Face->TexCoordAxis[1] );
+    _Face->TexCoordOffset[0] = Cursor.ReadFloat();
+    _Face->TexCoordOffset[1] = Cursor.ReadFloat();
 
-        for ( int c = 0 ; c < NumHoles ; c++ ) {
-            ReadWinding( Hole );
+    _Face->TexCoordOffset[0] = -_Face->TexCoordOffset[0];
+    _Face->TexCoordOffset[1] = -_Face->TexCoordOffset[1];
 
-            HolesUnion.AddContour3D( Hole.ToPtr(), Hole.Length(), true );
+    // 8 zero bytes?
+    for ( int k = 0 ; k < 8 ; k++ ) {
+        if ( Cursor.ReadByte() != 0 ) {
+            Out() << "not zero!";
+        }
+    }
+}
+
+void FBladeWorld::LoadFaceWithHole( FFace * _Face ) {
+    // Face plane
+    PlaneD Plane = ReadFacePlane( _Face->Index );
+
+    // FIXME: What is it?
+    _Face->UnknownSignature = Cursor.ReadUInt64();
+    if ( _Face->UnknownSignature != 3 ) {
+        Out() << "Face signature" << _Face->UnknownSignature;
+    }
+
+    _Face->TextureId = ReadTextureId( Cursor );
+
+    Cursor.ReadVector( _Face->TexCoordAxis[0] );
+    Cursor.ReadVector( _Face->TexCoordAxis[1] );
+    _Face->TexCoordOffset[0] = Cursor.ReadFloat();
+    _Face->TexCoordOffset[1] = Cursor.ReadFloat();
+
+    _Face->TexCoordOffset[0] = -_Face->TexCoordOffset[0];
+    _Face->TexCoordOffset[1] = -_Face->TexCoordOffset[1];
+
+    // 8 zero bytes?
+    for ( int k = 0 ; k < 8 ; k++ ) {
+        if ( Cursor.ReadByte() != 0 ) {
+            Out() << "not zero!";
+        }
+    }
+
+    // Winding
+    FFaceBuild & Build = AddFaceBuild( _Face );
+
+    Build.Plane = Plane;
+
+    ReadWinding( Build.Winding );
+
+    // Winding hole
+    Build.Holes.Resize( 1 );
+    ReadWinding( Build.Holes[ 0 ] );
+
+    FPortal * Portal = CreatePortal();
+
+    Portal->Face = _Face;
+    Portal->ToSector = ReadPortalTarget();
+    SetPortalWinding( Portal, Build.Holes[ 0 ] );
+
+    Sectors[ FaceSectors[ _Face->Index ] ].Portals.Append( Portal );
+
+    ReadPortalPlanes( Portal->Planes );
+}
+
+// Execute clipping and triangulate the result in the face plane. Uses buffers of the scratch context.
+void FBladeWorld::ClipAndTriangulate( FClipper & _Clipper, const PlaneD & _Plane, FGeometryScratch & _Scratch, TArenaArray< Double3 > & _Vertices, TArenaArray< unsigned int > & _Indices, FArena & _Arena ) {
+    typedef FGeometryScratch::FTriangulator FTriangulator;
+
+    TArray< FClipperPolygon > & ResultPolygons = _Scratch.ResultPolygons;
+
+    ResultPolygons.Clear();
+    _Clipper.Execute( FClipper::CLIP_DIFF, ResultPolygons );
+
+    //PrintPolygons( ResultPolygons );
+
+    // Polygon descriptors are reused, only the pointers are rebuilt
+    if ( _Scratch.Polygons.Length() < ResultPolygons.Length() ) {
+        _Scratch.Polygons.Resize( ResultPolygons.Length() );
+    }
+    _Scratch.PolygonPtrs.Clear();
+
+    for ( int i = 0 ; i < ResultPolygons.Length() ; i++ ) {
+        FTriangulator::FPolygon * Polygon = &_Scratch.Polygons[ i ];
+
+        Polygon->OuterContour = ResultPolygons[ i ].Outer.ToPtr();
+        Polygon->OuterContourEnd = ResultPolygons[ i ].Outer.ToPtr() + ResultPolygons[ i ].Outer.Length();
+
+        Polygon->HoleContours.Resize( ResultPolygons[ i ].Holes.Length() );
+        Polygon->HoleContoursEnd.Resize( ResultPolygons[ i ].Holes.Length() );
+        for ( int j = 0 ; j < ResultPolygons[ i ].Holes.Length() ; j++ ) {
+            Polygon->HoleContours[ j ] = ResultPolygons[ i ].Holes[ j ].ToPtr();
+            Polygon->HoleContoursEnd[ j ] = ResultPolygons[ i ].Holes[ j ].ToPtr() + ResultPolygons[ i ].Holes[ j ].Length();
+        }
+
+        Polygon->Normal.X = 0;
+        Polygon->Normal.Y = 0;
+        Polygon->Normal.Z = 1;
+
+        _Scratch.PolygonPtrs.Append( Polygon );
+    }
+
+    _Scratch.ResultVertices.Clear();
+    _Scratch.ResultIndices.Clear();
+    _Scratch.Triangulator.TriangulatePolygons( _Scratch.PolygonPtrs, _Scratch.ResultVertices, _Scratch.ResultIndices );
+
+    const Double3x3 & TransformMatrix = _Clipper.GetTransform3D();
+
+    _Vertices = _Arena.AllocArray< Double3 >( _Scratch.ResultVertices.Length() );
+    for ( int k = 0 ; k < _Scratch.ResultVertices.Length() ; k++ ) {
+        _Vertices[ k ] = TransformMatrix * Double3( _Scratch.ResultVertices[ k ], _Plane.Dist() );
+    }
+    _Indices = _Arena.CopyArray( _Scratch.ResultIndices.ToPtr(), _Scratch.ResultIndices.Length() );
+}
+
+// Twice the area of triangle projected to the plane with normal _Normal, scaled by the normal length.
+// Positive for counterclockwise triangles.
+static double OrientedArea( const Double3 & _A, const Double3 & _B, const Double3 & _C, const Double3 & _Normal ) {
+    return FMath::Dot( FMath::Cross( _B - _A, _C - _A ), _Normal );
+}
+
+static Double3 PolygonNormal( const Double3 * _Points, int _NumPoints ) {
+    Double3 Normal( 0.0 );
+    for ( int i = 0 ; i < _NumPoints ; i++ ) {
+        Normal += FMath::Cross( _Points[ i ], _Points[ ( i + 1 ) % _NumPoints ] );
+    }
+    return Normal;
+}
+
+static bool IsStrictlyConvex( const Double3 * _Points, int _NumPoints, const Double3 & _Normal ) {
+    for ( int i = 0 ; i < _NumPoints ; i++ ) {
+        if ( OrientedArea( _Points[ i ], _Points[ ( i + 1 ) % _NumPoints ], _Points[ ( i + 2 ) % _NumPoints ], _Normal ) <= 0.0 ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Angular order of directions around _Normal, starting from _Reference
+static int AngularHalf( const Double3 & _Reference, const Double3 & _Dir, const Double3 & _Normal ) {
+    double Side = FMath::Dot( FMath::Cross( _Reference, _Dir ), _Normal );
+    if ( Side > 0.0 ) {
+        return 0;
+    }
+    if ( Side < 0.0 ) {
+        return 1;
+    }
+    return FMath::Dot( _Reference, _Dir ) > 0.0 ? 0 : 1;
+}
+
+static bool AngularLess( const Double3 & _Reference, const Double3 & _A, const Double3 & _B, const Double3 & _Normal ) {
+    int HalfA = AngularHalf( _Reference, _A, _Normal );
+    int HalfB = AngularHalf( _Reference, _B, _Normal );
+    if ( HalfA != HalfB ) {
+        return HalfA < HalfB;
+    }
+    return FMath::Dot( FMath::Cross( _A, _B ), _Normal ) > 0.0;
+}
+
+// Triangulate the ring between a strictly convex polygon and a strictly convex hole inside it.
+// Both contours are walked around the hole center, every step emits a triangle with one edge on
+// the outer or on the hole contour. Triangles have the orientation of _Outer.
+// Outer vertices are indexed first, then hole vertices. Returns false if the input doesn't fit,
+// the caller should use the general clipper then.
+static bool TriangulateConvexRing( const Double3 * _Outer, int _NumOuter, const Double3 * _Hole, int _NumHole, TPodArray< unsigned int > & _Indices ) {
+    enum { MAX_RING_VERTICES = 32 };
+
+    if ( _NumOuter < 3 || _NumHole < 3 || _NumOuter > MAX_RING_VERTICES || _NumHole > MAX_RING_VERTICES ) {
+        return false;
+    }
+
+    const Double3 Normal = PolygonNormal( _Outer, _NumOuter );
+    const double OuterArea = FMath::Dot( Normal, Normal );
+
+    if ( OuterArea <= 0.0 || !IsStrictlyConvex( _Outer, _NumOuter, Normal ) ) {
+        return false;
+    }
+
+    // Walk the hole in the same direction as the outer contour
+    Double3 Hole[ MAX_RING_VERTICES ];
+    int HoleMap[ MAX_RING_VERTICES ];
+    const bool bReversed = FMath::Dot( PolygonNormal( _Hole, _NumHole ), Normal ) < 0.0;
+    for ( int i = 0 ; i < _NumHole ; i++ ) {
+        HoleMap[ i ] = bReversed ? _NumHole - i - 1 : i;
+        Hole[ i ] = _Hole[ HoleMap[ i ] ];
+    }
+
+    const double HoleArea = FMath::Dot( PolygonNormal( Hole, _NumHole ), Normal );
+
+    if ( HoleArea <= 0.0 || !IsStrictlyConvex( Hole, _NumHole, Normal ) ) {
+        return false;
+    }
+
+    // Hole must be strictly inside
+    for ( int i = 0 ; i < _NumOuter ; i++ ) {
+        const Double3 & A = _Outer[ i ];
+        const Double3 & B = _Outer[ ( i + 1 ) % _NumOuter ];
+        for ( int j = 0 ; j < _NumHole ; j++ ) {
+            if ( OrientedArea( A, B, Hole[ j ], Normal ) <= 0.0 ) {
+                return false;
+            }
+        }
+    }
+
+    Double3 Center( 0.0 );
+    for ( int j = 0 ; j < _NumHole ; j++ ) {
+        Center += Hole[ j ];
+    }
+    Center /= _NumHole;
+
+    // Start from the hole vertex at or just before the first outer vertex
+    const Double3 Reference = _Outer[ 0 ] - Center;
+    int First = 0;
+    for ( int j = 1 ; j < _NumHole ; j++ ) {
+        if ( AngularLess( Reference, Hole[ j ] - Center, Hole[ First ] - Center, Normal ) ) {
+            First = j;
+        }
+    }
+    const bool bFirstAtReference = !AngularLess( Reference, Reference, Hole[ First ] - Center, Normal );
+    if ( !bFirstAtReference ) {
+        First = ( First + _NumHole - 1 ) % _NumHole;
+    }
+
+    _Indices.Clear();
+
+    double RingArea = 0.0;
+    int NumOuterSteps = 0;
+    int NumHoleSteps = 0;
+
+    while ( NumOuterSteps < _NumOuter || NumHoleSteps < _NumHole ) {
+        const int o0 = NumOuterSteps % _NumOuter;
+        const int o1 = ( NumOuterSteps + 1 ) % _NumOuter;
+        const int h0 = ( First + NumHoleSteps ) % _NumHole;
+        const int h1 = ( First + NumHoleSteps + 1 ) % _NumHole;
+
+        // Hole step: the next hole edge must be visible from the current outer vertex. Outer step: the
+        // current hole vertex must be visible from the next outer vertex, so the new edge doesn't cross
+        // the hole. Both steps keep the triangle on the right side of the contours.
+        const bool bCanAdvanceHole = NumHoleSteps < _NumHole
+            && OrientedArea( Hole[ h0 ], Hole[ h1 ], _Outer[ o0 ], Normal ) < 0.0;
+        const bool bCanAdvanceOuter = NumOuterSteps < _NumOuter
+            && ( OrientedArea( Hole[ ( h0 + _NumHole - 1 ) % _NumHole ], Hole[ h0 ], _Outer[ o1 ], Normal ) < 0.0
+              || OrientedArea( Hole[ h0 ], Hole[ h1 ], _Outer[ o1 ], Normal ) < 0.0 );
+
+        bool bAdvanceOuter;
+        if ( !bCanAdvanceHole && !bCanAdvanceOuter ) {
+            return false;
+        } else if ( !bCanAdvanceHole ) {
+            bAdvanceOuter = true;
+        } else if ( !bCanAdvanceOuter ) {
+            bAdvanceOuter = false;
+        } else if ( NumHoleSteps == _NumHole - 1 && bFirstAtReference ) {
+            // The last hole step returns to the reference direction
+            bAdvanceOuter = true;
+        } else if ( o1 == 0 ) {
+            // The outer contour is closed at the reference direction, finish the hole first
+            bAdvanceOuter = false;
+        } else {
+            // Both steps are possible, keep the contours in angular sync for better shaped triangles
+            bAdvanceOuter = !AngularLess( Reference, Hole[ h1 ] - Center, _Outer[ o1 ] - Center, Normal );
+        }
+
+        unsigned int a, b, c;
+        double Area;
+        if ( bAdvanceOuter ) {
+            Area = OrientedArea( _Outer[ o0 ], _Outer[ o1 ], Hole[ h0 ], Normal );
+            a = o0;
+            b = o1;
+            c = _NumOuter + HoleMap[ h0 ];
+            NumOuterSteps++;
+        } else {
+            Area = OrientedArea( _Outer[ o0 ], Hole[ h1 ], Hole[ h0 ], Normal );
+            a = o0;
+            b = _NumOuter + HoleMap[ h1 ];
+            c = _NumOuter + HoleMap[ h0 ];
+            NumHoleSteps++;
+        }
+
+        if ( Area <= 0.0 ) {
+            return false;
+        }
+
+        RingArea += Area;
+
+        _Indices.Append( a );
+        _Indices.Append( b );
+        _Indices.Append( c );
+    }
+
+    // Triangles must cover the ring exactly
+    if ( fabs( RingArea - ( OuterArea - HoleArea ) ) > OuterArea * 1e-9 ) {
+        return false;
+    }
+
+    return true;
+}
+
+void FBladeWorld::BuildFaceWithHole( FFaceBuild & _Build, FGeometryScratch & _Scratch, FArena & _Arena ) {
+    FFace * Face = _Build.Face;
+    const PolygonD & Winding = _Build.Winding;
+    const PolygonD & Hole = _Build.Holes[ 0 ];
+
+    // Common case: convex face with convex hole
+    if ( TriangulateConvexRing( Winding.ToPtr(), Winding.Length(), Hole.ToPtr(), Hole.Length(), _Scratch.ResultIndices ) ) {
+        Face->Vertices = _Arena.AllocArray< Double3 >( Winding.Length() + Hole.Length() );
+        memcpy( Face->Vertices.ToPtr(), Winding.ToPtr(), Winding.Length() * sizeof( Double3 ) );
+        memcpy( Face->Vertices.ToPtr() + Winding.Length(), Hole.ToPtr(), Hole.Length() * sizeof( Double3 ) );
+        Face->Indices = _Arena.CopyArray( _Scratch.ResultIndices.ToPtr(), _Scratch.ResultIndices.Length() );
+        return;
+    }
+
+    FClipper Clipper;
+
+    const PlaneD & Plane = _Build.Plane;//Winding.CalcPlane();
+
+    Clipper.SetNormal( Plane.Normal );
+    Clipper.AddContour3D( Winding.ToPtr(), Winding.Length(), true );
+    Clipper.AddContour3D( Hole.ToPtr(), Hole.Length(), false );
+
+    ClipAndTriangulate( Clipper, Plane, _Scratch, Face->Vertices, Face->Indices, _Arena );
+}
+
+// Split a convex winding by the plane. Points on the plane go to both sides. If the winding
+// doesn't cross the plane, it goes whole to one side (to the front if it lies on the plane).
+static void SplitWinding( const Double3 * _Points, int _NumPoints, const PlaneD & _Plane, TPodArray< Double3 > & _Front, TPodArray< Double3 > & _Back ) {
+    int NumFront = 0;
+    int NumBack = 0;
+
+    _Front.Clear();
+    _Back.Clear();
+
+    for ( int i = 0 ; i < _NumPoints ; i++ ) {
+        EPlaneSide Side = _Plane.SideOffset( _Points[ i ], 0.0 );
+        if ( Side == EPlaneSide::Front ) {
+            NumFront++;
+        } else if ( Side == EPlaneSide::Back ) {
+            NumBack++;
+        }
+    }
+
+    if ( NumBack == 0 ) {
+        _Front.Resize( _NumPoints );
+        memcpy( _Front.ToPtr(), _Points, _NumPoints * sizeof( Double3 ) );
+        return;
+    }
+
+    if ( NumFront == 0 ) {
+        _Back.Resize( _NumPoints );
+        memcpy( _Back.ToPtr(), _Points, _NumPoints * sizeof( Double3 ) );
+        return;
+    }
+
+    for ( int i = 0 ; i < _NumPoints ; i++ ) {
+        const Double3 & P1 = _Points[ i ];
+        const Double3 & P2 = _Points[ ( i + 1 ) % _NumPoints ];
+
+        EPlaneSide Side1 = _Plane.SideOffset( P1, 0.0 );
+        EPlaneSide Side2 = _Plane.SideOffset( P2, 0.0 );
+
+        if ( Side1 != EPlaneSide::Back ) {
+            _Front.Append( P1 );
+        }
+        if ( Side1 != EPlaneSide::Front ) {
+            _Back.Append( P1 );
+        }
+
+        if ( Side1 == EPlaneSide::On || Side2 == EPlaneSide::On || Side1 == Side2 ) {
+            continue;
+        }
+
+        // Edge crosses the plane
+        Double D1 = _Plane.Dist( P1 );
+        Double D2 = _Plane.Dist( P2 );
+        Double3 Mid = P1 + ( P2 - P1 ) * ( D1 / ( D1 - D2 ) );
+
+        _Front.Append( Mid );
+        _Back.Append( Mid );
+    }
+}
+
+void FBladeWorld::TriangulateLeaf( const PlaneD & _Plane, const TArray< FClipperContour > & _Holes, const Double3 * _Winding, int _NumPoints, FBSPNode * _Leaf, FGeometryScratch & _Scratch, FArena & _Arena ) {
+    FClipper Clipper;
+
+    Clipper.SetNormal( _Plane.Normal );
+    Clipper.AddContour3D( _Winding, _NumPoints, true );
+
+    for ( int i = 0 ; i < _Holes.Length() ; i++ ) {
+        Clipper.AddContour2D( _Holes[ i ].ToPtr(), _Holes[ i ].Length(), false, true );
+    }
+
+    ClipAndTriangulate( Clipper, _Plane, _Scratch, _Leaf->Vertices, _Leaf->Indices, _Arena );
+}
+
+// Walk the face BSP with an explicit stack, splitting the winding down to the leafs. Windings of
+// pending nodes live in one scratch buffer that is used as a stack too: the winding of the node on
+// top of the stack is always at the end of the buffer.
+//
+// Texture info of a leaf is taken from the last TexInfo node passed by the back side, until the
+// first node passed by the front side. It is carried down the traversal, so leafs are textured
+// without classifying them against the tree again.
+void FBladeWorld::CreateWindings( FBladeWorld::FFace * _Face, const PlaneD & _Plane, const TArray< FClipperContour > & _Holes, const PolygonD & _Winding, TPodArray< FBSPNode * > & _Leafs, FGeometryScratch & _Scratch, FArena & _Arena ) {
+    TPodArray< FWindingStackEntry > & Stack = _Scratch.WindingStack;
+    TPodArray< Double3 > & Points = _Scratch.Points;
+    TPodArray< Double3 > & Front = _Scratch.Front;
+    TPodArray< Double3 > & Back = _Scratch.Back;
+
+    Stack.Clear();
+    Points.Resize( _Winding.Length() );
+    memcpy( Points.ToPtr(), _Winding.ToPtr(), _Winding.Length() * sizeof( Double3 ) );
+
+    FWindingStackEntry Entry;
+    Entry.Node = _Face->Root;
+    Entry.TexInfo = NULL;
+    Entry.bTexInfoFrozen = false;
+    Entry.FirstPoint = 0;
+    Entry.NumPoints = _Winding.Length();
+    Stack.Append( Entry );
+
+    while ( Stack.Length() > 0 ) {
+        FWindingStackEntry Top = Stack.Last();
+        Stack.Resize( Stack.Length() - 1 );
+
+        FBSPNode * Node = Top.Node;
+
+        if ( Node->Type == NT_Leaf ) {
+            TriangulateLeaf( _Plane, _Holes, Points.ToPtr() + Top.FirstPoint, Top.NumPoints, Node, _Scratch, _Arena );
+
+            if ( Top.TexInfo ) {
+                Node->TextureId = Top.TexInfo->TextureId;
+                Node->TexCoordAxis[ 0 ] = Top.TexInfo->TexCoordAxis[ 0 ];
+                Node->TexCoordAxis[ 1 ] = Top.TexInfo->TexCoordAxis[ 1 ];
+                Node->TexCoordOffset[ 0 ] = Top.TexInfo->TexCoordOffset[ 0 ];
+                Node->TexCoordOffset[ 1 ] = Top.TexInfo->TexCoordOffset[ 1 ];
+            } else {
+                Node->TextureId = _Face->TextureId;
+                Node->TexCoordAxis[ 0 ] = _Face->TexCoordAxis[ 0 ];
+                Node->TexCoordAxis[ 1 ] = _Face->TexCoordAxis[ 1 ];
+                Node->TexCoordOffset[ 0 ] = _Face->TexCoordOffset[ 0 ];
+                Node->TexCoordOffset[ 1 ] = _Face->TexCoordOffset[ 1 ];
+            }
+
+            _Leafs.Append( Node );
+
+            Points.Resize( Top.FirstPoint );
+            continue;
+        }
+
+        SplitWinding( Points.ToPtr() + Top.FirstPoint, Top.NumPoints, Node->Plane, Front, Back );
+
+        // The winding of the node is no longer needed, reuse its place
+        Points.Resize( Top.FirstPoint );
+
+        // Push back side first, so the front side is processed first as before
+        if ( Back.Length() > 0 ) {
+            Entry.Node = Node->Children[ 1 ];
+            Entry.TexInfo = ( !Top.bTexInfoFrozen && Node->Type == NT_TexInfo ) ? Node : Top.TexInfo;
+            Entry.bTexInfoFrozen = Top.bTexInfoFrozen;
+            Entry.FirstPoint = Points.Length();
+            Entry.NumPoints = Back.Length();
+            Stack.Append( Entry );
+
+            for ( int i = 0 ; i < Back.Length() ; i++ ) {
+                Points.Append( Back[ i ] );
+            }
+        }
+
+        if ( Front.Length() > 0 ) {
+            Entry.Node = Node->Children[ 0 ];
+            Entry.TexInfo = Top.TexInfo;
+            Entry.bTexInfoFrozen = true;
+            Entry.FirstPoint = Points.Length();
+            Entry.NumPoints = Front.Length();
+            Stack.Append( Entry );
+
+            for ( int i = 0 ; i < Front.Length() ; i++ ) {
+                Points.Append( Front[ i ] );
+            }
+        }
+    }
+}
+
+void FBladeWorld::LoadFaceBSP( FFace * _Face ) {
+    // Face plane
+    PlaneD Plane = ReadFacePlane( _Face->Index );
+
+    // FIXME: What is it?
+    _Face->UnknownSignature = Cursor.ReadUInt64();
+    if ( _Face->UnknownSignature != 3 ) {
+        Out() << "Face signature" << _Face->UnknownSignature;
+    }
+
+    _Face->TextureId = ReadTextureId( Cursor );
+
+    Cursor.ReadVector( _Face->TexCoordAxis[0] );
+    Cursor.ReadVector( _Face->TexCoordAxis[1] );
+    _Face->TexCoordOffset[0] = Cursor.ReadFloat();
+    _Face->TexCoordOffset[1] = Cursor.ReadFloat();
+
+    _Face->TexCoordOffset[0] = -_Face->TexCoordOffset[0];
+    _Face->TexCoordOffset[1] = -_Face->TexCoordOffset[1];
+
+    // 8 zero bytes?
+    for ( int k = 0 ; k < 8 ; k++ ) {
+        if ( Cursor.ReadByte() != 0 ) {
+            Out() << "not zero!";
+        }
+    }
+
+    // Winding
+    ReadIndices( _Face->Indices, DataArena );
+
+    FFaceBuild & Build = AddFaceBuild( _Face );
+
+    Build.Plane = Plane;
+
+    PolygonD & Winding = Build.Winding;
+
+    Winding.Resize( _Face->Indices.Length() );
+    for ( int k = 0 ; k < _Face->Indices.Length() ; k++ ) {
+        Winding[ k ] = GetFileVertices()[ _Face->Indices[ k ] ];
+    }
+    Winding.Reverse();
+
+    int NumHoles = Cursor.ReadInt32();
+    if ( NumHoles > 0 && Cursor.CanRead( NumHoles, 8 ) ) {
+        Build.Holes.Resize( NumHoles );
+
+        for ( int c = 0 ; c < NumHoles ; c++ ) {
+            PolygonD & Hole = Build.Holes[ c ];
+
+            ReadWinding( Hole );
 
             FPortal * Portal = CreatePortal();
 
             Portal->Face = _Face;
-            File->ReadSwapInt32( Portal->ToSector );
-            Portal->Winding = Hole;
+            Portal->ToSector = ReadPortalTarget();
+            SetPortalWinding( Portal, Hole );
 
-            Sectors[ _Face->SectorIndex ].Portals.Append( Portal );
+            Sectors[ FaceSectors[ _Face->Index ] ].Portals.Append( Portal );
 
-            int32_t Count;
-            File->ReadSwapInt32( Count );
-            Portal->Planes.Resize( Count );
-            for ( int k = 0 ; k < Count ; k++ ) {
-                File->ReadSwapVector( Portal->Planes[k].Normal );
-                File->ReadSwapDouble( Portal->Planes[k].D.Value );
-            }
+            ReadPortalPlanes( Portal->Planes );
+        }
+    }
+
+    _Face->Root = ReadBSPTree( _Face );
+}
+
+void FBladeWorld::BuildFaceBSP( FFaceBuild & _Build, FGeometryScratch & _Scratch, FArena & _Arena ) {
+    FFace * Face = _Build.Face;
+
+    const PlaneD & Plane = _Build.Plane;
+
+    TArray< FClipperContour > & Holes = _Scratch.Holes;
+
+    Holes.Clear();
+
+    if ( _Build.Holes.Length() > 0 ) {
+        FClipper HolesUnion;
+
+        HolesUnion.SetNormal( Plane.Normal );
+
+        for ( int c = 0 ; c < _Build.Holes.Length() ; c++ ) {
+            const PolygonD & Hole = _Build.Holes[ c ];
+
+            HolesUnion.AddContour3D( Hole.ToPtr(), Hole.Length(), true );
         }
 
         // FIXME: Union of hulls may produce inner holes!
         HolesUnion.Execute( FClipper::CLIP_UNION, Holes );
     }
 
-    _Face->Root = ReadBSPNode_r( _Face );
+    // Create windings, fill leafs and find their texture info
+    CreateWindings( Face, Plane, Holes, _Build.Winding, _Build.Leafs, _Scratch, _Arena );
+}
+
+void FBladeWorld::CreateSubfaces( FFaceBuild & _Build ) {
+    FFace * Face = _Build.Face;
+
+    int NumSubFaces = 0;
+    for ( int i = 0 ; i < _Build.Leafs.Length() ; i++ ) {
+        FBSPNode * Leaf = _Build.Leafs[ i ];
 
-    // Create windings and fill Leafs
-    CreateWindings_r( _Face, Holes, &Winding, _Face->Root );
+        if ( Leaf->Vertices.Length() > 0 && Leaf->Indices.Length() > 0 ) {
+            NumSubFaces++;
+        }
+    }
 
-    // Create subfaces
-    for ( int i = 0 ; i < Leafs.Length() ; i++ ) {
-        if ( Leafs[i]->Vertices.Length() > 0 && Leafs[i]->Indices.Length() > 0 ) {
-            Leafs[i]->TextureName = _Face->TextureName;
-            Leafs[i]->TexCoordAxis[0] = _Face->TexCoordAxis[0];
-            Leafs[i]->TexCoordAxis[1] = _Face->TexCoordAxis[1];
-            Leafs[i]->TexCoordOffset[0] = _Face->TexCoordOffset[0];
-            Leafs[i]->TexCoordOffset[1] = _Face->TexCoordOffset[1];
+    Face->SubFaces = DataArena.AllocArray< FFace * >( NumSubFaces );
+    NumSubFaces = 0;
 
-            FilterWinding_r( _Face, _Face->Root, Leafs[i] );
+    PlaneF Plane = FacePlanes[ Face->Index ];
+    int SectorIndex = FaceSectors[ Face->Index ];
 
-            FBladeWorld::FFace * SubFace = CreateFace();
-            SubFace->Type = FT_Subface;
-            SubFace->TextureName = Leafs[i]->TextureName;
-            SubFace->TexCoordAxis[ 0 ] = Leafs[i]->TexCoordAxis[ 0 ];
-            SubFace->TexCoordAxis[ 1 ] = Leafs[i]->TexCoordAxis[ 1 ];
-            SubFace->TexCoordOffset[ 0 ] = Leafs[i]->TexCoordOffset[ 0 ];
-            SubFace->TexCoordOffset[ 1 ] = Leafs[i]->TexCoordOffset[ 1 ];
-            SubFace->SectorIndex = _Face->SectorIndex;
-            SubFace->Plane = _Face->Plane;
-            SubFace->Vertices = Leafs[i]->Vertices;
-            SubFace->Indices = Leafs[i]->Indices;
+    for ( int i = 0 ; i < _Build.Leafs.Length() ; i++ ) {
+        FBSPNode * Leaf = _Build.Leafs[ i ];
 
-            _Face->SubFaces.Append( SubFace );
+        if ( Leaf->Vertices.Length() > 0 && Leaf->Indices.Length() > 0 ) {
+            FBladeWorld::FFace * SubFace = CreateFace( FT_Subface, SectorIndex );
+            FacePlanes[ SubFace->Index ] = Plane;
+            SubFace->TextureId = Leaf->TextureId;
+            SubFace->TexCoordAxis[ 0 ] = Leaf->TexCoordAxis[ 0 ];
+            SubFace->TexCoordAxis[ 1 ] = Leaf->TexCoordAxis[ 1 ];
+            SubFace->TexCoordOffset[ 0 ] = Leaf->TexCoordOffset[ 0 ];
+            SubFace->TexCoordOffset[ 1 ] = Leaf->TexCoordOffset[ 1 ];
+            SubFace->Vertices = Leaf->Vertices;
+            SubFace->Indices = Leaf->Indices;
+
+            Face->SubFaces[ NumSubFaces++ ] = SubFace;
         } else {
             Out() << "Leaf with no vertices";
         }
     }
-    Leafs.Clear();
 
-    //assert( _Face->SubFaces.Length() > 0 );
+    //assert( Face->SubFaces.Length() > 0 );
 }
 
-static void ConvertFacePlane( PlaneD & _Plane ) {
-    _Plane.Normal.Y = -_Plane.Normal.Y;
-    _Plane.Normal.Z = -_Plane.Normal.Z;
-    _Plane.D *= 0.001;
+FBladeWorld::FFaceBuild & FBladeWorld::AddFaceBuild( FFace * _Face ) {
+    FaceBuilds.Append( FFaceBuild() );
+    FFaceBuild & Build = FaceBuilds.Last();
+    Build.Face = _Face;
+    return Build;
 }
 
-FBladeWorld::FBSPNode * FBladeWorld::ReadBSPNode_r( FFace * _Face ) {
+void FBladeWorld::BuildFaces() {
+    // Faces are independent: clip and triangulate them in parallel. Every job writes only
+    // to its own face, BSP nodes and build record.
+    GJobPool.ParallelFor( FaceBuilds.Length(), [this]( int _Index, int _WorkerIndex ) {
+        FFaceBuild & Build = FaceBuilds[ _Index ];
+        if ( FaceTypes[ Build.Face->Index ] == FT_Face ) {
+            BuildFaceWithHole( Build, WorkerScratch[ _WorkerIndex ], WorkerArenas[ _WorkerIndex ] );
+        } else {
+            BuildFaceBSP( Build, WorkerScratch[ _WorkerIndex ], WorkerArenas[ _WorkerIndex ] );
+        }
+    } );
+
+    // Create subfaces serially in file order, so the result doesn't depend on job scheduling.
+    // Subfaces are appended to the face table after the faces of all sectors.
+    for ( int i = 0 ; i < FaceBuilds.Length() ; i++ ) {
+        if ( FaceTypes[ FaceBuilds[ i ].Face->Index ] == FT_FaceBSP ) {
+            CreateSubfaces( FaceBuilds[ i ] );
+        }
+    }
+
+    FaceBuilds.Clear();
+}
+
+Float3 ConvertPosition( const Double3 & _Position ) {
+    return Float3( _Position * BLADE_COORD_SCALE_D );
+}
+
+PlaneF ConvertPlane( const PlaneD & _Plane ) {
+    PlaneF Plane;
+    Plane.Normal.X = _Plane.Normal.X;
+    Plane.Normal.Y = -_Plane.Normal.Y;
+    Plane.Normal.Z = -_Plane.Normal.Z;
+    Plane.D = _Plane.D * BLADE_COORD_SCALE_D.X;
+    return Plane;
+}
+
+// Nodes are stored in pre-order: node type, then leaf data or both subtrees followed by the node plane
+// and texture info. Read them with an explicit stack, the tree depth is not limited by the call stack.
+FBladeWorld::FBSPNode * FBladeWorld::ReadBSPTree( FFace * _Face ) {
     // Special thanks to ASP for node parsing
 
-    FBSPNode * Node = CreateBSPNode();
+    struct FReadStackEntry {
+        FBSPNode * Node;
+        int NumChildrenRead;
+    };
+
+    TPodArray< FReadStackEntry > Stack;
+
+    FBSPNode * Root = NULL;
+
+    for ( ;; ) {
+        // Read node header
+        FBSPNode * Node = CreateBSPNode();
+
+        Node->Type = ( ENodeType )Cursor.ReadInt32();
+
+        if ( Cursor.IsOverflow() ) {
+            // Stop reading on truncated file
+            Node->Type = NT_Leaf;
+        }
 
-    File->ReadSwapInt32( ( int32_t & )Node->Type );
+        if ( !Root ) {
+            Root = Node;
+        } else {
+            FReadStackEntry & Parent = Stack.Last();
+            Parent.Node->Children[ Parent.NumChildrenRead++ ] = Node;
+        }
 
-    if ( Node->Type == NT_Leaf ) {
+        if ( Node->Type != NT_Leaf ) {
+            FReadStackEntry Entry;
+            Entry.Node = Node;
+            Entry.NumChildrenRead = 0;
+            Stack.Append( Entry );
+            continue;
+        }
 
         Node->Children[0] = NULL;
         Node->Children[1] = NULL;
 
-        int Count = DumpInt( File );
+        int Count = Cursor.ReadInt32();
+        if ( !Cursor.CanRead( Count, 8 ) ) {
+            Count = 0;
+        }
 
-        Node->Unknown.Resize( Count );
+        Node->Unknown = LoadArena.AllocArray< FLeafIndices >( Count );
 
         for ( int i = 0; i < Count; i++ ) {
             FLeafIndices & Unknown = Node->Unknown[ i ];
 
-            Unknown.UnknownIndex = DumpInt( File );
+            Unknown.UnknownIndex = Cursor.ReadInt32();
 
-            uint32_t IndicesCount = DumpInt( File );
-            Unknown.Indices.Resize( IndicesCount );
-            for ( int j = 0; j < IndicesCount; j++ ) {
-                Unknown.Indices[ j ] = DumpInt( File );
-            }
+            ReadIndices( Unknown.Indices, LoadArena );
         }
 
-        return Node;
-    }    
+        // Finish the nodes whose subtrees are complete
+        while ( Stack.Length() > 0 && Stack.Last().NumChildrenRead == 2 ) {
+            FBSPNode * Parent = Stack.Last().Node;
+            Stack.Resize( Stack.Length() - 1 );
 
-    Node->Children[0] = ReadBSPNode_r( _Face );
-    Node->Children[1] = ReadBSPNode_r( _Face );
+            ReadNodeTail( Parent );
+        }
 
-    File->ReadSwapVector( Node->Plane.Normal );
-    File->ReadSwapDouble( Node->Plane.D.Value );
+        if ( Stack.Length() == 0 ) {
+            break;
+        }
+    }
+
+    return Root;
+}
 
-    if ( Node->Type == NT_TexInfo ) {
-        File->ReadSwapUInt64( Node->UnknownSignature );
-        File->ReadString( Node->TextureName );
+void FBladeWorld::ReadNodeTail( FBSPNode * _Node ) {
+    Cursor.ReadPlane( _Node->Plane );
 
-        File->ReadSwapVector( Node->TexCoordAxis[0] );
-        File->ReadSwapVector( Node->TexCoordAxis[1] );
-        File->ReadSwapFloat( Node->TexCoordOffset[0] );
-        File->ReadSwapFloat( Node->TexCoordOffset[1] );
+    if ( _Node->Type == NT_TexInfo ) {
+        _Node->UnknownSignature = Cursor.ReadUInt64();
+        _Node->TextureId = ReadTextureId( Cursor );
 
-        Node->TexCoordOffset[ 0 ] = -Node->TexCoordOffset[ 0 ];
-        Node->TexCoordOffset[ 1 ] = -Node->TexCoordOffset[ 1 ];
+        Cursor.ReadVector( _Node->TexCoordAxis[0] );
+        Cursor.ReadVector( _Node->TexCoordAxis[1] );
+        _Node->TexCoordOffset[0] = Cursor.ReadFloat();
+        _Node->TexCoordOffset[1] = Cursor.ReadFloat();
+
+        _Node->TexCoordOffset[ 0 ] = -_Node->TexCoordOffset[ 0 ];
+        _Node->TexCoordOffset[ 1 ] = -_Node->TexCoordOffset[ 1 ];
 
         // 8 zero bytes?
         for ( int k = 0 ; k < 8 ; k++ ) {
-            if ( DumpByte( File ) != 0 ) {
+            if ( Cursor.ReadByte() != 0 ) {
                 Out() << "not zero!";
             }
         }
     }
-
-    return Node;
 }
 
 void FBladeWorld::LoadSkydomeFace( FFace * _Face ) {
     // Face plane
-    File->ReadSwapVector( _Face->Plane.Normal );
-    File->ReadSwapDouble( _Face->Plane.D.Value );
+    ReadFacePlane( _Face->Index );
 
     // Winding
-    ReadIndices( _Face->Indices );
+    ReadIndices( _Face->Indices, DataArena );
 }
 
-#define USE_TEXCOORD_CORRECTION
+// Texture axes are in file space, so texture coordinates are generated from file space positions
+static void AddTexCoordFace( const FBladeWorld::FFace * _Face, int _TexWidth, int _TexHeight, int _FirstVertex, FTexCoordBatch & _TexCoords ) {
+    FTexCoordFace & Mapping = _TexCoords.AddFace( _FirstVertex );
 
-static void RecalcTextureCoords( FBladeWorld::FFace * _Face, FMeshVertex * _Vertices, int _NumVertices, int _TexWidth, int _TexHeight ) {
-#ifdef USE_TEXCOORD_CORRECTION
-    Float2 Mins( std::numeric_limits< float >::max() );
-#endif
+    for ( int i = 0 ; i < 2 ; i++ ) {
+        Mapping.Axis[ i ][ 0 ] = _Face->TexCoordAxis[ i ].X;
+        Mapping.Axis[ i ][ 1 ] = _Face->TexCoordAxis[ i ].Y;
+        Mapping.Axis[ i ][ 2 ] = _Face->TexCoordAxis[ i ].Z;
+        Mapping.Offset[ i ] = _Face->TexCoordOffset[ i ];
+    }
 
-    double tx, ty;
-    double sx = 1.0 / _TexWidth;
-    double sy = 1.0 / _TexHeight;
+    Mapping.Scale[ 0 ] = 1.0 / _TexWidth;
+    Mapping.Scale[ 1 ] = 1.0 / _TexHeight;
+}
 
-    for ( int k = 0 ; k < _NumVertices ; k++ ) {
-        FMeshVertex & Vert = _Vertices[ k ];
+// Texture mapping of a face is affine, so its tangent frame is the same for all face vertices. Tangent and
+// bitangent are directions of increasing texture coordinates in the face plane. Texture axes are gradients
+// of texture coordinates in file space, their world space directions differ by the axis flip only. Scale
+// of the gradients doesn't matter, the tangent is normalized.
+static void CalcFaceTangentSpace( const FBladeWorld::FFace * _Face, const Float3 & _Normal, FMeshVertex * _Vertices, int _NumVertices ) {
+    const Double3 Normal( _Normal );
 
-        tx = FMath::Dot( _Face->TexCoordAxis[ 0 ], Double3( Vert.Position ) ) + double(_Face->TexCoordOffset[ 0 ]);
-        ty = FMath::Dot( _Face->TexCoordAxis[ 1 ], Double3( Vert.Position ) ) + double(_Face->TexCoordOffset[ 1 ]);
-        tx *= sx;
-        ty *= sy;
+    Double3 GradU( _Face->TexCoordAxis[ 0 ].X, -_Face->TexCoordAxis[ 0 ].Y, -_Face->TexCoordAxis[ 0 ].Z );
+    Double3 GradV( _Face->TexCoordAxis[ 1 ].X, -_Face->TexCoordAxis[ 1 ].Y, -_Face->TexCoordAxis[ 1 ].Z );
 
-        Vert.TexCoord.X = tx;
-        Vert.TexCoord.Y = ty;
+    GradU -= Normal * FMath::Dot( Normal, GradU );
+    GradV -= Normal * FMath::Dot( Normal, GradV );
 
-#ifdef USE_TEXCOORD_CORRECTION
-        Mins.X = FMath::Min( Vert.TexCoord.X, Mins.X );
-        Mins.Y = FMath::Min( Vert.TexCoord.Y, Mins.Y );
-#endif
+    // Tangent is orthogonal to GradV, bitangent is orthogonal to GradU
+    Double3 Tangent = FMath::Cross( GradV, Normal );
+    Double3 Bitangent = FMath::Cross( Normal, GradU );
+
+    const double TangentScale = FMath::Dot( GradU, Tangent );
+    const double BitangentScale = FMath::Dot( GradV, Bitangent );
+
+    Float3 FaceTangent;
+    float Handedness = 1.0f;
+
+    if ( fabs( TangentScale ) > 1e-12 && fabs( BitangentScale ) > 1e-12 ) {
+        Tangent *= 1.0 / TangentScale;
+        Bitangent *= 1.0 / BitangentScale;
+
+        Handedness = FMath::Dot( FMath::Cross( Normal, Tangent ), Bitangent ) < 0.0 ? -1.0f : 1.0f;
+
+        Tangent.NormalizeSelf();
+        FaceTangent = Float3( Tangent );
+    } else {
+        // Degenerate mapping (sky and untextured faces): any direction in the plane
+        Tangent = fabs( Normal.X ) < 0.9 ? FMath::Cross( Normal, Double3( 1, 0, 0 ) ) : FMath::Cross( Normal, Double3( 0, 1, 0 ) );
+        Tangent.NormalizeSelf();
+        FaceTangent = Float3( Tangent );
     }
 
-#ifdef USE_TEXCOORD_CORRECTION
-    // Скорректировать текстурные координаты, чтобы они были ближе к нулю
-    Mins.X = Mins.X.Floor();
-    Mins.Y = Mins.Y.Floor();
     for ( int k = 0 ; k < _NumVertices ; k++ ) {
-        FMeshVertex & Vert = _Vertices[ k ];
-        Vert.TexCoord -= Mins;
+        _Vertices[ k ].Tangent = FaceTangent;
+        _Vertices[ k ].Handedness = Handedness;
     }
-#endif
 }
 
-// Generate world mesh
-void FBladeWorld::WorldGeometryPostProcess() {
-    FMeshOffset MeshOffset;
+// Set face flags
+void FBladeWorld::ClassifyFace( int _FaceIndex, int _SkyTextureId ) {
+    FFace * Face = Faces[ _FaceIndex ];
+    FSector & Sector = Sectors[ FaceSectors[ _FaceIndex ] ];
+    int Type = FaceTypes[ _FaceIndex ];
+
+    if ( Type == FT_Skydome ) {
+        FaceFlags[ _FaceIndex ] = 0;
+        HasSky = true;
+    } else if ( Face->TextureId == 0 ) {
+        FaceFlags[ _FaceIndex ] = 0;
+    } else if ( Face->TextureId == _SkyTextureId ) {
+        FaceFlags[ _FaceIndex ] = 0;
+        HasSky = true;
+    } else if ( Sector.Portals.Length() == 0 ) {
+        FaceFlags[ _FaceIndex ] = 0;
+    } else {
+        FaceFlags[ _FaceIndex ] = FF_CastShadows;
+    }
+}
+
+// Sort faces by shadow flag, sector and material, so each of them forms contiguous draw ranges.
+// Original order breaks ties to keep the sort stable.
+void FBladeWorld::SortMeshOrder( TPodArray< int > & _MeshOrder ) const {
+    TPodArray< int > MeshOrderPositions;
+    MeshOrderPositions.Resize( _MeshOrder.Length() );
+    for ( int i = 0 ; i < _MeshOrder.Length() ; i++ ) {
+        MeshOrderPositions[ i ] = i;
+    }
+
+    class FaceSort : public TQuickSort< int, FaceSort > {
+    public:
+        const FBladeWorld * World;
+        const int * Order;
+
+        bool operator() ( int _First, int _Second ) {
+            const int FirstFace = Order[ _First ];
+            const int SecondFace = Order[ _Second ];
+
+            const int FirstShadow = World->FaceFlags[ FirstFace ] & FF_CastShadows;
+            const int SecondShadow = World->FaceFlags[ SecondFace ] & FF_CastShadows;
+            if ( FirstShadow != SecondShadow ) {
+                return FirstShadow < SecondShadow;
+            }
+
+            if ( World->FaceSectors[ FirstFace ] != World->FaceSectors[ SecondFace ] ) {
+                return World->FaceSectors[ FirstFace ] < World->FaceSectors[ SecondFace ];
+            }
+
+            const int FirstMaterial = World->GetFaceMaterial( FirstFace );
+            const int SecondMaterial = World->GetFaceMaterial( SecondFace );
+            if ( FirstMaterial != SecondMaterial ) {
+                return FirstMaterial < SecondMaterial;
+            }
+
+            return _First < _Second;
+        }
+    };
+
+    FaceSort Sort;
+    Sort.World = this;
+    Sort.Order = _MeshOrder.ToPtr();
+    Sort.Sort( MeshOrderPositions.ToPtr(), MeshOrderPositions.Length() );
+
+    TPodArray< int > SortedOrder;
+    SortedOrder.Resize( _MeshOrder.Length() );
+    for ( int i = 0 ; i < _MeshOrder.Length() ; i++ ) {
+        SortedOrder[ i ] = _MeshOrder[ MeshOrderPositions[ i ] ];
+    }
+    _MeshOrder = SortedOrder;
+}
+
+// Append face triangles to the mesh. Updates sector bounds and the sum of vertex positions for
+// the sector centroid. Texture mapping of the face goes to _TexCoords, texture coordinates are generated
+// for all faces at once. Returns false if the face has no geometry of its own.
+bool FBladeWorld::EmitFaceMesh( int _FaceIndex, TArray< FMeshVertex > & _Vertices, TArray< unsigned int > & _Indices, FMeshOffset & _MeshOffset, FTexCoordBatch & _TexCoords ) {
+    FFace * Face = Faces[ _FaceIndex ];
+    int Type = FaceTypes[ _FaceIndex ];
+    const PlaneF & Plane = FacePlanes[ _FaceIndex ];
+    FSector & Sector = Sectors[ FaceSectors[ _FaceIndex ] ];
     FMeshVertex Vertex;
-    int FirstVertex;
+    int FirstVertex = _Vertices.Length();
+    int NumVertices;
+
+    if ( Type == FT_Portal || Type == FT_FaceBSP ) {
+        return false;
+    }
+
+    if ( Face->Indices.Length() < 3 ) {
+        return false;
+    }
+
+    // Face winding indexes the vertex table, clipped faces index their own vertices
+    const int NumIndexed = Face->Vertices.Length() > 0 ? Face->Vertices.Length() : GetFileVertices().Length();
+    for ( int j = 0 ; j < Face->Indices.Length() ; j++ ) {
+        if ( Face->Indices[ j ] >= ( unsigned int )NumIndexed ) {
+            Out() << "WARNING: face" << _FaceIndex << "has vertex index out of range";
+            return false;
+        }
+    }
 
     memset( &Vertex, 0, sizeof( Vertex ) );
-    FirstVertex = 0;
 
-    MeshOffset.BaseVertexLocation = 0;
-    MeshOffset.StartIndexLocation = 0;
-    MeshOffset.IndexCount = 0;
+    _MeshOffset.BaseVertexLocation = 0;
+    _MeshOffset.StartIndexLocation = _Indices.Length();
+
+    int TexWidth, TexHeight;
+    GetTextureSize( Face->TextureId, TexWidth, TexHeight );
+    AddTexCoordFace( Face, TexWidth, TexHeight, FirstVertex, _TexCoords );
+
+    if ( Face->Vertices.Length() > 0 ) {
+        for ( int v = 0 ; v < Face->Vertices.Length() ; v++ ) {
+            Vertex.Position = ConvertPosition( Face->Vertices[ v ] );
+            Vertex.Normal = Plane.Normal;
+
+            _Vertices.Append( Vertex );
+            _TexCoords.AddPosition( Face->Vertices[ v ] );
+        }
+
+        for ( int j = 0 ; j < Face->Indices.Length() ; j++ ) {
+            _Indices.Append( FirstVertex + Face->Indices[ j ] );
+        }
+
+        _MeshOffset.IndexCount = Face->Indices.Length();
+
+        NumVertices = Face->Vertices.Length();
+    } else {
+        for ( int j = 0 ; j < Face->Indices.Length() ; j++ ) {
+            int Index = Face->Indices[ j ];
+
+            Vertex.Position = ConvertPosition( GetFileVertices()[ Index ] );
+            Vertex.Normal = Plane.Normal;
+
+            _Vertices.Append( Vertex );
+            _TexCoords.AddPosition( GetFileVertices()[ Index ] );
+        }
+
+        // triangle fan -> triangles
+        for ( int j = 0 ; j < Face->Indices.Length() - 2 ; j++ ) {
+            _Indices.Append( FirstVertex + 0 );
+            _Indices.Append( FirstVertex + Face->Indices.Length() - j - 2 );
+            _Indices.Append( FirstVertex + Face->Indices.Length() - j - 1 );
+        }
+
+        _MeshOffset.IndexCount = ( Face->Indices.Length() - 2 ) * 3;
+
+        NumVertices = Face->Indices.Length();
+    }
+
+    CalcFaceTangentSpace( Face, Plane.Normal, &_Vertices[ FirstVertex ], NumVertices );
 
-    ShadowCasterMeshOffset.BaseVertexLocation = 0;
-    ShadowCasterMeshOffset.StartIndexLocation = 0;
-    ShadowCasterMeshOffset.IndexCount = 0;
+    for ( int v = 0 ; v < NumVertices ; v++ ) {
+        const FMeshVertex & Vert = _Vertices[ v + FirstVertex ];
+
+        Sector.Bounds.AddPoint( Vert.Position );
+        Sector.Centroid += Vert.Position;
+    }
+
+    return true;
+}
+
+// Compare batch texture coordinate generation with the scalar version on the world mesh
+static void BenchmarkTexCoords( const FTexCoordBatch & _TexCoords, int _NumVertices, int _Iterations ) {
+    typedef std::chrono::steady_clock FClock;
+
+    TArray< FMeshVertex > Scalar;
+    TArray< FMeshVertex > Batch;
+
+    Scalar.Resize( _NumVertices );
+    Batch.Resize( _NumVertices );
+    memset( Scalar.ToPtr(), 0, _NumVertices * sizeof( FMeshVertex ) );
+    memset( Batch.ToPtr(), 0, _NumVertices * sizeof( FMeshVertex ) );
+
+    FClock::time_point Start = FClock::now();
+    for ( int i = 0 ; i < _Iterations ; i++ ) {
+        GenerateTexCoordsScalar( _TexCoords, Scalar.ToPtr() );
+    }
+    FClock::time_point Middle = FClock::now();
+    for ( int i = 0 ; i < _Iterations ; i++ ) {
+        GenerateTexCoords( _TexCoords, Batch.ToPtr() );
+    }
+    FClock::time_point End = FClock::now();
+
+    float MaxDifference = 0;
+    for ( int i = 0 ; i < _NumVertices ; i++ ) {
+        MaxDifference = FMath::Max( MaxDifference, fabsf( Scalar[ i ].TexCoord.X - Batch[ i ].TexCoord.X ) );
+        MaxDifference = FMath::Max( MaxDifference, fabsf( Scalar[ i ].TexCoord.Y - Batch[ i ].TexCoord.Y ) );
+    }
+
+    const float ScalarTime = std::chrono::duration< float, std::milli >( Middle - Start ).count() / _Iterations;
+    const float BatchTime = std::chrono::duration< float, std::milli >( End - Middle ).count() / _Iterations;
+
+    Out() << "Texture coordinates:" << _TexCoords.Faces.Length() << "faces," << _NumVertices << "vertices, scalar"
+          << ScalarTime << "ms, batch" << BatchTime << "ms, max difference" << MaxDifference;
+}
+
+// Generate world mesh
+void FBladeWorld::WorldGeometryPostProcess() {
+    FMeshOffset MeshOffset;
 
     TPodArray< int > VerticesCounts;
     VerticesCounts.Resize( Sectors.Length() );
@@ -923,235 +1926,393 @@ void FBladeWorld::WorldGeometryPostProcess() {
         VerticesCounts[ SectorIndex ] = 0;
     }
 
+    // Sector faces are followed by subfaces in the face table
+    int NumSectorFaces = Faces.Length();
     for ( int FaceIndex = 0 ; FaceIndex < Faces.Length() ; FaceIndex++ ) {
-        FFace * Face = Faces[ FaceIndex ];
-        FSector & Sector = Sectors[ Face->SectorIndex ];
-
-        if ( Face->Type == FT_Skydome ) {
-            Face->CastShadows = false;
-            HasSky = true;
-        } else if ( Face->TextureName.Length() == 0 ) {
-            Face->CastShadows = false;
-        } else if ( Face->TextureName == "blanca" ) {
-            Face->CastShadows = false;
-            HasSky = true;
-        } else if ( Sector.Portals.Length() == 0 ) {
-            Face->CastShadows = false;
-        } else {
-            Face->CastShadows = true;
+        if ( FaceTypes[ FaceIndex ] == FT_Subface ) {
+            NumSectorFaces = FaceIndex;
+            break;
         }
     }
 
-    class FaceSort : public TQuickSort< FFace *, FaceSort > {
-    public:
-        bool operator() ( FFace * _First, FFace * _Second ) {
-            return _First->CastShadows < _Second->CastShadows;
-        }
-    };
-
-    FaceSort().Sort( Faces.ToPtr(), Faces.Length() );
+    const int SkyTextureId = FindTexture( "blanca" );
 
     for ( int FaceIndex = 0 ; FaceIndex < Faces.Length() ; FaceIndex++ ) {
+        ClassifyFace( FaceIndex, SkyTextureId );
+    }
 
-        FFace * Face = Faces[ FaceIndex ];
-        FSector & Sector = Sectors[ Face->SectorIndex ];
-        int & VerticesCount = VerticesCounts[ Face->SectorIndex ];
-
-        ConvertFacePlane( Face->Plane );
+    // Mesh order: each face followed by its subfaces
+    TPodArray< int > MeshOrder;
+    MeshOrder.Reserve( Faces.Length() );
+    for ( int FaceIndex = 0 ; FaceIndex < NumSectorFaces ; FaceIndex++ ) {
+        MeshOrder.Append( FaceIndex );
 
-        if ( Face->Type == FT_Portal || Face->Type == FT_FaceBSP ) {
-            continue;
+        const TArenaArray< FFace * > & SubFaces = Faces[ FaceIndex ]->SubFaces;
+        for ( int i = 0 ; i < SubFaces.Length() ; i++ ) {
+            MeshOrder.Append( SubFaces[ i ]->Index );
         }
+    }
 
-        if ( Face->Indices.Length() < 3 ) {
+    SortMeshOrder( MeshOrder );
+
+    FTexCoordBatch TexCoords;
+
+    for ( int i = 0 ; i < MeshOrder.Length() ; i++ ) {
+        int FaceIndex = MeshOrder[ i ];
+        int FirstVertex = MeshVertices.Length();
+
+        if ( !EmitFaceMesh( FaceIndex, MeshVertices, MeshIndices, MeshOffset, TexCoords ) ) {
             continue;
         }
 
-        MeshOffset.StartIndexLocation = MeshIndices.Length();
+        VerticesCounts[ FaceSectors[ FaceIndex ] ] += MeshVertices.Length() - FirstVertex;
 
-        if ( Face->Vertices.Length() > 0 ) {
-            for ( int v = 0 ; v < Face->Vertices.Length() ; v++ ) {
-                Vertex.Position.X = Face->Vertices[ v ].X;
-                Vertex.Position.Y = Face->Vertices[ v ].Y;
-                Vertex.Position.Z = Face->Vertices[ v ].Z;
-                Vertex.Normal = Float3( Face->Plane.Normal );
+        MeshOffsets.Append( MeshOffset );
+        MeshFaces.Append( FaceIndex );
+    }
 
-                MeshVertices.Append( Vertex );
-            }
+    GenerateTexCoords( TexCoords, MeshVertices.ToPtr() );
 
-            for ( int j = 0 ; j < Face->Indices.Length() ; j++ ) {
-                MeshIndices.Append( FirstVertex + Face->Indices[ j ] );
-            }
+    if ( world_texcoord_benchmark.GetInteger() > 0 ) {
+        BenchmarkTexCoords( TexCoords, MeshVertices.Length(), world_texcoord_benchmark.GetInteger() );
+    }
 
-            MeshOffset.IndexCount = Face->Indices.Length();
+    if ( world_weld.GetBool() ) {
+        WeldMeshVertices();
+    }
 
-            RecalcTextureCoords( Face, &MeshVertices[ FirstVertex ], Face->Vertices.Length(), 256, 256 );
+    if ( world_optimize_mesh.GetBool() ) {
+        OptimizeMesh();
+    }
 
-            for ( int v = 0 ; v < Face->Vertices.Length() ; v++ ) {
-                FMeshVertex & Vert = MeshVertices[ v + FirstVertex ];
+    BuildMeshBatches();
 
-                Vert.Position *= BLADE_COORD_SCALE_F;
+    for ( int SectorIndex = 0 ; SectorIndex < Sectors.Length() ; SectorIndex++ ) {
+        Sectors[ SectorIndex ].Centroid *= 1.0f / VerticesCounts[ SectorIndex ];
 
-                Sector.Bounds.AddPoint( Vert.Position );
-                Sector.Centroid += Vert.Position;
-                VerticesCount++;
-            }
+        Bounds.AddAABB( Sectors[ SectorIndex ].Bounds );
+    }
+}
 
-            FirstVertex += Face->Vertices.Length();
+// Build mesh of a loaded sector in its own vertex space. Sector draw ranges are sorted by shadow flag
+// and material as in WorldGeometryPostProcess.
+void FBladeWorld::BuildSectorMesh( int _SectorIndex, FSectorMesh & _Mesh ) {
+    FSector & Sector = Sectors[ _SectorIndex ];
 
-        } else {
-            for ( int j = 0 ; j < Face->Indices.Length() ; j++ ) {
-                int Index = Face->Indices[ j ];
+    const int SkyTextureId = FindTexture( "blanca" );
 
-                Vertex.Position = Float3( Vertices[ Index ] );
-                Vertex.Normal = Float3( Face->Plane.Normal );
+    // Mesh order: each face followed by its subfaces
+    TPodArray< int > MeshOrder;
+    for ( int FaceIndex = Sector.FirstFace ; FaceIndex < Sector.FirstFace + Sector.NumFaces ; FaceIndex++ ) {
+        ClassifyFace( FaceIndex, SkyTextureId );
+        MeshOrder.Append( FaceIndex );
 
-                MeshVertices.Append( Vertex );
-            }
+        const TArenaArray< FFace * > & SubFaces = Faces[ FaceIndex ]->SubFaces;
+        for ( int i = 0 ; i < SubFaces.Length() ; i++ ) {
+            ClassifyFace( SubFaces[ i ]->Index, SkyTextureId );
+            MeshOrder.Append( SubFaces[ i ]->Index );
+        }
+    }
 
-            // triangle fan -> triangles
-            for ( int j = 0 ; j < Face->Indices.Length() - 2 ; j++ ) {
-                MeshIndices.Append( FirstVertex + 0 );
-                MeshIndices.Append( FirstVertex + Face->Indices.Length() - j - 2 );
-                MeshIndices.Append( FirstVertex + Face->Indices.Length() - j - 1 );
-            }
+    SortMeshOrder( MeshOrder );
 
-            MeshOffset.IndexCount = ( Face->Indices.Length() - 2 ) * 3;
+    FMeshOffset MeshOffset;
 
-            RecalcTextureCoords( Face, &MeshVertices[ FirstVertex ], Face->Indices.Length(), 256, 256 );
+    _Mesh.Vertices.Clear();
+    _Mesh.Indices.Clear();
+    _Mesh.MeshOffsets.Clear();
+    _Mesh.MeshFaces.Clear();
+    _Mesh.Materials.Clear();
+    _Mesh.Flags.Clear();
 
-            for ( int v = 0 ; v < Face->Indices.Length() ; v++ ) {
-                FMeshVertex & Vert = MeshVertices[ v + FirstVertex ];
+    Sector.Bounds.Clear();
+    Sector.Centroid = Float3( 0 );
 
-                Vert.Position *= BLADE_COORD_SCALE_F;
+    FTexCoordBatch TexCoords;
 
-                Sector.Bounds.AddPoint( Vert.Position );
-                Sector.Centroid += Vert.Position;
-                VerticesCount++;
-            }
+    for ( int i = 0 ; i < MeshOrder.Length() ; i++ ) {
+        const int FaceIndex = MeshOrder[ i ];
 
-            FirstVertex += Face->Indices.Length();
+        if ( EmitFaceMesh( FaceIndex, _Mesh.Vertices, _Mesh.Indices, MeshOffset, TexCoords ) ) {
+            _Mesh.MeshOffsets.Append( MeshOffset );
+            _Mesh.MeshFaces.Append( FaceIndex );
+            _Mesh.Materials.Append( GetFaceMaterial( FaceIndex ) );
+            _Mesh.Flags.Append( FaceFlags[ FaceIndex ] );
         }
+    }
 
-        if ( Face->CastShadows ) {
-            if ( ShadowCasterMeshOffset.IndexCount == 0 ) {
-                ShadowCasterMeshOffset.StartIndexLocation = MeshOffset.StartIndexLocation;
-            }
+    if ( _Mesh.Vertices.Length() > 0 ) {
+        Sector.Centroid *= 1.0f / _Mesh.Vertices.Length();
+    }
+
+    _Mesh.Bounds = Sector.Bounds;
+
+    GenerateTexCoords( TexCoords, _Mesh.Vertices.ToPtr() );
+
+    if ( world_weld.GetBool() ) {
+        WeldVertices( _Mesh.Vertices, _Mesh.Indices.ToPtr(), _Mesh.Indices.Length(), NULL );
+    }
 
-            ShadowCasterMeshOffset.IndexCount += MeshOffset.IndexCount;
+    if ( world_optimize_mesh.GetBool() ) {
+        for ( int i = 0 ; i < _Mesh.MeshOffsets.Length() ; i++ ) {
+            OptimizeVertexCache( _Mesh.Indices.ToPtr() + _Mesh.MeshOffsets[ i ].StartIndexLocation, _Mesh.MeshOffsets[ i ].IndexCount );
         }
 
+        OptimizeVertexFetch( _Mesh.Vertices, _Mesh.Indices.ToPtr(), _Mesh.Indices.Length() );
+    }
+}
+
+// Append sector mesh to the world mesh
+void FBladeWorld::AppendSectorMesh( int _SectorIndex, const FSectorMesh & _Mesh ) {
+    // World mesh indices are absolute
+    const int FirstVertex = MeshVertices.Length();
+    const int FirstIndex = MeshIndices.Length();
+
+    MeshVertices.Resize( FirstVertex + _Mesh.Vertices.Length() );
+    memcpy( MeshVertices.ToPtr() + FirstVertex, _Mesh.Vertices.ToPtr(), _Mesh.Vertices.Length() * sizeof( FMeshVertex ) );
+
+    MeshIndices.Resize( FirstIndex + _Mesh.Indices.Length() );
+    for ( int i = 0 ; i < _Mesh.Indices.Length() ; i++ ) {
+        MeshIndices[ FirstIndex + i ] = FirstVertex + _Mesh.Indices[ i ];
+    }
+
+    for ( int i = 0 ; i < _Mesh.MeshOffsets.Length() ; i++ ) {
+        FMeshOffset MeshOffset = _Mesh.MeshOffsets[ i ];
+        MeshOffset.StartIndexLocation += FirstIndex;
+
         MeshOffsets.Append( MeshOffset );
-        MeshFaces.Append( Face );
+        MeshFaces.Append( _Mesh.MeshFaces[ i ] );
     }
 
-    CalcTangentSpace( MeshVertices.ToPtr(), MeshVertices.Length(), MeshIndices.ToPtr(), MeshIndices.Length() );
+    BuildMeshBatches();
+
+    Bounds.AddAABB( Sectors[ _SectorIndex ].Bounds );
+}
+
+int FBladeWorld::GetFaceMaterial( int _FaceIndex ) const {
+    // Skydome faces are drawn with the sky material as faces without texture
+    return FaceTypes[ _FaceIndex ] == FT_Skydome ? 0 : Faces[ _FaceIndex ]->TextureId;
+}
+
+// Merge sorted draw ranges into batches of the same shadow flag, sector and material, and find
+// the ranges of each sector
+void FBladeWorld::BuildMeshBatches() {
+    MeshBatches.Clear();
 
     for ( int SectorIndex = 0 ; SectorIndex < Sectors.Length() ; SectorIndex++ ) {
-        Sectors[ SectorIndex ].Centroid *= 1.0f / VerticesCounts[ SectorIndex ];
+        FSector & Sector = Sectors[ SectorIndex ];
 
-        Bounds.AddAABB( Sectors[ SectorIndex ].Bounds );
+        for ( int Group = 0 ; Group < 2 ; Group++ ) {
+            Sector.FirstMeshOffset[ Group ] = 0;
+            Sector.NumMeshOffsets[ Group ] = 0;
+            Sector.FirstBatch[ Group ] = 0;
+            Sector.NumBatches[ Group ] = 0;
+            Sector.IndexRange[ Group ].BaseVertexLocation = 0;
+            Sector.IndexRange[ Group ].StartIndexLocation = 0;
+            Sector.IndexRange[ Group ].IndexCount = 0;
+        }
     }
-}
 
-void FBladeWorld::FreeWorld() {
-    Atmospheres.Clear();
-    Vertices.Clear();
-    Sectors.Clear();
-    MeshOffsets.Clear();
-    MeshVertices.Clear();
-    MeshIndices.Clear();
-    MeshFaces.Clear();
+    for ( int i = 0 ; i < MeshOffsets.Length() ; i++ ) {
+        const FMeshOffset & MeshOffset = MeshOffsets[ i ];
+        const int FaceIndex = MeshFaces[ i ];
+        const int Group = FaceFlags[ FaceIndex ] & FF_CastShadows;
+        const int SectorIndex = FaceSectors[ FaceIndex ];
+        const int Material = GetFaceMaterial( FaceIndex );
 
-    for ( int i = 0 ; i < Portals.Length() ; i++ ) {
-        delete Portals[i];
+        FSector & Sector = Sectors[ SectorIndex ];
+
+        if ( Sector.NumMeshOffsets[ Group ] == 0 ) {
+            Sector.FirstMeshOffset[ Group ] = i;
+            Sector.FirstBatch[ Group ] = MeshBatches.Length();
+            Sector.IndexRange[ Group ] = MeshOffset;
+            Sector.IndexRange[ Group ].IndexCount = 0;
+        }
+
+        // Draw ranges of a sector must be contiguous
+        assert( Sector.FirstMeshOffset[ Group ] + Sector.NumMeshOffsets[ Group ] == i );
+
+        Sector.NumMeshOffsets[ Group ]++;
+        Sector.IndexRange[ Group ].IndexCount += MeshOffset.IndexCount;
+
+        if ( MeshBatches.Length() > Sector.FirstBatch[ Group ] && MeshBatches.Last().Material == Material ) {
+            FMeshBatch & Batch = MeshBatches.Last();
+            Batch.NumMeshOffsets++;
+            Batch.Range.IndexCount += MeshOffset.IndexCount;
+            continue;
+        }
+
+        FMeshBatch Batch;
+        Batch.SectorIndex = SectorIndex;
+        Batch.Material = Material;
+        Batch.Flags = FaceFlags[ FaceIndex ] & FF_CastShadows;
+        Batch.FirstMeshOffset = i;
+        Batch.NumMeshOffsets = 1;
+        Batch.Range = MeshOffset;
+        MeshBatches.Append( Batch );
+
+        Sector.NumBatches[ Group ]++;
     }
-    Portals.Clear();
+}
 
-    for ( int i = 0 ; i < Faces.Length() ; i++ ) {
-        delete Faces[i];
+uint32_t FBladeWorld::GetPostProcessOptions() const {
+    uint32_t Options = 0;
+    if ( world_weld.GetBool() ) {
+        Options |= PP_WeldVertices;
     }
-    Faces.Clear();
+    if ( world_optimize_mesh.GetBool() ) {
+        Options |= PP_OptimizeMesh;
+    }
+    return Options;
+}
+
+// Share identical vertices of neighbour faces. Vertices are merged only within a sector, so
+// sector geometry stays self-contained.
+void FBladeWorld::WeldMeshVertices() {
+    TPodArray< int > VertexSectors;
+    VertexSectors.Resize( MeshVertices.Length() );
 
-    for ( int i = 0 ; i < BSPNodes.Length() ; i++ ) {
-        delete BSPNodes[i];
+    for ( int i = 0 ; i < MeshOffsets.Length() ; i++ ) {
+        const FMeshOffset & MeshOffset = MeshOffsets[ i ];
+        const int SectorIndex = FaceSectors[ MeshFaces[ i ] ];
+
+        for ( int k = 0 ; k < MeshOffset.IndexCount ; k++ ) {
+            VertexSectors[ MeshOffset.BaseVertexLocation + MeshIndices[ MeshOffset.StartIndexLocation + k ] ] = SectorIndex;
+        }
     }
-    BSPNodes.Clear();
+
+    int NumVertices = MeshVertices.Length();
+
+    WeldVertices( MeshVertices, MeshIndices.ToPtr(), MeshIndices.Length(), VertexSectors.ToPtr() );
+
+    Out() << "Vertex welding:" << NumVertices << "->" << MeshVertices.Length() << "vertices";
 }
 
+// Reorder triangles of each draw range for vertex cache, then vertices for fetch locality.
+// Triangles never move between draw ranges, so mesh offsets stay valid.
+void FBladeWorld::OptimizeMesh() {
+    FVertexCacheStats Before = AnalyzeVertexCache( MeshIndices.ToPtr(), MeshIndices.Length(), MeshVertices.Length(), VERTEX_CACHE_STATS_SIZE );
 
-#if 0
-        FClipper Clipper;
-        PolygonD Hole;
+    GJobPool.ParallelFor( MeshOffsets.Length(), [this]( int _Index, int _WorkerIndex ) {
+        const FMeshOffset & MeshOffset = MeshOffsets[ _Index ];
 
-        Clipper.SetNormal( Plane.normal );
-        Clipper.AddContour3D( Winding.ToPtr(), Winding.Length(), true );
+        OptimizeVertexCache( MeshIndices.ToPtr() + MeshOffset.StartIndexLocation, MeshOffset.IndexCount );
+    } );
 
-        for ( int c = 0 ; c < NumHoles ; c++ ) {
-            ReadWinding( Hole );
+    // Vertex fetch order is global: welded vertices are shared by the draw ranges of a sector
+    OptimizeVertexFetch( MeshVertices, MeshIndices.ToPtr(), MeshIndices.Length() );
 
-            Clipper.AddContour3D( Hole.ToPtr(), Hole.Length(), false );
+    FVertexCacheStats After = AnalyzeVertexCache( MeshIndices.ToPtr(), MeshIndices.Length(), MeshVertices.Length(), VERTEX_CACHE_STATS_SIZE );
 
-            FPortal * Portal = CreatePortal();
+    Out() << "Mesh optimization: ACMR" << Before.ACMR << "->" << After.ACMR << ", ATVR" << Before.ATVR << "->" << After.ATVR;
+}
 
-            Portal->Face = _Face;
-            File->ReadSwapInt32( Portal->ToSector );
-            Portal->Winding = Hole;
+// Release data that is needed only to build the world mesh: BSP trees, double precision face
+// triangulations, file space vertices and portal planes. Generated face geometry lives in the worker
+// arenas and BSP data in the node and load arenas, so they are released at once.
+void FBladeWorld::CompactWorld() {
+    size_t ResidentBytes = GetResidentBytes();
 
-            Sectors[ _Face->SectorIndex ].Portals.Append( Portal );
+    // Sectors that are loaded lazily are still built from the vertices
+    if ( !SourceFile.IsOpened() ) {
+        Vertices.Free();
+    }
 
-            int32_t Count;
-            File->ReadSwapInt32( Count );
-            Portal->Planes.Resize( Count );
-            for ( int k = 0 ; k < Count ; k++ ) {
-                File->ReadSwapVector( Portal->Planes[k].normal );
-                File->ReadSwapDouble( Portal->Planes[k].d );
-            }
-        }
+    // Face windings are in the mesh now. Triangulated faces point to the worker arenas, the rest index
+    // the file vertices.
+    for ( int i = 0 ; i < Faces.Length() ; i++ ) {
+        FFace * Face = Faces[ i ];
 
-        TArray< FClipperPolygon > ResultPolygons;
-        Clipper.Execute( FClipper::CLIP_DIFF, ResultPolygons );
+        Face->Vertices = TArenaArray< Double3 >();
+        Face->Indices = TArenaArray< unsigned int >();
+        Face->Root = NULL;
+    }
 
-        //PrintPolygons( ResultPolygons );
+    for ( int i = 0 ; i < Portals.Length() ; i++ ) {
+        Portals[ i ]->Planes = TArenaArray< PlaneD >();
+    }
 
-        typedef TTriangulator< Double2, Double2 > FTriangulator;
-        FTriangulator Triangulator;
-        TPodArray< FTriangulator::FPolygon * > Polygons;
-        TArray< Double2 > ResultVertices;
-        TPodArray< unsigned int > ResultIndices;
-        for ( int i = 0 ; i < ResultPolygons.Length() ; i++ ) {
-            FTriangulator::FPolygon * Polygon = new FTriangulator::FPolygon;
+    BSPNodes.Clear();
 
-            Polygon->OuterContour = ResultPolygons[i].Outer.ToPtr();
-            Polygon->OuterContourEnd = ResultPolygons[i].Outer.ToPtr() + ResultPolygons[i].Outer.Length();
+    NodeArena.Free();
+    LoadArena.Free();
+    for ( int i = 0 ; i < FJobPool::MAX_WORKERS ; i++ ) {
+        WorkerArenas[ i ].Free();
+    }
 
-            Polygon->HoleContours.Resize( ResultPolygons[i].Holes.Length() );
-            Polygon->HoleContoursEnd.Resize( ResultPolygons[i].Holes.Length() );
-            for ( int j = 0 ; j < ResultPolygons[i].Holes.Length() ; j++ ) {
-                Polygon->HoleContours[j] = ResultPolygons[i].Holes[j].ToPtr();
-                Polygon->HoleContoursEnd[j] = ResultPolygons[i].Holes[j].ToPtr() + ResultPolygons[i].Holes[j].Length();
-            }
+    Out() << "Resident world:" << ResidentBytes << "->" << GetResidentBytes() << "bytes";
+}
 
-            Polygon->Normal.X = 0;
-            Polygon->Normal.Y = 0;
-            Polygon->Normal.Z = 1;
+size_t FBladeWorld::GetResidentBytes() const {
+    size_t Bytes = FaceArena.GetAllocatedBytes()
+                 + PortalArena.GetAllocatedBytes()
+                 + NodeArena.GetAllocatedBytes()
+                 + DataArena.GetAllocatedBytes()
+                 + LoadArena.GetAllocatedBytes();
 
-            Polygons.Append( Polygon );
-        }
-        Triangulator.TriangulatePolygons( Polygons, ResultVertices, ResultIndices );
+    for ( int i = 0 ; i < FJobPool::MAX_WORKERS ; i++ ) {
+        Bytes += WorkerArenas[ i ].GetAllocatedBytes();
+    }
 
-        // free polygons
-        for ( int i = 0 ; i < Polygons.Length() ; i++ ) {
-            FTriangulator::FPolygon * Polygon = Polygons[ i ];
-            delete Polygon;
-        }
+    Bytes += Atmospheres.Length() * sizeof( Atmospheres[ 0 ] );
+    Bytes += Vertices.Length() * sizeof( Double3 );
+    Bytes += Sectors.Length() * sizeof( FSector );
+    Bytes += MeshOffsets.Length() * sizeof( FMeshOffset );
+    Bytes += MeshVertices.Length() * sizeof( FMeshVertex );
+    Bytes += MeshIndices.Length() * sizeof( unsigned int );
+    Bytes += MeshFaces.Length() * sizeof( int );
+    Bytes += FacePlanes.Length() * sizeof( PlaneF );
+    Bytes += SectorPlanes.Length() * sizeof( PlaneF );
+    Bytes += SectorBounds.Length() * sizeof( BvAxisAlignedBox );
+    Bytes += ( SectorFirstLink.Length() + SectorLinks.Length() ) * sizeof( int );
+    Bytes += FaceSectors.Length() * sizeof( int );
+    Bytes += FaceTypes.Length() * sizeof( int );
+    Bytes += FaceFlags.Length() * sizeof( byte );
+    Bytes += Faces.Length() * sizeof( FFace * );
+    Bytes += Portals.Length() * sizeof( FPortal * );
+    Bytes += BSPNodes.Length() * sizeof( FBSPNode * );
+    Bytes += TextureNames.Length() * sizeof( const char * );
+
+    return Bytes;
+}
 
-        const Double3x3 & TransformMatrix = Clipper.GetTransform3D();
+void FBladeWorld::FreeWorld() {
+    FaceBuilds.Clear();
+    Atmospheres.Clear();
+    Vertices.Clear();
+    Sectors.Clear();
+    MeshOffsets.Clear();
+    MeshVertices.Clear();
+    MeshIndices.Clear();
+    MeshFaces.Clear();
+    MeshBatches.Clear();
 
-        _Face->Vertices.Resize( ResultVertices.Length() );
-        for ( int k = 0 ; k < ResultVertices.Length() ; k++ ) {
-            _Face->Vertices[k] = TransformMatrix * Double3( ResultVertices[k], Plane.Dist() );
-        }
-        _Face->Indices = ResultIndices;
+    Portals.Clear();
+    Faces.Clear();
+    TextureNames.Clear();
+    TextureIds.clear();
+    FacePlanes.Clear();
+    FaceSectors.Clear();
+    FaceTypes.Clear();
+    FaceFlags.Clear();
+    BSPNodes.Clear();
 
-#endif
+    // Release all loader objects at once
+    FaceArena.Free();
+    PortalArena.Free();
+    NodeArena.Free();
+    DataArena.Free();
+    LoadArena.Free();
+    for ( int i = 0 ; i < FJobPool::MAX_WORKERS ; i++ ) {
+        WorkerArenas[ i ].Free();
+    }
+
+    SectorOffsets.Clear();
+    SectorPlanes.Clear();
+    SectorBounds.Clear();
+    std::atomic_store( &Query, std::shared_ptr< const FWorldQuery >() );
+    SectorFirstLink.Clear();
+    SectorLinks.Clear();
+    SectorBuilder.reset();
+    SourceFile.Close();
+}
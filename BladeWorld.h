@@ -25,16 +25,33 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #pragma once
 
 #include "BladeMap.h"
+#include "MappedFile.h"
+#include "Arena.h"
+#include "JobPool.h"
+#include "WorldQuery.h"
 
 #include <Engine/Utilites/Public/Polygon.h>
 #include <Engine/Utilites/Public/PolygonClipper.h>
 #include <Engine/Renderer/Public/StaticMeshResource.h>
 
+#include <string>
+#include <unordered_map>
+#include <memory>
+
+struct FTexCoordBatch;
+
 // Blade .BW file loader
 
+// Increase when loader output changes to invalidate compiled world caches
+#define BLADE_WORLD_CACHE_VERSION 16
+
 extern const Double3 BLADE_COORD_SCALE_D;
 extern const Float3 BLADE_COORD_SCALE_F;
 
+// Convert from file space to world space. World data is scaled by BLADE_COORD_SCALE only here.
+Float3 ConvertPosition( const Double3 & _Position );
+PlaneF ConvertPlane( const PlaneD & _Plane );
+
 struct FBladeWorld {
     enum EFaceType {
         FT_SimpleFace = 0x00001B59,    // 7001 Face without holes/portals
@@ -45,15 +62,21 @@ struct FBladeWorld {
         FT_Subface    = 0xffffffff     // Used to mark subfaces
     };
 
+    enum EFaceFlags {
+        FF_CastShadows = 1
+    };
+
     enum ENodeType {
         NT_Node       = 0x00001F41,    // 8001
         NT_TexInfo    = 0x00001F42,    // 8002
         NT_Leaf       = 0x00001F43,    // 8003
     };
 
+    // Loader objects and their arrays are allocated from the world arenas
+
     struct FLeafIndices {
         uint32_t UnknownIndex;
-        TPodArray< uint32_t > Indices;
+        TArenaArray< unsigned int > Indices;
     };
 
     struct FBSPNode {
@@ -66,47 +89,42 @@ struct FBladeWorld {
 
         // Only for NT_TexInfo
         uint64_t UnknownSignature;
-        FString TextureName;
+        int TextureId;
         Double3 TexCoordAxis[ 2 ];
         float TexCoordOffset[ 2 ];
 
         // Only for leafs
-        TArray< FLeafIndices > Unknown;
+        TArenaArray< FLeafIndices > Unknown;
 
         // Leaf triangles
-        TPodArray< Double3 > Vertices;
-        TPodArray< unsigned int > Indices;
+        TArenaArray< Double3 > Vertices;
+        TArenaArray< unsigned int > Indices;
     };
 
+    // Cold face data. Hot data (plane, sector, type, flags) is in the face table.
     struct FFace {
-        int Type;
-        PlaneD Plane;
+        int Index;                  // Face table row
         uint64_t UnknownSignature;    // Только для фейсов с текстурой
-        FString TextureName;        // Только для фейсов с текстурой
+        int TextureId;              // Только для фейсов с текстурой
         Double3 TexCoordAxis[2];     // Только для фейсов с текстурой
         float TexCoordOffset[2];    // Только для фейсов с текстурой
-        bool CastShadows;
-
-        // result mesh
-        TPodArray< Double3 > Vertices;
-        TPodArray< unsigned int > Indices;
 
-        int SectorIndex;
+        // Winding or result mesh, released after loading. Use the world mesh or portal windings instead.
+        TArenaArray< Double3 > Vertices;
+        TArenaArray< unsigned int > Indices;
 
-        TArray< FFace * > SubFaces;
+        TArenaArray< FFace * > SubFaces;
 
-        FBSPNode * Root;
+        FBSPNode * Root;            // Released after loading
     };
 
     struct FPortal {
         FFace * Face;
         int32_t ToSector;
-        PolygonD Winding;
-
-        // Some planes. What they mean?
-        TPodArray< PlaneD > Planes;
+        TArenaArray< Float3 > Winding;    // World space
 
-        bool Marked;
+        // Some planes. What they mean? Released after loading
+        TArenaArray< PlaneD > Planes;
     };
 
     struct FSector {
@@ -116,54 +134,265 @@ struct FBladeWorld {
 
         Float3 LightDir;
 
-        TArray< FFace * > Faces;
+        // Sector faces in the face table
+        int FirstFace;
+        int NumFaces;
+
         TArray< FPortal * > Portals;
 
+        // Draw ranges of the sector, indexed by FF_CastShadows flag. Each group is a contiguous
+        // run of mesh offsets and batches, IndexRange covers all of them.
+        int FirstMeshOffset[ 2 ];
+        int NumMeshOffsets[ 2 ];
+        int FirstBatch[ 2 ];
+        int NumBatches[ 2 ];
+        FMeshOffset IndexRange[ 2 ];
+
         BvAxisAlignedBox Bounds;
         Float3 Centroid;
+
+        // Faces, portals and mesh data are materialized. Sectors of a world opened with OpenWorld
+        // have only their properties until LoadSector is called.
+        bool bLoaded;
     };
 
     TArray< FBladeMap::FAtmosphereEntry > Atmospheres;
-    TArray< Double3 > Vertices;
+    TArray< Double3 > Vertices;     // File space, released after loading unless sectors are loaded lazily
     TArray< FSector > Sectors;
     TArray< FMeshOffset > MeshOffsets;
     TArray< FMeshVertex > MeshVertices;
     TArray< unsigned int > MeshIndices;
-    TArray< FFace * > MeshFaces;
-    FMeshOffset ShadowCasterMeshOffset;
+    TPodArray< int > MeshFaces;     // Face table row for each mesh offset
 
-    TPodArray< FPortal * > Portals;
+    // Mesh offsets are sorted by shadow flag, sector and material. Batch is a run of mesh offsets
+    // with the same keys merged to one index range.
+    struct FMeshBatch {
+        int SectorIndex;
+        int Material;               // Texture id, 0 for sky
+        int Flags;                  // FF_CastShadows
+        int FirstMeshOffset;
+        int NumMeshOffsets;
+        FMeshOffset Range;
+    };
+    TArray< FMeshBatch > MeshBatches;
+
+    // Face table. Faces of each sector are stored contiguously, subfaces follow the faces
+    // of all sectors. Hot data are in separate arrays, cold data are in Faces. Face planes are in world space.
+    TPodArray< PlaneF > FacePlanes;
+    TPodArray< int > FaceSectors;
+    TPodArray< int > FaceTypes;
+    TPodArray< byte > FaceFlags;
     TPodArray< FFace * > Faces;
+
+    TPodArray< FPortal * > Portals;
     TPodArray< FBSPNode * > BSPNodes;
-    TPodArray< FBSPNode * > Leafs; // Temporary used on loading
+
+    // Texture names interned on loading. Faces and BSP nodes refer to them by id,
+    // id 0 means no texture.
+    TPodArray< const char * > TextureNames;
 
     BvAxisAlignedBox Bounds;
     bool HasSky;
 
+    FBladeWorld();
     ~FBladeWorld();
 
-    void LoadWorld( const char * _FileName );
+    // Returns false if the file can't be read
+    bool LoadWorld( const char * _FileName );
     void FreeWorld();
 
+    // Mesh of a single sector in its own vertex space. Mesh offsets are sorted by shadow flag and material.
+    struct FSectorMesh {
+        TArray< FMeshVertex > Vertices;
+        TArray< unsigned int > Indices;
+        TArray< FMeshOffset > MeshOffsets;
+        TPodArray< int > MeshFaces;     // Face table rows, empty for sectors streamed to the caller
+        TPodArray< int > Materials;     // Material key of each mesh offset
+        TPodArray< byte > Flags;        // Face flags of each mesh offset
+        BvAxisAlignedBox Bounds;
+        TPodArray< int > Neighbors;     // Sectors behind portals
+    };
+
+    // Lazy loading. OpenWorld reads world vertices and sector properties and finds sector records
+    // in the file with the sector index, LoadSector parses and triangulates one sector. The sector mesh
+    // is appended to the world mesh, or returned in _Mesh and owned by the caller.
+    // The .BW file stays mapped until FreeWorld. Sectors that are not loaded have no faces.
+    // With _Mesh the sector is built on the side and only the texture table of the world grows, so the
+    // sector can be loaded again after the caller released the mesh. It may run on one loader thread,
+    // meanwhile other threads may only use the query snapshot and read sector properties set by OpenWorld.
+    bool OpenWorld( const char * _FileName );
+    bool LoadSector( int _SectorIndex, FSectorMesh * _Mesh = NULL );
+
+    // Spatial queries of the loaded world. The snapshot is replaced atomically when the world or a sector
+    // is loaded and released by FreeWorld, returns NULL if there is no world. Worker threads keep the
+    // returned reference for the duration of their queries.
+    std::shared_ptr< const FWorldQuery > GetQuery() const;
+
+    // Triangles of a streamed sector for queries. The streaming code sets them when the sector mesh
+    // is loaded and removes them with NULL when the sector is evicted.
+    void SetSectorTriangles( int _SectorIndex, const FSectorMesh * _Mesh );
+
+    // Find sector that contains the point with the current query snapshot. Returns -1 if the point
+    // is outside of the world.
+    int LocateSector( const Float3 & _Position ) const;
+
+    // Texture sizes for texture coordinates. Set them before LoadWorld or OpenWorld, textures without
+    // size are 256x256. FreeWorld keeps the sizes.
+    void SetTextureSize( const char * _Name, int _Width, int _Height );
+
+    // Returns -1 if texture is not used by the world
+    int FindTexture( const char * _Name ) const;
+
+    // Material key of the face: texture id, 0 for sky
+    int GetFaceMaterial( int _FaceIndex ) const;
+
 private:
-    FFace * CreateFace();
+    // Raw face data recorded on parsing. Clipping and triangulation run later in BuildFaces
+    // Clipping runs in file space with double precision.
+    struct FFaceBuild {
+        FFace * Face;
+        PlaneD Plane;
+        PolygonD Winding;
+        TArray< PolygonD > Holes;
+        TPodArray< FBSPNode * > Leafs;
+    };
+
+    // Location of a sector record in the .BW file
+    struct FSectorOffset {
+        uint64_t Offset;
+        int32_t NumFaces;
+        int32_t FirstPlane;         // Sector bounding planes (face planes) in SectorPlanes
+    };
+
+    struct FTextureSize {
+        int Width;
+        int Height;
+    };
+
+    struct FWindingStackEntry {
+        FBSPNode * Node;
+        const FBSPNode * TexInfo;   // NULL - use texture info of the face
+        bool bTexInfoFrozen;
+        int FirstPoint;
+        int NumPoints;
+    };
+
+    // Clipping and triangulation buffers of a face build worker. Buffers keep their capacity
+    // from face to face.
+    struct FGeometryScratch {
+        typedef TTriangulator< Double2, Double2 > FTriangulator;
+
+        FTriangulator Triangulator;
+        TArray< FClipperPolygon > ResultPolygons;
+        TArray< FClipperContour > Holes;
+        TArray< FTriangulator::FPolygon > Polygons;
+        TPodArray< FTriangulator::FPolygon * > PolygonPtrs;
+        TArray< Double2 > ResultVertices;
+        TPodArray< unsigned int > ResultIndices;
+
+        // BSP winding split stack
+        TPodArray< FWindingStackEntry > WindingStack;
+        TPodArray< Double3 > Points;
+        TPodArray< Double3 > Front;
+        TPodArray< Double3 > Back;
+    };
+
+    FFace * CreateFace( int _Type, int _SectorIndex );
     FPortal * CreatePortal();
     FBSPNode * CreateBSPNode();
 
-    void LoadFace( FFace * _Face );
+    bool ReadWorldHeader();
+    int ReadSectorHeader( FSector & _Sector );
+    PlaneD ReadFacePlane( int _FaceIndex );
+    void LoadFace( int _SectorIndex );
     void LoadSimpleFace( FFace * _Face );
     void LoadPortalFace( FFace * _Face );
     void LoadFaceWithHole( FFace * _Face );
     void LoadFaceBSP( FFace * _Face );
     void LoadSkydomeFace( FFace * _Face );
-    void ReadIndices( TPodArray< unsigned int > & _Indices );
+    void ReadIndices( TArenaArray< unsigned int > & _Indices, FArena & _Arena );
     void ReadWinding( PolygonD & _Winding );
-    FBSPNode * ReadBSPNode_r( FFace * _Face );
-    void CreateWindings_r( FBladeWorld::FFace * _Face, const TArray< FClipperContour > & _Holes, PolygonD * _Winding, FBSPNode * _Node );
-    void FilterWinding_r( FBladeWorld::FFace * _Face, FBSPNode * _Node, FBSPNode * _Leaf );
+    int ReadPortalTarget();
+    void ReadPortalPlanes( TArenaArray< PlaneD > & _Planes );
+    void SetPortalWinding( FPortal * _Portal, const PolygonD & _Winding );
+    int ReadTextureId( FMemoryCursor & _Cursor );
+    int AddTexture( const char * _Name, int _Length );
+    FBSPNode * ReadBSPTree( FFace * _Face );
+    void ReadNodeTail( FBSPNode * _Node );
+    void CreateWindings( FBladeWorld::FFace * _Face, const PlaneD & _Plane, const TArray< FClipperContour > & _Holes, const PolygonD & _Winding, TPodArray< FBSPNode * > & _Leafs, FGeometryScratch & _Scratch, FArena & _Arena );
+    void TriangulateLeaf( const PlaneD & _Plane, const TArray< FClipperContour > & _Holes, const Double3 * _Winding, int _NumPoints, FBSPNode * _Leaf, FGeometryScratch & _Scratch, FArena & _Arena );
+    void ClipAndTriangulate( FClipper & _Clipper, const PlaneD & _Plane, FGeometryScratch & _Scratch, TArenaArray< Double3 > & _Vertices, TArenaArray< unsigned int > & _Indices, FArena & _Arena );
+    FFaceBuild & AddFaceBuild( FFace * _Face );
+    void BuildFaces();
+    void BuildFaceWithHole( FFaceBuild & _Build, FGeometryScratch & _Scratch, FArena & _Arena );
+    void BuildFaceBSP( FFaceBuild & _Build, FGeometryScratch & _Scratch, FArena & _Arena );
+    void CreateSubfaces( FFaceBuild & _Build );
+    void ClassifyFace( int _FaceIndex, int _SkyTextureId );
+    void SortMeshOrder( TPodArray< int > & _MeshOrder ) const;
+    bool EmitFaceMesh( int _FaceIndex, TArray< FMeshVertex > & _Vertices, TArray< unsigned int > & _Indices, FMeshOffset & _MeshOffset, FTexCoordBatch & _TexCoords );
+    void GetTextureSize( int _TextureId, int & _Width, int & _Height ) const;
+    uint64_t GetTextureSizesHash() const;
     void WorldGeometryPostProcess();
-
-    FFileAbstract * File;
+    void BuildSectorMesh( int _SectorIndex, FSectorMesh & _Mesh );
+    void AppendSectorMesh( int _SectorIndex, const FSectorMesh & _Mesh );
+    void WeldMeshVertices();
+    void OptimizeMesh();
+    void CompactWorld();
+    void BuildMeshBatches();
+    size_t GetResidentBytes() const;
+    uint32_t GetPostProcessOptions() const;
+    bool LoadCache( const char * _FileName, uint64_t _SourceHash, uint64_t _SourceSize, uint32_t _Options );
+    void SaveCache( const char * _FileName, uint64_t _SourceHash, uint64_t _SourceSize, uint32_t _Options );
+    bool GetSectorPlanes( int _SectorIndex, const PlaneF *& _Planes, int & _NumPlanes ) const;
+    bool IsInsideSector( int _SectorIndex, const Float3 & _Position ) const;
+    int LocateSectorLinear( const Float3 & _Position ) const;
+    void CalcSectorBounds();
+    void BuildSectorLinks();
+    void PublishQuery();
+    void PublishSectorTriangles( int _SectorIndex, const std::shared_ptr< const FWorldSectorTriangles > & _Triangles );
+    void BenchmarkLocateSector( const std::shared_ptr< const FWorldQuery > & _Query, int _NumPoints ) const;
+    bool ScanSectors();
+    bool ReadSectorFaces( int _SectorIndex, const FBladeWorld & _Source );
+    bool BuildStreamedSector( int _SectorIndex, FSectorMesh & _Mesh );
+    void CompactSector( int _SectorIndex );
+    void ResetSectorBuilder();
+
+    // File space vertices. The sector builder has none of its own and reads them from the world.
+    const TArray< Double3 > & GetFileVertices() const { return BuilderOwner ? BuilderOwner->Vertices : Vertices; }
+    bool LoadSectorIndex( const char * _FileName, uint64_t _SourceHash, uint64_t _SourceSize );
+    void SaveSectorIndex( const char * _FileName, uint64_t _SourceHash, uint64_t _SourceSize );
+
+    FMemoryCursor Cursor;
+    FMappedFile SourceFile;     // Opened by OpenWorld
+    TPodArray< FSectorOffset > SectorOffsets;
+    TPodArray< PlaneF > SectorPlanes;
+    TPodArray< BvAxisAlignedBox > SectorBounds;     // Bounds of sector windings, known before sectors are loaded
+    TPodArray< int > SectorFirstLink;       // Links of sector i are in [ SectorFirstLink[i], SectorFirstLink[i+1] )
+    TPodArray< int > SectorLinks;           // Sectors behind portals, known before sectors are loaded
+    TArray< FFaceBuild > FaceBuilds;
+
+    // Streamed sectors are parsed and triangulated in a world of their own, build data is released
+    // after each sector. Reads the file vertices of this world. Created by OpenWorld.
+    std::unique_ptr< FBladeWorld > SectorBuilder;
+    const FBladeWorld * BuilderOwner;       // World of the sector builder, NULL for other worlds
+    std::unordered_map< std::string, int > TextureIds;
+    std::unordered_map< std::string, FTextureSize > TextureSizes;
+
+    // World memory. Objects of one type are packed together, arrays and strings go to DataArena.
+    // Face build jobs allocate from the arena of their worker.
+    FArena FaceArena;
+    FArena PortalArena;
+    FArena NodeArena;
+    FArena DataArena;
+    FArena LoadArena;           // BSP leaf lists and portal planes, released after loading
+    FArena WorkerArenas[ FJobPool::MAX_WORKERS ];
+    FGeometryScratch WorkerScratch[ FJobPool::MAX_WORKERS ];
+
+    // Current query snapshot, accessed with std::atomic_load and std::atomic_store
+    std::shared_ptr< const FWorldQuery > Query;
+
+    FBladeWorld( const FBladeWorld & ) = delete;
+    FBladeWorld & operator=( const FBladeWorld & ) = delete;
+
+    friend class FWorldQuery;
 };
-
-extern FBladeWorld World;
@@ -0,0 +1,397 @@
+/*
+
+Blade Of Darkness Remake GPL Source Code
+
+Copyright (C) 2017 Alexander Samusev.
+
+This file is part of the Blade Of Darkness Remake GPL Source Code (BladeRemake Source Code).  
+
+BladeRemake is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+#include "BladeWorld.h"
+
+#include <map>
+
+// Compiled world cache: the result of LoadWorld stored next to the .BW file. The cache is
+// valid while the source file hash, the loader version and the post-process options match.
+// Only data that survives CompactWorld is stored. File vertices, the face windings that index
+// them and portal planes are released before the cache is written.
+
+static const uint32_t WORLD_CACHE_MAGIC = 0x43575742; // "BWWC"
+
+static void WriteFloat3( FMemoryWriter & _Writer, const Float3 & _Vector ) {
+    _Writer.WriteFloat( _Vector.X );
+    _Writer.WriteFloat( _Vector.Y );
+    _Writer.WriteFloat( _Vector.Z );
+}
+
+static void ReadFloat3( FMemoryCursor & _Cursor, Float3 & _Vector ) {
+    _Vector.X = _Cursor.ReadFloat();
+    _Vector.Y = _Cursor.ReadFloat();
+    _Vector.Z = _Cursor.ReadFloat();
+}
+
+static void WriteBounds( FMemoryWriter & _Writer, const BvAxisAlignedBox & _Bounds ) {
+    WriteFloat3( _Writer, _Bounds.Mins );
+    WriteFloat3( _Writer, _Bounds.Maxs );
+}
+
+static void ReadBounds( FMemoryCursor & _Cursor, BvAxisAlignedBox & _Bounds ) {
+    ReadFloat3( _Cursor, _Bounds.Mins );
+    ReadFloat3( _Cursor, _Bounds.Maxs );
+}
+
+// Read element count and check that the rest of the file can hold it
+static int ReadCount( FMemoryCursor & _Cursor, size_t _ElementSize ) {
+    int32_t Count = _Cursor.ReadInt32();
+    if ( !_Cursor.CanRead( Count, _ElementSize ) ) {
+        _Cursor.Skip( _Cursor.Remaining() + 1 );   // raise overflow
+        return 0;
+    }
+    return Count;
+}
+
+template< typename T >
+static void ReadIndex( FMemoryCursor & _Cursor, const TPodArray< T * > & _Array, T *& _Pointer ) {
+    int32_t Index = _Cursor.ReadInt32();
+    _Pointer = ( Index >= 0 && Index < _Array.Length() ) ? _Array[ Index ] : NULL;
+}
+
+// Draw range must lie in the index buffer and its indices must address the vertex buffer
+static bool IsValidMeshOffset( const FMeshOffset & _MeshOffset, const TArray< unsigned int > & _Indices, int _NumVertices ) {
+    if ( _MeshOffset.BaseVertexLocation < 0 || _MeshOffset.BaseVertexLocation > _NumVertices
+         || _MeshOffset.StartIndexLocation > ( unsigned int )_Indices.Length()
+         || _MeshOffset.IndexCount > ( unsigned int )_Indices.Length() - _MeshOffset.StartIndexLocation ) {
+        return false;
+    }
+    for ( unsigned int i = 0 ; i < _MeshOffset.IndexCount ; i++ ) {
+        if ( _Indices[ _MeshOffset.StartIndexLocation + i ] >= ( unsigned int )( _NumVertices - _MeshOffset.BaseVertexLocation ) ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FBladeWorld::LoadCache( const char * _FileName, uint64_t _SourceHash, uint64_t _SourceSize, uint32_t _Options ) {
+    FMappedFile Mapping;
+
+    if ( !Mapping.Open( _FileName ) ) {
+        return false;
+    }
+
+    FMemoryCursor & c = Cursor;
+
+    c = FMemoryCursor( Mapping.GetData(), Mapping.GetSize() );
+
+    if ( c.ReadUInt32() != WORLD_CACHE_MAGIC
+         || c.ReadUInt32() != BLADE_WORLD_CACHE_VERSION
+         || c.ReadUInt32() != sizeof( FMeshVertex )
+         || c.ReadUInt32() != _Options
+         || c.ReadUInt64() != _SourceHash
+         || c.ReadUInt64() != _SourceSize ) {
+        Cursor = FMemoryCursor();
+        return false;
+    }
+
+    // Create objects first so cross references can be resolved on reading
+    Faces.Resize( ReadCount( c, 4 ) );
+    for ( int i = 0 ; i < Faces.Length() ; i++ ) {
+        Faces[ i ] = FaceArena.New< FFace >();
+        Faces[ i ]->Index = i;
+    }
+    Portals.Resize( ReadCount( c, 4 ) );
+    for ( int i = 0 ; i < Portals.Length() ; i++ ) {
+        Portals[ i ] = PortalArena.New< FPortal >();
+    }
+
+    Atmospheres.Resize( ReadCount( c, 8 ) );
+    for ( int i = 0 ; i < Atmospheres.Length() ; i++ ) {
+        FBladeMap::FAtmosphereEntry & Atmo = Atmospheres[ i ];
+        c.ReadString( Atmo.Name );
+        c.Read( &Atmo.Color[ 0 ], 3 );
+        Atmo.Intensity = c.ReadFloat();
+    }
+
+    // Texture ids are restored in the same order
+    int NumTextures = ReadCount( c, 4 );
+    for ( int i = 0 ; i < NumTextures ; i++ ) {
+        int Length;
+        const char * Name = c.ReadStringView( Length );
+        AddTexture( Name ? Name : "", Name ? Length : 0 );
+    }
+
+    int NumFaces = Faces.Length();
+
+    FacePlanes.Resize( NumFaces );
+    FaceSectors.Resize( NumFaces );
+    FaceTypes.Resize( NumFaces );
+    FaceFlags.Resize( NumFaces );
+
+    c.ReadArray( FacePlanes.ToPtr(), NumFaces );
+    c.ReadArray( FaceSectors.ToPtr(), NumFaces );
+    c.ReadArray( FaceTypes.ToPtr(), NumFaces );
+    c.ReadArray( FaceFlags.ToPtr(), NumFaces );
+
+    for ( int i = 0 ; i < Faces.Length() ; i++ ) {
+        FFace * Face = Faces[ i ];
+
+        Face->UnknownSignature = c.ReadUInt64();
+        Face->TextureId = c.ReadInt32();
+        c.ReadVector( Face->TexCoordAxis[ 0 ] );
+        c.ReadVector( Face->TexCoordAxis[ 1 ] );
+        Face->TexCoordOffset[ 0 ] = c.ReadFloat();
+        Face->TexCoordOffset[ 1 ] = c.ReadFloat();
+
+        Face->SubFaces = DataArena.AllocArray< FFace * >( ReadCount( c, 4 ) );
+        for ( int k = 0 ; k < Face->SubFaces.Length() ; k++ ) {
+            ReadIndex( c, Faces, Face->SubFaces[ k ] );
+        }
+    }
+
+    for ( int i = 0 ; i < Portals.Length() ; i++ ) {
+        FPortal * Portal = Portals[ i ];
+
+        ReadIndex( c, Faces, Portal->Face );
+        Portal->ToSector = c.ReadInt32();
+
+        Portal->Winding = DataArena.AllocArray< Float3 >( ReadCount( c, sizeof( Float3 ) ) );
+        c.ReadArray( Portal->Winding.ToPtr(), Portal->Winding.Length() );
+    }
+
+    Sectors.Resize( ReadCount( c, 4 ) );
+    SectorBounds.Resize( Sectors.Length() );
+    for ( int i = 0 ; i < Sectors.Length() ; i++ ) {
+        FSector & Sector = Sectors[ i ];
+
+        c.Read( &Sector.AmbientColor[ 0 ], 3 );
+        Sector.AmbientIntensity = c.ReadFloat();
+        ReadFloat3( c, Sector.LightDir );
+
+        Sector.FirstFace = c.ReadInt32();
+        Sector.NumFaces = c.ReadInt32();
+
+        Sector.Portals.Resize( ReadCount( c, 4 ) );
+        for ( int k = 0 ; k < Sector.Portals.Length() ; k++ ) {
+            ReadIndex( c, Portals, Sector.Portals[ k ] );
+        }
+
+        ReadBounds( c, Sector.Bounds );
+        ReadFloat3( c, Sector.Centroid );
+        ReadBounds( c, SectorBounds[ i ] );
+
+        Sector.bLoaded = true;
+    }
+
+    // Vertex layout is checked in the header, so vertices are stored as is
+    MeshVertices.Resize( ReadCount( c, sizeof( FMeshVertex ) ) );
+    c.Read( MeshVertices.ToPtr(), MeshVertices.Length() * sizeof( FMeshVertex ) );
+
+    MeshIndices.Resize( ReadCount( c, sizeof( uint32_t ) ) );
+    c.ReadArray( MeshIndices.ToPtr(), MeshIndices.Length() );
+
+    MeshOffsets.Resize( ReadCount( c, 12 ) );
+    MeshFaces.Resize( MeshOffsets.Length() );
+    for ( int i = 0 ; i < MeshOffsets.Length() ; i++ ) {
+        FMeshOffset & MeshOffset = MeshOffsets[ i ];
+        MeshOffset.BaseVertexLocation = c.ReadInt32();
+        MeshOffset.StartIndexLocation = c.ReadUInt32();
+        MeshOffset.IndexCount = c.ReadUInt32();
+        MeshFaces[ i ] = c.ReadInt32();
+    }
+
+    ReadBounds( c, Bounds );
+    HasSky = c.ReadByte() != 0;
+
+    bool bValid = c.ReadUInt32() == WORLD_CACHE_MAGIC && !c.IsOverflow();
+
+    // Every reference must resolve, otherwise the cache is damaged
+    for ( int i = 0 ; i < MeshFaces.Length() && bValid ; i++ ) {
+        bValid = MeshFaces[ i ] >= 0 && MeshFaces[ i ] < NumFaces;
+    }
+    for ( int i = 0 ; i < NumFaces && bValid ; i++ ) {
+        bValid = FaceSectors[ i ] >= 0 && FaceSectors[ i ] < Sectors.Length()
+              && Faces[ i ]->TextureId >= 0 && Faces[ i ]->TextureId < TextureNames.Length();
+    }
+    for ( int i = 0 ; i < NumFaces && bValid ; i++ ) {
+        for ( int k = 0 ; k < Faces[ i ]->SubFaces.Length() && bValid ; k++ ) {
+            bValid = Faces[ i ]->SubFaces[ k ] != NULL;
+        }
+    }
+    for ( int i = 0 ; i < Portals.Length() && bValid ; i++ ) {
+        bValid = Portals[ i ]->Face != NULL && Portals[ i ]->ToSector >= 0 && Portals[ i ]->ToSector < Sectors.Length();
+    }
+    for ( int i = 0 ; i < Sectors.Length() && bValid ; i++ ) {
+        bValid = Sectors[ i ].FirstFace >= 0 && Sectors[ i ].NumFaces >= 0 && Sectors[ i ].FirstFace + Sectors[ i ].NumFaces <= NumFaces;
+        for ( int k = 0 ; k < Sectors[ i ].Portals.Length() && bValid ; k++ ) {
+            bValid = Sectors[ i ].Portals[ k ] != NULL;
+        }
+    }
+    for ( int i = 0 ; i < MeshIndices.Length() && bValid ; i++ ) {
+        bValid = MeshIndices[ i ] < ( unsigned int )MeshVertices.Length();
+    }
+    for ( int i = 0 ; i < MeshOffsets.Length() && bValid ; i++ ) {
+        bValid = IsValidMeshOffset( MeshOffsets[ i ], MeshIndices, MeshVertices.Length() );
+    }
+
+    Cursor = FMemoryCursor();
+
+    if ( !bValid ) {
+        Out() << "WARNING: Damaged world cache" << _FileName;
+        FreeWorld();
+        return false;
+    }
+
+    // Batches are derived from the sorted mesh offsets
+    BuildMeshBatches();
+
+    // Sector ranges are drawn as shadow casters
+    for ( int i = 0 ; i < Sectors.Length() ; i++ ) {
+        for ( int Group = 0 ; Group < 2 ; Group++ ) {
+            if ( !IsValidMeshOffset( Sectors[ i ].IndexRange[ Group ], MeshIndices, MeshVertices.Length() ) ) {
+                Out() << "WARNING: Damaged world cache" << _FileName;
+                FreeWorld();
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// Map object pointers back to indices
+template< typename T >
+static void BuildIndexMap( const TPodArray< T * > & _Array, std::map< const T *, int32_t > & _Map ) {
+    for ( int i = 0 ; i < _Array.Length() ; i++ ) {
+        _Map[ _Array[ i ] ] = i;
+    }
+}
+
+template< typename T >
+static void WriteIndex( FMemoryWriter & _Writer, const std::map< const T *, int32_t > & _Map, const T * _Pointer ) {
+    auto It = _Map.find( _Pointer );
+    _Writer.WriteInt32( It != _Map.end() ? It->second : -1 );
+}
+
+void FBladeWorld::SaveCache( const char * _FileName, uint64_t _SourceHash, uint64_t _SourceSize, uint32_t _Options ) {
+    FMemoryWriter w;
+
+    std::map< const FPortal *, int32_t > PortalIndices;
+
+    BuildIndexMap( Portals, PortalIndices );
+
+    w.Reserve( MeshVertices.Length() * sizeof( FMeshVertex ) + MeshIndices.Length() * 4 + Faces.Length() * 256 );
+
+    w.WriteUInt32( WORLD_CACHE_MAGIC );
+    w.WriteUInt32( BLADE_WORLD_CACHE_VERSION );
+    w.WriteUInt32( sizeof( FMeshVertex ) );
+    w.WriteUInt32( _Options );
+    w.WriteUInt64( _SourceHash );
+    w.WriteUInt64( _SourceSize );
+
+    w.WriteInt32( Faces.Length() );
+    w.WriteInt32( Portals.Length() );
+
+    w.WriteInt32( Atmospheres.Length() );
+    for ( int i = 0 ; i < Atmospheres.Length() ; i++ ) {
+        const FBladeMap::FAtmosphereEntry & Atmo = Atmospheres[ i ];
+        w.WriteString( Atmo.Name.Str() );
+        w.Write( &Atmo.Color[ 0 ], 3 );
+        w.WriteFloat( Atmo.Intensity );
+    }
+
+    w.WriteInt32( TextureNames.Length() );
+    for ( int i = 0 ; i < TextureNames.Length() ; i++ ) {
+        w.WriteString( TextureNames[ i ] );
+    }
+
+    w.WriteArray( FacePlanes.ToPtr(), Faces.Length() );
+    w.WriteArray( FaceSectors.ToPtr(), Faces.Length() );
+    w.WriteArray( FaceTypes.ToPtr(), Faces.Length() );
+    w.WriteArray( FaceFlags.ToPtr(), Faces.Length() );
+
+    for ( int i = 0 ; i < Faces.Length() ; i++ ) {
+        const FFace * Face = Faces[ i ];
+
+        w.WriteUInt64( Face->UnknownSignature );
+        w.WriteInt32( Face->TextureId );
+        w.WriteVector( Face->TexCoordAxis[ 0 ] );
+        w.WriteVector( Face->TexCoordAxis[ 1 ] );
+        w.WriteFloat( Face->TexCoordOffset[ 0 ] );
+        w.WriteFloat( Face->TexCoordOffset[ 1 ] );
+
+        w.WriteInt32( Face->SubFaces.Length() );
+        for ( int k = 0 ; k < Face->SubFaces.Length() ; k++ ) {
+            w.WriteInt32( Face->SubFaces[ k ]->Index );
+        }
+    }
+
+    for ( int i = 0 ; i < Portals.Length() ; i++ ) {
+        const FPortal * Portal = Portals[ i ];
+
+        w.WriteInt32( Portal->Face->Index );
+        w.WriteInt32( Portal->ToSector );
+
+        w.WriteInt32( Portal->Winding.Length() );
+        w.WriteArray( Portal->Winding.ToPtr(), Portal->Winding.Length() );
+    }
+
+    w.WriteInt32( Sectors.Length() );
+    for ( int i = 0 ; i < Sectors.Length() ; i++ ) {
+        const FSector & Sector = Sectors[ i ];
+
+        w.Write( &Sector.AmbientColor[ 0 ], 3 );
+        w.WriteFloat( Sector.AmbientIntensity );
+        WriteFloat3( w, Sector.LightDir );
+
+        w.WriteInt32( Sector.FirstFace );
+        w.WriteInt32( Sector.NumFaces );
+
+        w.WriteInt32( Sector.Portals.Length() );
+        for ( int k = 0 ; k < Sector.Portals.Length() ; k++ ) {
+            WriteIndex( w, PortalIndices, Sector.Portals[ k ] );
+        }
+
+        WriteBounds( w, Sector.Bounds );
+        WriteFloat3( w, Sector.Centroid );
+        WriteBounds( w, SectorBounds[ i ] );
+    }
+
+    w.WriteInt32( MeshVertices.Length() );
+    w.Write( MeshVertices.ToPtr(), MeshVertices.Length() * sizeof( FMeshVertex ) );
+
+    w.WriteInt32( MeshIndices.Length() );
+    w.WriteArray( MeshIndices.ToPtr(), MeshIndices.Length() );
+
+    w.WriteInt32( MeshOffsets.Length() );
+    for ( int i = 0 ; i < MeshOffsets.Length() ; i++ ) {
+        const FMeshOffset & MeshOffset = MeshOffsets[ i ];
+        w.WriteInt32( MeshOffset.BaseVertexLocation );
+        w.WriteUInt32( MeshOffset.StartIndexLocation );
+        w.WriteUInt32( MeshOffset.IndexCount );
+        w.WriteInt32( MeshFaces[ i ] );
+    }
+
+    WriteBounds( w, Bounds );
+    w.WriteByte( HasSky );
+
+    w.WriteUInt32( WORLD_CACHE_MAGIC );
+
+    if ( !w.SaveToFile( _FileName ) ) {
+        Out() << "WARNING: Couldn't write world cache" << _FileName;
+    }
+}
@@ -0,0 +1,636 @@
+/*
+
+Blade Of Darkness Remake GPL Source Code
+
+Copyright (C) 2017 Alexander Samusev.
+
+This file is part of the Blade Of Darkness Remake GPL Source Code (BladeRemake Source Code).  
+
+BladeRemake is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+#include "BladeWorld.h"
+
+// Lazy sector loading. Sector records of a .BW file have variable size, so their offsets are found
+// once by a scan that skips face data without building anything. The offsets are stored in a sector
+// index next to the .BW file and are valid while the source file hash matches. The index also keeps
+// face planes, bounds and portal links of all sectors, so points can be located and tracked in sectors
+// that are not loaded.
+
+static const uint32_t SECTOR_INDEX_MAGIC = 0x49535742; // "BWSI"
+
+static void SkipString( FMemoryCursor & _Cursor ) {
+    int32_t Length = _Cursor.ReadInt32();
+    if ( Length > 0 ) {
+        _Cursor.Skip( Length );
+    }
+}
+
+// Count-prefixed array
+static void SkipArray( FMemoryCursor & _Cursor, size_t _ElementSize ) {
+    int32_t Count = _Cursor.ReadInt32();
+    if ( !_Cursor.CanRead( Count, _ElementSize ) ) {
+        _Cursor.Skip( _Cursor.Remaining() + 1 );   // raise overflow
+        return;
+    }
+    _Cursor.Skip( Count * _ElementSize );
+}
+
+// Signature, texture name, texture axes and offsets, 8 zero bytes. Returns true for sky texture.
+static bool SkipTexInfo( FMemoryCursor & _Cursor ) {
+    _Cursor.Skip( 8 );
+
+    int Length;
+    const char * Name = _Cursor.ReadStringView( Length );
+    const bool bSky = Name && Length == 6 && !memcmp( Name, "blanca", 6 );
+
+    _Cursor.Skip( sizeof( Double3 ) * 2 + sizeof( float ) * 2 + 8 );
+    return bSky;
+}
+
+// Count-prefixed winding of vertex indices. Adds the vertices to the bounds.
+static void ReadWindingBounds( FMemoryCursor & _Cursor, const TArray< Double3 > & _Vertices, BvAxisAlignedBox & _Bounds ) {
+    int32_t Count = _Cursor.ReadInt32();
+    TFileView< int32_t > Indices = _Cursor.View< int32_t >( Count );
+    if ( Indices.Length() != Count ) {
+        _Cursor.Skip( _Cursor.Remaining() + 1 );   // raise overflow
+        return;
+    }
+    for ( int k = 0 ; k < Indices.Length() ; k++ ) {
+        const int32_t Index = Indices[ k ];
+        if ( Index >= 0 && Index < _Vertices.Length() ) {
+            _Bounds.AddPoint( ConvertPosition( _Vertices[ Index ] ) );
+        }
+    }
+}
+
+// Target sector of a portal. Links to missing sectors are dropped.
+static void AddSectorLink( int32_t _ToSector, int _NumSectors, TPodArray< int > & _Links ) {
+    if ( _ToSector >= 0 && _ToSector < _NumSectors ) {
+        _Links.Append( _ToSector );
+    }
+}
+
+// Hole winding, target sector and portal planes
+static void SkipPortal( FMemoryCursor & _Cursor, int _NumSectors, TPodArray< int > & _Links ) {
+    SkipArray( _Cursor, sizeof( int32_t ) );
+    AddSectorLink( _Cursor.ReadInt32(), _NumSectors, _Links );
+    SkipArray( _Cursor, sizeof( PlaneD ) );
+}
+
+// Same layout as FBladeWorld::ReadBSPTree
+static void SkipBSPTree( FMemoryCursor & _Cursor ) {
+    TPodArray< int > Stack; // Node types whose subtrees are not complete
+    TPodArray< int > NumChildrenRead;
+
+    for ( ;; ) {
+        int Type = _Cursor.ReadInt32();
+
+        if ( _Cursor.IsOverflow() ) {
+            return;
+        }
+
+        if ( Stack.Length() > 0 ) {
+            NumChildrenRead.Last()++;
+        }
+
+        if ( Type != FBladeWorld::NT_Leaf ) {
+            Stack.Append( Type );
+            NumChildrenRead.Append( 0 );
+            continue;
+        }
+
+        int Count = _Cursor.ReadInt32();
+        if ( !_Cursor.CanRead( Count, 8 ) ) {
+            Count = 0;
+        }
+        for ( int i = 0 ; i < Count ; i++ ) {
+            _Cursor.Skip( sizeof( int32_t ) );
+            SkipArray( _Cursor, sizeof( int32_t ) );
+        }
+
+        while ( Stack.Length() > 0 && NumChildrenRead.Last() == 2 ) {
+            _Cursor.Skip( sizeof( PlaneD ) );
+            if ( Stack.Last() == FBladeWorld::NT_TexInfo ) {
+                SkipTexInfo( _Cursor );
+            }
+
+            Stack.Resize( Stack.Length() - 1 );
+            NumChildrenRead.Resize( NumChildrenRead.Length() - 1 );
+        }
+
+        if ( Stack.Length() == 0 ) {
+            return;
+        }
+    }
+}
+
+// Same layout as FBladeWorld::LoadFace. Returns face plane in world space and true for sky faces
+// (see FBladeWorld::ClassifyFace). Face winding is added to the sector bounds, portal targets to the links.
+static bool SkipFace( FMemoryCursor & _Cursor, const TArray< Double3 > & _Vertices, int _NumSectors, PlaneF & _Plane, BvAxisAlignedBox & _Bounds, TPodArray< int > & _Links ) {
+    int Type = _Cursor.ReadInt32();
+    bool bSky = false;
+    PlaneD Plane;
+
+    _Cursor.ReadPlane( Plane );
+    _Plane = ConvertPlane( Plane );
+
+    switch ( Type ) {
+        case FBladeWorld::FT_SimpleFace:
+            bSky = SkipTexInfo( _Cursor );
+            ReadWindingBounds( _Cursor, _Vertices, _Bounds );
+            break;
+        case FBladeWorld::FT_Portal:
+            ReadWindingBounds( _Cursor, _Vertices, _Bounds );
+            AddSectorLink( _Cursor.ReadInt32(), _NumSectors, _Links );
+            SkipTexInfo( _Cursor );
+            break;
+        case FBladeWorld::FT_Face:
+            bSky = SkipTexInfo( _Cursor );
+            ReadWindingBounds( _Cursor, _Vertices, _Bounds );
+            SkipPortal( _Cursor, _NumSectors, _Links );
+            break;
+        case FBladeWorld::FT_FaceBSP: {
+            bSky = SkipTexInfo( _Cursor );
+            ReadWindingBounds( _Cursor, _Vertices, _Bounds );
+
+            int NumHoles = _Cursor.ReadInt32();
+            if ( NumHoles > 0 && _Cursor.CanRead( NumHoles, 8 ) ) {
+                for ( int c = 0 ; c < NumHoles ; c++ ) {
+                    SkipPortal( _Cursor, _NumSectors, _Links );
+                }
+            }
+
+            SkipBSPTree( _Cursor );
+            break;
+        }
+        case FBladeWorld::FT_Skydome:
+            ReadWindingBounds( _Cursor, _Vertices, _Bounds );
+            bSky = true;
+            break;
+        default:
+            assert(0);
+            break;
+    }
+
+    return bSky;
+}
+
+bool FBladeWorld::OpenWorld( const char * _FileName ) {
+    FreeWorld();
+
+    if ( !SourceFile.Open( _FileName ) ) {
+        return false;
+    }
+
+    // Texture id 0 is reserved for faces without texture
+    AddTexture( "", 0 );
+
+    Cursor = FMemoryCursor( SourceFile.GetData(), SourceFile.GetSize() );
+
+    if ( !ReadWorldHeader() ) {
+        Cursor = FMemoryCursor();
+        FreeWorld();
+        return false;
+    }
+
+    const size_t FirstSectorOffset = Cursor.Tell();
+
+    HasSky = false;
+
+    FString IndexName = _FileName;
+    IndexName.StripExt().Concat( ".wsectors" );
+
+    uint64_t SourceHash = BladeHash64( SourceFile.GetData(), SourceFile.GetSize() );
+
+    if ( LoadSectorIndex( IndexName.Str(), SourceHash, SourceFile.GetSize() ) ) {
+        // Read sector properties only
+        for ( int SectorIndex = 0 ; SectorIndex < Sectors.Length() ; SectorIndex++ ) {
+            Cursor.Seek( SectorOffsets[ SectorIndex ].Offset );
+
+            if ( ReadSectorHeader( Sectors[ SectorIndex ] ) != SectorOffsets[ SectorIndex ].NumFaces ) {
+                Out() << "WARNING: Sector index doesn't match the world" << IndexName;
+                SectorOffsets.Clear();
+                SectorPlanes.Clear();
+                SectorBounds.Clear();
+                SectorFirstLink.Clear();
+                SectorLinks.Clear();
+                break;
+            }
+        }
+    }
+
+    if ( SectorOffsets.Length() != Sectors.Length() ) {
+        Cursor.Seek( FirstSectorOffset );
+
+        HasSky = false;
+
+        if ( !ScanSectors() ) {
+            Cursor = FMemoryCursor();
+            FreeWorld();
+            return false;
+        }
+
+        SaveSectorIndex( IndexName.Str(), SourceHash, SourceFile.GetSize() );
+    }
+
+    Cursor = FMemoryCursor();
+
+    for ( int SectorIndex = 0 ; SectorIndex < Sectors.Length() ; SectorIndex++ ) {
+        FSector & Sector = Sectors[ SectorIndex ];
+
+        Sector.FirstFace = 0;
+        Sector.NumFaces = 0;
+        Sector.Portals.Clear();
+        Sector.Bounds.Clear();
+        Sector.Centroid = Float3( 0 );
+    }
+
+    // World bounds are known before sectors are loaded
+    Bounds.Clear();
+    for ( int i = 0 ; i < Vertices.Length() ; i++ ) {
+        Bounds.AddPoint( ConvertPosition( Vertices[ i ] ) );
+    }
+
+    // Clear sector draw ranges
+    BuildMeshBatches();
+
+    SectorBuilder.reset( new FBladeWorld );
+    SectorBuilder->BuilderOwner = this;
+    SectorBuilder->Sectors.Resize( Sectors.Length() );
+    SectorBuilder->TextureSizes = TextureSizes;
+    SectorBuilder->ResetSectorBuilder();
+
+    PublishQuery();
+
+    return true;
+}
+
+// Find sector records. Reads sector properties and skips face data.
+bool FBladeWorld::ScanSectors() {
+    SectorOffsets.Resize( Sectors.Length() );
+    SectorBounds.Resize( Sectors.Length() );
+    SectorPlanes.Clear();
+    SectorFirstLink.Resize( Sectors.Length() + 1 );
+    SectorLinks.Clear();
+
+    for ( int SectorIndex = 0 ; SectorIndex < Sectors.Length() ; SectorIndex++ ) {
+        FSectorOffset & SectorOffset = SectorOffsets[ SectorIndex ];
+
+        SectorOffset.Offset = Cursor.Tell();
+        SectorOffset.NumFaces = ReadSectorHeader( Sectors[ SectorIndex ] );
+        SectorOffset.FirstPlane = SectorPlanes.Length();
+        SectorFirstLink[ SectorIndex ] = SectorLinks.Length();
+
+        if ( SectorOffset.NumFaces < 4 || SectorOffset.NumFaces > 100 || Cursor.IsOverflow() ) {
+            Out() << "WARNING: FILE READ ERROR.. SOMETHING GO WRONG!";
+            Sectors.Resize( SectorIndex );
+            SectorOffsets.Resize( SectorIndex );
+            SectorBounds.Resize( SectorIndex );
+            SectorFirstLink.Resize( SectorIndex + 1 );
+            break;
+        }
+
+        SectorPlanes.Resize( SectorOffset.FirstPlane + SectorOffset.NumFaces );
+        SectorBounds[ SectorIndex ].Clear();
+
+        for ( int FaceIndex = 0 ; FaceIndex < SectorOffset.NumFaces ; FaceIndex++ ) {
+            if ( SkipFace( Cursor, Vertices, SectorFirstLink.Length() - 1, SectorPlanes[ SectorOffset.FirstPlane + FaceIndex ], SectorBounds[ SectorIndex ], SectorLinks ) ) {
+                HasSky = true;
+            }
+        }
+
+        if ( Cursor.IsOverflow() ) {
+            Out() << "WARNING: UNEXPECTED END OF FILE";
+            Sectors.Resize( SectorIndex + 1 );
+            SectorOffsets.Resize( SectorIndex + 1 );
+            SectorBounds.Resize( SectorIndex + 1 );
+            SectorFirstLink.Resize( SectorIndex + 2 );
+            break;
+        }
+    }
+
+    SectorFirstLink.Last() = SectorLinks.Length();
+
+    return Sectors.Length() > 0;
+}
+
+bool FBladeWorld::LoadSectorIndex( const char * _FileName, uint64_t _SourceHash, uint64_t _SourceSize ) {
+    FMappedFile Mapping;
+
+    if ( !Mapping.Open( _FileName ) ) {
+        return false;
+    }
+
+    FMemoryCursor c( Mapping.GetData(), Mapping.GetSize() );
+
+    if ( c.ReadUInt32() != SECTOR_INDEX_MAGIC
+         || c.ReadUInt32() != BLADE_WORLD_CACHE_VERSION
+         || c.ReadUInt64() != _SourceHash
+         || c.ReadUInt64() != _SourceSize ) {
+        return false;
+    }
+
+    int32_t Count = c.ReadInt32();
+    if ( Count != Sectors.Length() || !c.CanRead( Count, 12 ) ) {
+        return false;
+    }
+
+    SectorOffsets.Resize( Count );
+    int NumPlanes = 0;
+    for ( int i = 0 ; i < Count ; i++ ) {
+        SectorOffsets[ i ].Offset = c.ReadUInt64();
+        SectorOffsets[ i ].NumFaces = c.ReadInt32();
+        SectorOffsets[ i ].FirstPlane = NumPlanes;
+
+        if ( SectorOffsets[ i ].Offset >= _SourceSize || SectorOffsets[ i ].NumFaces < 0 ) {
+            SectorOffsets.Clear();
+            return false;
+        }
+
+        NumPlanes += SectorOffsets[ i ].NumFaces;
+    }
+
+    if ( c.ReadInt32() != NumPlanes || !c.CanRead( NumPlanes, sizeof( PlaneF ) ) ) {
+        SectorOffsets.Clear();
+        return false;
+    }
+
+    SectorPlanes.Resize( NumPlanes );
+    c.ReadArray( SectorPlanes.ToPtr(), NumPlanes );
+
+    SectorBounds.Resize( Count );
+    for ( int i = 0 ; i < Count ; i++ ) {
+        c.ReadArray( &SectorBounds[ i ].Mins, 1 );
+        c.ReadArray( &SectorBounds[ i ].Maxs, 1 );
+    }
+
+    SectorFirstLink.Resize( Count + 1 );
+    c.ReadArray( SectorFirstLink.ToPtr(), Count + 1 );
+
+    int32_t NumLinks = c.ReadInt32();
+    bool bValidLinks = NumLinks >= 0 && c.CanRead( NumLinks, sizeof( int32_t ) ) && SectorFirstLink[ 0 ] == 0 && SectorFirstLink[ Count ] == NumLinks;
+    for ( int i = 0 ; i < Count && bValidLinks ; i++ ) {
+        bValidLinks = SectorFirstLink[ i ] <= SectorFirstLink[ i + 1 ];
+    }
+    if ( bValidLinks ) {
+        SectorLinks.Resize( NumLinks );
+        c.ReadArray( SectorLinks.ToPtr(), NumLinks );
+        for ( int i = 0 ; i < NumLinks && bValidLinks ; i++ ) {
+            bValidLinks = SectorLinks[ i ] >= 0 && SectorLinks[ i ] < Count;
+        }
+    }
+
+    HasSky = c.ReadByte() != 0;
+
+    if ( !bValidLinks || c.ReadUInt32() != SECTOR_INDEX_MAGIC || c.IsOverflow() ) {
+        SectorOffsets.Clear();
+        SectorPlanes.Clear();
+        SectorBounds.Clear();
+        SectorFirstLink.Clear();
+        SectorLinks.Clear();
+        return false;
+    }
+
+    return true;
+}
+
+void FBladeWorld::SaveSectorIndex( const char * _FileName, uint64_t _SourceHash, uint64_t _SourceSize ) {
+    FMemoryWriter w;
+
+    w.WriteUInt32( SECTOR_INDEX_MAGIC );
+    w.WriteUInt32( BLADE_WORLD_CACHE_VERSION );
+    w.WriteUInt64( _SourceHash );
+    w.WriteUInt64( _SourceSize );
+
+    w.WriteInt32( SectorOffsets.Length() );
+    for ( int i = 0 ; i < SectorOffsets.Length() ; i++ ) {
+        w.WriteUInt64( SectorOffsets[ i ].Offset );
+        w.WriteInt32( SectorOffsets[ i ].NumFaces );
+    }
+
+    w.WriteInt32( SectorPlanes.Length() );
+    w.WriteArray( SectorPlanes.ToPtr(), SectorPlanes.Length() );
+
+    for ( int i = 0 ; i < SectorBounds.Length() ; i++ ) {
+        w.WriteArray( &SectorBounds[ i ].Mins, 1 );
+        w.WriteArray( &SectorBounds[ i ].Maxs, 1 );
+    }
+
+    w.WriteArray( SectorFirstLink.ToPtr(), SectorFirstLink.Length() );
+    w.WriteInt32( SectorLinks.Length() );
+    w.WriteArray( SectorLinks.ToPtr(), SectorLinks.Length() );
+
+    w.WriteByte( HasSky );
+
+    w.WriteUInt32( SECTOR_INDEX_MAGIC );
+
+    if ( !w.SaveToFile( _FileName ) ) {
+        Out() << "WARNING: Couldn't write sector index" << _FileName;
+    }
+}
+
+// Without _Mesh the sector becomes part of the world mesh and stays loaded. Streamed sectors are
+// built by the sector builder.
+bool FBladeWorld::LoadSector( int _SectorIndex, FSectorMesh * _Mesh ) {
+    if ( _SectorIndex < 0 || _SectorIndex >= Sectors.Length() ) {
+        return false;
+    }
+
+    if ( !SourceFile.IsOpened() || _SectorIndex >= SectorOffsets.Length() ) {
+        // World was not opened for lazy loading
+        return false;
+    }
+
+    if ( _Mesh ) {
+        return BuildStreamedSector( _SectorIndex, *_Mesh );
+    }
+
+    FSector & Sector = Sectors[ _SectorIndex ];
+
+    if ( Sector.bLoaded ) {
+        return true;
+    }
+
+    if ( !ReadSectorFaces( _SectorIndex, *this ) ) {
+        return false;
+    }
+
+    // Clip and triangulate faces of the sector
+    BuildFaces();
+
+    FSectorMesh Mesh;
+    BuildSectorMesh( _SectorIndex, Mesh );
+    AppendSectorMesh( _SectorIndex, Mesh );
+
+    CompactSector( _SectorIndex );
+
+    Sector.bLoaded = true;
+
+    PublishSectorTriangles( _SectorIndex, FWorldQuery::MakeSectorTriangles( *this, _SectorIndex ) );
+
+    return true;
+}
+
+// Parse the sector record of the _Source file to the face table. Sector faces are contiguous,
+// subfaces follow them after BuildFaces.
+bool FBladeWorld::ReadSectorFaces( int _SectorIndex, const FBladeWorld & _Source ) {
+    const FSectorOffset & SectorOffset = _Source.SectorOffsets[ _SectorIndex ];
+
+    Cursor = FMemoryCursor( _Source.SourceFile.GetData(), _Source.SourceFile.GetSize() );
+    Cursor.Seek( SectorOffset.Offset );
+
+    // Sector properties are already known from OpenWorld. Don't overwrite them, they can be read by other threads
+    FSector Header;
+    int32_t FaceCount = ReadSectorHeader( Header );
+
+    if ( FaceCount != SectorOffset.NumFaces || Cursor.IsOverflow() ) {
+        Out() << "WARNING: FILE READ ERROR.. SOMETHING GO WRONG!";
+        Cursor = FMemoryCursor();
+        return false;
+    }
+
+    FSector & Sector = Sectors[ _SectorIndex ];
+
+    const int FirstPortal = Portals.Length();
+
+    Sector.FirstFace = Faces.Length();
+    Sector.NumFaces = FaceCount;
+    Sector.Portals.Clear();
+
+    for ( int FaceIndex = 0 ; FaceIndex < FaceCount ; FaceIndex++ ) {
+        LoadFace( _SectorIndex );
+    }
+
+    if ( Cursor.IsOverflow() ) {
+        Out() << "WARNING: UNEXPECTED END OF FILE";
+
+        // Faces of a truncated sector are read from zeros, drop them. Their arena memory is released
+        // with the world.
+        Faces.Resize( Sector.FirstFace );
+        FacePlanes.Resize( Sector.FirstFace );
+        FaceSectors.Resize( Sector.FirstFace );
+        FaceTypes.Resize( Sector.FirstFace );
+        FaceFlags.Resize( Sector.FirstFace );
+        Portals.Resize( FirstPortal );
+        FaceBuilds.Clear();
+
+        Sector.NumFaces = 0;
+        Sector.Portals.Clear();
+
+        Cursor = FMemoryCursor();
+        return false;
+    }
+
+    Cursor = FMemoryCursor();
+
+    return true;
+}
+
+// The mesh is the only thing left of a streamed sector. Texture ids of the builder are mapped
+// to the texture table of this world.
+bool FBladeWorld::BuildStreamedSector( int _SectorIndex, FSectorMesh & _Mesh ) {
+    FBladeWorld & Builder = *SectorBuilder;
+
+    const bool bLoaded = Builder.ReadSectorFaces( _SectorIndex, *this );
+
+    if ( bLoaded ) {
+        Builder.BuildFaces();
+        Builder.BuildSectorMesh( _SectorIndex, _Mesh );
+
+        const FSector & Sector = Builder.Sectors[ _SectorIndex ];
+
+        _Mesh.Neighbors.Clear();
+        for ( int i = 0 ; i < Sector.Portals.Length() ; i++ ) {
+            _Mesh.Neighbors.Append( Sector.Portals[ i ]->ToSector );
+        }
+
+        for ( int i = 0 ; i < _Mesh.Materials.Length() ; i++ ) {
+            const char * Name = Builder.TextureNames[ _Mesh.Materials[ i ] ];
+            _Mesh.Materials[ i ] = AddTexture( Name, strlen( Name ) );
+        }
+
+        // Face table of the builder is released below
+        _Mesh.MeshFaces.Clear();
+    }
+
+    Builder.ResetSectorBuilder();
+
+    return bLoaded;
+}
+
+// Release build data of the faces of one sector, like CompactWorld does for the whole world
+void FBladeWorld::CompactSector( int _SectorIndex ) {
+    const FSector & Sector = Sectors[ _SectorIndex ];
+
+    for ( int i = Sector.FirstFace ; i < Sector.FirstFace + Sector.NumFaces ; i++ ) {
+        FFace * Face = Faces[ i ];
+
+        for ( int k = 0 ; k < Face->SubFaces.Length() ; k++ ) {
+            Face->SubFaces[ k ]->Vertices = TArenaArray< Double3 >();
+            Face->SubFaces[ k ]->Indices = TArenaArray< unsigned int >();
+        }
+
+        Face->Vertices = TArenaArray< Double3 >();
+        Face->Indices = TArenaArray< unsigned int >();
+        Face->Root = NULL;
+    }
+
+    for ( int i = 0 ; i < Sector.Portals.Length() ; i++ ) {
+        Sector.Portals[ i ]->Planes = TArenaArray< PlaneD >();
+    }
+
+    // Nodes and worker arenas hold only the sector that was just built
+    BSPNodes.Clear();
+
+    NodeArena.Free();
+    LoadArena.Free();
+    for ( int i = 0 ; i < FJobPool::MAX_WORKERS ; i++ ) {
+        WorkerArenas[ i ].Free();
+    }
+}
+
+// Release everything but the sector table and texture sizes. Texture table starts over.
+void FBladeWorld::ResetSectorBuilder() {
+    for ( int i = 0 ; i < Sectors.Length() ; i++ ) {
+        Sectors[ i ].FirstFace = 0;
+        Sectors[ i ].NumFaces = 0;
+        Sectors[ i ].Portals.Clear();
+    }
+
+    Faces.Clear();
+    FacePlanes.Clear();
+    FaceSectors.Clear();
+    FaceTypes.Clear();
+    FaceFlags.Clear();
+    Portals.Clear();
+    BSPNodes.Clear();
+    TextureNames.Clear();
+    TextureIds.clear();
+
+    FaceArena.Free();
+    PortalArena.Free();
+    NodeArena.Free();
+    DataArena.Free();
+    LoadArena.Free();
+    for ( int i = 0 ; i < FJobPool::MAX_WORKERS ; i++ ) {
+        WorkerArenas[ i ].Free();
+    }
+
+    // Texture id 0 is reserved for faces without texture
+    AddTexture( "", 0 );
+}
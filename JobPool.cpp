@@ -0,0 +1,156 @@
+/*
+
+Blade Of Darkness Remake GPL Source Code
+
+Copyright (C) 2017 Alexander Samusev.
+
+This file is part of the Blade Of Darkness Remake GPL Source Code (BladeRemake Source Code).
+
+BladeRemake is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+#include "JobPool.h"
+
+FJobPool GJobPool;
+
+// Index of the pool worker running on this thread, -1 outside of jobs
+static thread_local int CurrentWorker = -1;
+
+FJobPool::FJobPool()
+    : Job( NULL )
+    , NextIndex( 0 )
+    , Count( 0 )
+    , ActiveWorkers( 0 )
+    , Generation( 0 )
+    , bInitialized( false )
+    , bShutdown( false )
+{
+}
+
+FJobPool::~FJobPool() {
+    {
+        std::lock_guard< std::mutex > Lock( Mutex );
+        bShutdown = true;
+    }
+    WakeUp.notify_all();
+
+    for ( std::thread & Thread : Threads ) {
+        Thread.join();
+    }
+}
+
+void FJobPool::Initialize() {
+    std::lock_guard< std::mutex > Lock( InitMutex );
+
+    if ( bInitialized ) {
+        return;
+    }
+
+    int NumThreads = ( int )std::thread::hardware_concurrency() - 1;
+    if ( NumThreads < 0 ) {
+        NumThreads = 0;
+    }
+    if ( NumThreads > MAX_WORKERS - 1 ) {
+        NumThreads = MAX_WORKERS - 1;
+    }
+
+    Threads.reserve( NumThreads );
+    for ( int i = 0 ; i < NumThreads ; i++ ) {
+        Threads.emplace_back( &FJobPool::WorkerMain, this, i + 1 );
+    }
+
+    bInitialized = true;
+}
+
+int FJobPool::GetNumWorkers() {
+    Initialize();
+
+    return ( int )Threads.size() + 1;
+}
+
+void FJobPool::ParallelFor( int _Count, const FParallelJob & _Job ) {
+    if ( _Count <= 0 ) {
+        return;
+    }
+
+    Initialize();
+
+    // Workers run one batch at a time. A batch from another thread doesn't wait for the running one,
+    // which can be a whole level triangulation on the loader thread, it runs on the calling thread.
+    std::unique_lock< std::mutex > CallerLock( CallerMutex, std::defer_lock );
+
+    if ( Threads.empty() || _Count == 1 || CurrentWorker != -1 || !CallerLock.try_lock() ) {
+        int WorkerIndex = CurrentWorker != -1 ? CurrentWorker : 0;
+        for ( int i = 0 ; i < _Count ; i++ ) {
+            _Job( i, WorkerIndex );
+        }
+        return;
+    }
+
+    {
+        std::lock_guard< std::mutex > Lock( Mutex );
+        Job = &_Job;
+        Count = _Count;
+        NextIndex.store( 0 );
+        ActiveWorkers = ( int )Threads.size();
+        Generation++;
+    }
+    WakeUp.notify_all();
+
+    CurrentWorker = 0;
+    RunBatch( 0 );
+    CurrentWorker = -1;
+
+    std::unique_lock< std::mutex > Lock( Mutex );
+    Done.wait( Lock, [this]() { return ActiveWorkers == 0; } );
+    Job = NULL;
+}
+
+void FJobPool::RunBatch( int _WorkerIndex ) {
+    for ( ;; ) {
+        int Index = NextIndex.fetch_add( 1 );
+        if ( Index >= Count ) {
+            break;
+        }
+        ( *Job )( Index, _WorkerIndex );
+    }
+}
+
+void FJobPool::WorkerMain( int _WorkerIndex ) {
+    uint64_t LastGeneration = 0;
+
+    CurrentWorker = _WorkerIndex;
+
+    for ( ;; ) {
+        {
+            std::unique_lock< std::mutex > Lock( Mutex );
+            WakeUp.wait( Lock, [&]() { return bShutdown || Generation != LastGeneration; } );
+            if ( bShutdown ) {
+                return;
+            }
+            LastGeneration = Generation;
+        }
+
+        RunBatch( _WorkerIndex );
+
+        {
+            std::lock_guard< std::mutex > Lock( Mutex );
+            if ( --ActiveWorkers == 0 ) {
+                Done.notify_all();
+            }
+        }
+    }
+}
@@ -0,0 +1,75 @@
+/*
+
+Blade Of Darkness Remake GPL Source Code
+
+Copyright (C) 2017 Alexander Samusev.
+
+This file is part of the Blade Of Darkness Remake GPL Source Code (BladeRemake Source Code).
+
+BladeRemake is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <vector>
+#include <cstdint>
+
+// Persistent worker threads for loader jobs
+class FJobPool {
+public:
+    enum { MAX_WORKERS = 16 };
+
+    typedef std::function< void( int _Index, int _WorkerIndex ) > FParallelJob;
+
+    FJobPool();
+    ~FJobPool();
+
+    // Number of threads that can execute jobs at the same time, including the calling thread.
+    // Worker indices passed to jobs are in [0, GetNumWorkers())
+    int GetNumWorkers();
+
+    // Call _Job for every index in [0, _Count) and wait for completion. The calling thread takes part
+    // in the work. Jobs must write their results to preallocated per-index slots to stay deterministic.
+    // Calls from inside a job, and calls made while another thread's batch is running, run serially
+    // on the current thread.
+    void ParallelFor( int _Count, const FParallelJob & _Job );
+
+private:
+    void Initialize();
+    void WorkerMain( int _WorkerIndex );
+    void RunBatch( int _WorkerIndex );
+
+    std::vector< std::thread > Threads;
+    std::mutex InitMutex;
+    std::mutex CallerMutex;
+    std::mutex Mutex;
+    std::condition_variable WakeUp;
+    std::condition_variable Done;
+    const FParallelJob * Job;
+    std::atomic< int > NextIndex;
+    int Count;
+    int ActiveWorkers;
+    uint64_t Generation;
+    bool bInitialized;
+    bool bShutdown;
+};
+
+extern FJobPool GJobPool;
@@ -0,0 +1,251 @@
+/*
+
+Blade Of Darkness Remake GPL Source Code
+
+Copyright (C) 2017 Alexander Samusev.
+
+This file is part of the Blade Of Darkness Remake GPL Source Code (BladeRemake Source Code).
+
+BladeRemake is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+#include "MappedFile.h"
+
+#include <Engine/IO/Public/FileUrl.h>
+
+#include <cstdio>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+FMappedFile::FMappedFile()
+    : Data( NULL )
+    , Size( 0 )
+    , Buffer( NULL )
+    , bMapped( false )
+#ifdef _WIN32
+    , FileHandle( NULL )
+    , MappingHandle( NULL )
+#endif
+{
+}
+
+FMappedFile::~FMappedFile() {
+    Close();
+}
+
+bool FMappedFile::Open( const char * _FileName ) {
+    Close();
+
+    if ( MapNative( _FileName ) ) {
+        return true;
+    }
+
+    // Not a plain file on disk (e.g. packed resource): read it through the engine
+    FFileAbstract * File = FFiles::OpenFileFromUrl( _FileName, FFileAbstract::M_Read );
+    if ( !File ) {
+        return false;
+    }
+
+    long Length = File->Length();
+    if ( Length <= 0 ) {
+        FFiles::CloseFile( File );
+        return false;
+    }
+
+    Buffer = new byte[ Length ];
+    File->Read( Buffer, Length );
+    FFiles::CloseFile( File );
+
+    Data = Buffer;
+    Size = Length;
+
+    return true;
+}
+
+void FMappedFile::Close() {
+    if ( bMapped ) {
+#ifdef _WIN32
+        UnmapViewOfFile( Data );
+        CloseHandle( MappingHandle );
+        CloseHandle( FileHandle );
+        MappingHandle = NULL;
+        FileHandle = NULL;
+#else
+        munmap( const_cast< byte * >( Data ), Size );
+#endif
+        bMapped = false;
+    }
+
+    delete [] Buffer;
+    Buffer = NULL;
+
+    Data = NULL;
+    Size = 0;
+}
+
+bool FMappedFile::MapNative( const char * _FileName ) {
+#ifdef _WIN32
+    HANDLE hFile = CreateFileA( _FileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+    if ( hFile == INVALID_HANDLE_VALUE ) {
+        return false;
+    }
+
+    LARGE_INTEGER FileSize;
+    if ( !GetFileSizeEx( hFile, &FileSize ) || FileSize.QuadPart == 0 ) {
+        CloseHandle( hFile );
+        return false;
+    }
+
+    HANDLE hMapping = CreateFileMappingA( hFile, NULL, PAGE_READONLY, 0, 0, NULL );
+    if ( !hMapping ) {
+        CloseHandle( hFile );
+        return false;
+    }
+
+    void * View = MapViewOfFile( hMapping, FILE_MAP_READ, 0, 0, 0 );
+    if ( !View ) {
+        CloseHandle( hMapping );
+        CloseHandle( hFile );
+        return false;
+    }
+
+    FileHandle = hFile;
+    MappingHandle = hMapping;
+    Data = ( const byte * )View;
+    Size = ( size_t )FileSize.QuadPart;
+#else
+    int fd = open( _FileName, O_RDONLY );
+    if ( fd < 0 ) {
+        return false;
+    }
+
+    struct stat Stat;
+    if ( fstat( fd, &Stat ) != 0 || Stat.st_size == 0 ) {
+        close( fd );
+        return false;
+    }
+
+    void * View = mmap( NULL, Stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+
+    // Mapping stays valid after the descriptor is closed
+    close( fd );
+
+    if ( View == MAP_FAILED ) {
+        return false;
+    }
+
+    madvise( View, Stat.st_size, MADV_SEQUENTIAL );
+
+    Data = ( const byte * )View;
+    Size = ( size_t )Stat.st_size;
+#endif
+
+    bMapped = true;
+    return true;
+}
+
+void FMemoryCursor::Seek( size_t _Offset ) {
+    if ( _Offset > size_t( End - Begin ) ) {
+        Ptr = End;
+        bOverflow = true;
+        return;
+    }
+    Ptr = Begin + _Offset;
+}
+
+bool FMemoryCursor::Skip( size_t _BytesCount ) {
+    return Take( _BytesCount ) != NULL;
+}
+
+void FMemoryCursor::Read( void * _Dst, size_t _BytesCount ) {
+    const byte * p = Take( _BytesCount );
+    if ( p ) {
+        memcpy( _Dst, p, _BytesCount );
+    } else {
+        memset( _Dst, 0, _BytesCount );
+    }
+}
+
+const char * FMemoryCursor::ReadStringView( int & _Length ) {
+    int32_t Length = ReadInt32();
+    const byte * p = Length > 0 ? Take( Length ) : NULL;
+    if ( !p ) {
+        _Length = 0;
+        return NULL;
+    }
+    // Strip terminating zeros if they are stored
+    while ( Length > 0 && p[ Length - 1 ] == 0 ) {
+        Length--;
+    }
+    _Length = Length;
+    return ( const char * )p;
+}
+
+void FMemoryCursor::ReadString( FString & _String ) {
+    int Length;
+    const char * p = ReadStringView( Length );
+    if ( !p ) {
+        _String.Clear();
+        return;
+    }
+    _String.Resize( Length );
+    memcpy( _String.ToPtr(), p, Length );
+}
+
+void FMemoryWriter::WriteString( const char * _String ) {
+    int Length = strlen( _String );
+    WriteInt32( Length );
+    Write( _String, Length );
+}
+
+bool FMemoryWriter::SaveToFile( const char * _FileName ) const {
+    FString TempName = _FileName;
+    TempName.Concat( ".tmp" );
+
+    FILE * f = fopen( TempName.Str(), "wb" );
+    if ( !f ) {
+        return false;
+    }
+
+    size_t Size = Buffer.Length();
+    bool bWritten = fwrite( Buffer.ToPtr(), 1, Size, f ) == Size;
+    bWritten = ( fclose( f ) == 0 ) && bWritten;
+
+    if ( !bWritten ) {
+        remove( TempName.Str() );
+        return false;
+    }
+
+#ifdef _WIN32
+    // rename doesn't replace existing files on Windows
+    remove( _FileName );
+#endif
+
+    if ( rename( TempName.Str(), _FileName ) != 0 ) {
+        remove( TempName.Str() );
+        return false;
+    }
+
+    return true;
+}
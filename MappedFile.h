@@ -0,0 +1,366 @@
+/*
+
+Blade Of Darkness Remake GPL Source Code
+
+Copyright (C) 2017 Alexander Samusev.
+
+This file is part of the Blade Of Darkness Remake GPL Source Code (BladeRemake Source Code).
+
+BladeRemake is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+#pragma once
+
+#include <Engine/Core/Public/String.h>
+#include <Engine/Core/Public/Math.h>
+#include <Engine/Core/Public/Array.h>
+
+// Blade files are little-endian
+#if defined( __BYTE_ORDER__ ) && defined( __ORDER_BIG_ENDIAN__ ) && ( __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__ )
+#define BLADE_BIG_ENDIAN
+#endif
+
+// Read-only view of a whole file. Uses native memory mapping for files on disk,
+// falls back to reading the file into memory through FFiles otherwise.
+class FMappedFile {
+public:
+    FMappedFile();
+    ~FMappedFile();
+
+    bool Open( const char * _FileName );
+    void Close();
+
+    bool IsOpened() const { return Data != NULL; }
+
+    const byte * GetData() const { return Data; }
+    size_t GetSize() const { return Size; }
+
+private:
+    FMappedFile( const FMappedFile & ) = delete;
+    FMappedFile & operator=( const FMappedFile & ) = delete;
+
+    bool MapNative( const char * _FileName );
+
+    const byte * Data;
+    size_t Size;
+    byte * Buffer;      // Used when the file can't be mapped
+    bool bMapped;
+#ifdef _WIN32
+    void * FileHandle;
+    void * MappingHandle;
+#endif
+};
+
+// In-place view of little-endian scalars stored in a file. Elements are loaded with
+// memcpy so unaligned data is safe, and swapped only on big-endian hosts.
+template< typename T >
+struct TFileView {
+    const byte * Data;
+    int Count;
+
+    int Length() const { return Count; }
+
+    T operator[]( int _Index ) const;
+};
+
+// Bounds-checked reader over a memory block. Reading past the end never touches
+// memory outside the block: it zero-fills the output and raises the overflow flag.
+class FMemoryCursor {
+public:
+    FMemoryCursor() : Begin( NULL ), End( NULL ), Ptr( NULL ), bOverflow( false ) {}
+    FMemoryCursor( const byte * _Data, size_t _Size ) : Begin( _Data ), End( _Data + _Size ), Ptr( _Data ), bOverflow( false ) {}
+
+    size_t Tell() const { return Ptr - Begin; }
+    size_t Remaining() const { return End - Ptr; }
+    bool IsOverflow() const { return bOverflow; }
+
+    // Check that the block has enough data for _Count elements before allocating them
+    bool CanRead( int _Count, size_t _ElementSize ) const { return _Count >= 0 && size_t( _Count ) * _ElementSize <= size_t( End - Ptr ); }
+
+    void Seek( size_t _Offset );
+    bool Skip( size_t _BytesCount );
+
+    void Read( void * _Dst, size_t _BytesCount );
+
+    byte ReadByte();
+    int32_t ReadInt32();
+    uint32_t ReadUInt32();
+    uint64_t ReadUInt64();
+    float ReadFloat();
+    double ReadDouble();
+    void ReadVector( Double3 & _Vector );
+    void ReadPlane( PlaneD & _Plane );
+    void ReadString( FString & _String );
+
+    // Read string in place. Returns pointer to the string characters (not zero-terminated) or NULL
+    const char * ReadStringView( int & _Length );
+
+    // Bulk read of little-endian scalars: single memcpy on little-endian hosts
+    template< typename T >
+    void ReadArray( T * _Dst, int _Count );
+
+    void ReadArray( Double3 * _Dst, int _Count );
+    void ReadArray( PlaneD * _Dst, int _Count );
+    void ReadArray( Float3 * _Dst, int _Count );
+    void ReadArray( PlaneF * _Dst, int _Count );
+
+    // View array in place without copying. View is valid while the underlying memory is alive.
+    template< typename T >
+    TFileView< T > View( int _Count );
+
+private:
+    const byte * Take( size_t _BytesCount );
+
+    const byte * Begin;
+    const byte * End;
+    const byte * Ptr;
+    bool bOverflow;
+};
+
+// Growable little-endian output buffer, counterpart of FMemoryCursor
+class FMemoryWriter {
+public:
+    size_t Tell() const { return Buffer.Length(); }
+
+    void Reserve( size_t _BytesCount ) { Buffer.Reserve( ( int )_BytesCount ); }
+
+    void Write( const void * _Src, size_t _BytesCount );
+
+    void WriteByte( byte _Value ) { Write( &_Value, 1 ); }
+    void WriteInt32( int32_t _Value );
+    void WriteUInt32( uint32_t _Value );
+    void WriteUInt64( uint64_t _Value );
+    void WriteFloat( float _Value );
+    void WriteDouble( double _Value );
+    void WriteVector( const Double3 & _Vector ) { WriteArray( &_Vector, 1 ); }
+    void WritePlane( const PlaneD & _Plane ) { WriteArray( &_Plane, 1 ); }
+    void WriteString( const char * _String );
+
+    template< typename T >
+    void WriteArray( const T * _Src, int _Count );
+
+    void WriteArray( const Double3 * _Src, int _Count ) { WriteArray( &_Src->X.Value, _Count * 3 ); }
+    void WriteArray( const PlaneD * _Src, int _Count ) { WriteArray( &_Src->Normal.X.Value, _Count * 4 ); }
+    void WriteArray( const Float3 * _Src, int _Count ) { WriteArray( &_Src->X.Value, _Count * 3 ); }
+    void WriteArray( const PlaneF * _Src, int _Count ) { WriteArray( &_Src->Normal.X.Value, _Count * 4 ); }
+
+    const byte * GetData() const { return Buffer.ToPtr(); }
+
+    // Write buffer to a temporary file and move it over _FileName, so readers never see a partial file
+    bool SaveToFile( const char * _FileName ) const;
+
+private:
+    byte * Grow( size_t _BytesCount );
+
+    TPodArray< byte > Buffer;
+};
+
+static_assert( sizeof( Double3 ) == sizeof( double ) * 3, "Double3 must be tightly packed" );
+static_assert( sizeof( PlaneD ) == sizeof( double ) * 4, "PlaneD must be stored as normal + distance" );
+static_assert( sizeof( Float3 ) == sizeof( float ) * 3, "Float3 must be tightly packed" );
+static_assert( sizeof( PlaneF ) == sizeof( float ) * 4, "PlaneF must be stored as normal + distance" );
+
+AN_FORCEINLINE uint16_t BladeSwap( uint16_t _Value ) {
+    return ( _Value >> 8 ) | ( _Value << 8 );
+}
+
+AN_FORCEINLINE uint32_t BladeSwap( uint32_t _Value ) {
+    return ( _Value >> 24 ) | ( ( _Value >> 8 ) & 0xff00 ) | ( ( _Value << 8 ) & 0xff0000 ) | ( _Value << 24 );
+}
+
+AN_FORCEINLINE uint64_t BladeSwap( uint64_t _Value ) {
+    return ( uint64_t( BladeSwap( uint32_t( _Value ) ) ) << 32 ) | BladeSwap( uint32_t( _Value >> 32 ) );
+}
+
+// Convert little-endian scalar to host byte order
+template< typename T >
+AN_FORCEINLINE T BladeLittleToHost( const byte * _Src ) {
+    T Value;
+    memcpy( &Value, _Src, sizeof( T ) );
+#ifdef BLADE_BIG_ENDIAN
+    switch ( sizeof( T ) ) {
+    case 2: { uint16_t u; memcpy( &u, &Value, 2 ); u = BladeSwap( u ); memcpy( &Value, &u, 2 ); break; }
+    case 4: { uint32_t u; memcpy( &u, &Value, 4 ); u = BladeSwap( u ); memcpy( &Value, &u, 4 ); break; }
+    case 8: { uint64_t u; memcpy( &u, &Value, 8 ); u = BladeSwap( u ); memcpy( &Value, &u, 8 ); break; }
+    default: break;
+    }
+#endif
+    return Value;
+}
+
+template< typename T >
+AN_FORCEINLINE T TFileView< T >::operator[]( int _Index ) const {
+    assert( _Index >= 0 && _Index < Count );
+    return BladeLittleToHost< T >( Data + _Index * sizeof( T ) );
+}
+
+AN_FORCEINLINE const byte * FMemoryCursor::Take( size_t _BytesCount ) {
+    if ( _BytesCount > size_t( End - Ptr ) ) {
+        Ptr = End;
+        bOverflow = true;
+        return NULL;
+    }
+    const byte * p = Ptr;
+    Ptr += _BytesCount;
+    return p;
+}
+
+AN_FORCEINLINE byte FMemoryCursor::ReadByte() {
+    const byte * p = Take( 1 );
+    return p ? *p : 0;
+}
+
+AN_FORCEINLINE int32_t FMemoryCursor::ReadInt32() {
+    const byte * p = Take( 4 );
+    return p ? BladeLittleToHost< int32_t >( p ) : 0;
+}
+
+AN_FORCEINLINE uint32_t FMemoryCursor::ReadUInt32() {
+    const byte * p = Take( 4 );
+    return p ? BladeLittleToHost< uint32_t >( p ) : 0;
+}
+
+AN_FORCEINLINE uint64_t FMemoryCursor::ReadUInt64() {
+    const byte * p = Take( 8 );
+    return p ? BladeLittleToHost< uint64_t >( p ) : 0;
+}
+
+AN_FORCEINLINE float FMemoryCursor::ReadFloat() {
+    const byte * p = Take( 4 );
+    return p ? BladeLittleToHost< float >( p ) : 0.0f;
+}
+
+AN_FORCEINLINE double FMemoryCursor::ReadDouble() {
+    const byte * p = Take( 8 );
+    return p ? BladeLittleToHost< double >( p ) : 0.0;
+}
+
+AN_FORCEINLINE void FMemoryCursor::ReadVector( Double3 & _Vector ) {
+    ReadArray( &_Vector, 1 );
+}
+
+AN_FORCEINLINE void FMemoryCursor::ReadPlane( PlaneD & _Plane ) {
+    ReadArray( &_Plane, 1 );
+}
+
+template< typename T >
+void FMemoryCursor::ReadArray( T * _Dst, int _Count ) {
+    if ( _Count <= 0 ) {
+        return;
+    }
+    const byte * p = Take( _Count * sizeof( T ) );
+    if ( !p ) {
+        memset( _Dst, 0, _Count * sizeof( T ) );
+        return;
+    }
+#ifdef BLADE_BIG_ENDIAN
+    for ( int i = 0 ; i < _Count ; i++ ) {
+        _Dst[ i ] = BladeLittleToHost< T >( p + i * sizeof( T ) );
+    }
+#else
+    memcpy( _Dst, p, _Count * sizeof( T ) );
+#endif
+}
+
+AN_FORCEINLINE void FMemoryCursor::ReadArray( Double3 * _Dst, int _Count ) {
+    ReadArray( &_Dst->X.Value, _Count * 3 );
+}
+
+AN_FORCEINLINE void FMemoryCursor::ReadArray( PlaneD * _Dst, int _Count ) {
+    ReadArray( &_Dst->Normal.X.Value, _Count * 4 );
+}
+
+AN_FORCEINLINE void FMemoryCursor::ReadArray( Float3 * _Dst, int _Count ) {
+    ReadArray( &_Dst->X.Value, _Count * 3 );
+}
+
+AN_FORCEINLINE void FMemoryCursor::ReadArray( PlaneF * _Dst, int _Count ) {
+    ReadArray( &_Dst->Normal.X.Value, _Count * 4 );
+}
+
+template< typename T >
+TFileView< T > FMemoryCursor::View( int _Count ) {
+    TFileView< T > View;
+    View.Data = _Count > 0 ? Take( _Count * sizeof( T ) ) : NULL;
+    View.Count = View.Data ? _Count : 0;
+    return View;
+}
+
+// 64-bit FNV-1a hash of a memory block
+AN_FORCEINLINE uint64_t BladeHash64( const byte * _Data, size_t _Size ) {
+    uint64_t Hash = 0xcbf29ce484222325ULL;
+    for ( size_t i = 0 ; i < _Size ; i++ ) {
+        Hash ^= _Data[ i ];
+        Hash *= 0x100000001b3ULL;
+    }
+    return Hash;
+}
+
+// Convert host scalar to little-endian order
+template< typename T >
+AN_FORCEINLINE void BladeHostToLittle( byte * _Dst, T _Value ) {
+#ifdef BLADE_BIG_ENDIAN
+    _Value = BladeLittleToHost< T >( ( const byte * )&_Value );
+#endif
+    memcpy( _Dst, &_Value, sizeof( T ) );
+}
+
+AN_FORCEINLINE byte * FMemoryWriter::Grow( size_t _BytesCount ) {
+    int Offset = Buffer.Length();
+    Buffer.Resize( Offset + ( int )_BytesCount );
+    return Buffer.ToPtr() + Offset;
+}
+
+AN_FORCEINLINE void FMemoryWriter::Write( const void * _Src, size_t _BytesCount ) {
+    if ( _BytesCount > 0 ) {
+        memcpy( Grow( _BytesCount ), _Src, _BytesCount );
+    }
+}
+
+AN_FORCEINLINE void FMemoryWriter::WriteInt32( int32_t _Value ) {
+    BladeHostToLittle( Grow( 4 ), _Value );
+}
+
+AN_FORCEINLINE void FMemoryWriter::WriteUInt32( uint32_t _Value ) {
+    BladeHostToLittle( Grow( 4 ), _Value );
+}
+
+AN_FORCEINLINE void FMemoryWriter::WriteUInt64( uint64_t _Value ) {
+    BladeHostToLittle( Grow( 8 ), _Value );
+}
+
+AN_FORCEINLINE void FMemoryWriter::WriteFloat( float _Value ) {
+    BladeHostToLittle( Grow( 4 ), _Value );
+}
+
+AN_FORCEINLINE void FMemoryWriter::WriteDouble( double _Value ) {
+    BladeHostToLittle( Grow( 8 ), _Value );
+}
+
+template< typename T >
+void FMemoryWriter::WriteArray( const T * _Src, int _Count ) {
+    if ( _Count <= 0 ) {
+        return;
+    }
+    byte * p = Grow( _Count * sizeof( T ) );
+#ifdef BLADE_BIG_ENDIAN
+    for ( int i = 0 ; i < _Count ; i++ ) {
+        BladeHostToLittle( p + i * sizeof( T ), _Src[ i ] );
+    }
+#else
+    memcpy( p, _Src, _Count * sizeof( T ) );
+#endif
+}
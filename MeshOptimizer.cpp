@@ -0,0 +1,362 @@
+/*
+
+Blade Of Darkness Remake GPL Source Code
+
+Copyright (C) 2017 Alexander Samusev.
+
+This file is part of the Blade Of Darkness Remake GPL Source Code (BladeRemake Source Code).
+
+BladeRemake is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+#include "MeshOptimizer.h"
+#include "MappedFile.h"
+
+#include <cmath>
+
+int WeldVertices( TArray< FMeshVertex > & _Vertices, unsigned int * _Indices, int _NumIndices, const int * _VertexGroups ) {
+    const int NumVertices = _Vertices.Length();
+
+    if ( NumVertices == 0 ) {
+        return 0;
+    }
+
+    int HashSize = 1;
+    while ( HashSize < NumVertices * 2 ) {
+        HashSize <<= 1;
+    }
+
+    TPodArray< int > Buckets;
+    TPodArray< int > Next;
+    TPodArray< unsigned int > Remap;
+    TPodArray< int > WeldedGroups;
+    TArray< FMeshVertex > Welded;
+
+    Buckets.Resize( HashSize );
+    for ( int i = 0 ; i < HashSize ; i++ ) {
+        Buckets[ i ] = -1;
+    }
+    Next.Resize( NumVertices );
+    Remap.Resize( NumVertices );
+    for ( int i = 0 ; i < NumVertices ; i++ ) {
+        Remap[ i ] = ~0u;
+    }
+    Welded.Reserve( NumVertices );
+    WeldedGroups.Reserve( NumVertices );
+
+    for ( int i = 0 ; i < _NumIndices ; i++ ) {
+        unsigned int Index = _Indices[ i ];
+
+        assert( Index < ( unsigned int )NumVertices );
+
+        if ( Remap[ Index ] == ~0u ) {
+            const FMeshVertex & Vertex = _Vertices[ Index ];
+            const int Group = _VertexGroups ? _VertexGroups[ Index ] : 0;
+
+            uint64_t Hash = BladeHash64( ( const byte * )&Vertex, sizeof( Vertex ) ) ^ ( uint64_t( Group ) * 0x9e3779b97f4a7c15ULL );
+            int Bucket = int( Hash & ( HashSize - 1 ) );
+
+            int Found = -1;
+            for ( int w = Buckets[ Bucket ] ; w != -1 ; w = Next[ w ] ) {
+                if ( WeldedGroups[ w ] == Group && !memcmp( &Welded[ w ], &Vertex, sizeof( Vertex ) ) ) {
+                    Found = w;
+                    break;
+                }
+            }
+
+            if ( Found == -1 ) {
+                Found = Welded.Length();
+                Welded.Append( Vertex );
+                WeldedGroups.Append( Group );
+                Next[ Found ] = Buckets[ Bucket ];
+                Buckets[ Bucket ] = Found;
+            }
+
+            Remap[ Index ] = Found;
+        }
+
+        _Indices[ i ] = Remap[ Index ];
+    }
+
+    _Vertices = Welded;
+
+    return _Vertices.Length();
+}
+
+namespace {
+
+enum { FORSYTH_CACHE_SIZE = 32 };
+
+const float FORSYTH_CACHE_DECAY_POWER = 1.5f;
+const float FORSYTH_LAST_TRI_SCORE = 0.75f;
+const float FORSYTH_VALENCE_BOOST_SCALE = 2.0f;
+const float FORSYTH_VALENCE_BOOST_POWER = 0.5f;
+
+float ForsythVertexScore( int _CachePosition, int _RemainingTriangles ) {
+    if ( _RemainingTriangles == 0 ) {
+        return -1.0f;
+    }
+
+    float Score = 0.0f;
+
+    if ( _CachePosition >= 0 ) {
+        if ( _CachePosition < 3 ) {
+            // Vertices of the last triangle get fixed score to avoid reusing them immediately
+            Score = FORSYTH_LAST_TRI_SCORE;
+        } else {
+            const float Scaler = 1.0f / ( FORSYTH_CACHE_SIZE - 3 );
+            Score = powf( 1.0f - ( _CachePosition - 3 ) * Scaler, FORSYTH_CACHE_DECAY_POWER );
+        }
+    }
+
+    // Boost vertices with few triangles left to finish them off
+    Score += FORSYTH_VALENCE_BOOST_SCALE * powf( ( float )_RemainingTriangles, -FORSYTH_VALENCE_BOOST_POWER );
+
+    return Score;
+}
+
+}
+
+void OptimizeVertexCache( unsigned int * _Indices, int _NumIndices ) {
+    const int NumTriangles = _NumIndices / 3;
+
+    if ( NumTriangles < 2 ) {
+        return;
+    }
+
+    // Work in local vertex space of the index range
+    unsigned int MinIndex = _Indices[ 0 ];
+    unsigned int MaxIndex = _Indices[ 0 ];
+    for ( int i = 1 ; i < NumTriangles * 3 ; i++ ) {
+        MinIndex = FMath::Min( MinIndex, _Indices[ i ] );
+        MaxIndex = FMath::Max( MaxIndex, _Indices[ i ] );
+    }
+    const int NumVertices = int( MaxIndex - MinIndex ) + 1;
+
+    TPodArray< int > TriangleCounts;
+    TPodArray< int > TriangleOffsets;
+    TPodArray< int > VertexTriangles;
+    TPodArray< int > CachePositions;
+    TPodArray< float > VertexScores;
+    TPodArray< float > TriangleScores;
+    TPodArray< byte > Emitted;
+    TPodArray< unsigned int > Optimized;
+
+    TriangleCounts.Resize( NumVertices );
+    TriangleOffsets.Resize( NumVertices );
+    CachePositions.Resize( NumVertices );
+    VertexScores.Resize( NumVertices );
+    for ( int v = 0 ; v < NumVertices ; v++ ) {
+        TriangleCounts[ v ] = 0;
+        CachePositions[ v ] = -1;
+    }
+
+    for ( int i = 0 ; i < NumTriangles * 3 ; i++ ) {
+        TriangleCounts[ _Indices[ i ] - MinIndex ]++;
+    }
+
+    int Offset = 0;
+    for ( int v = 0 ; v < NumVertices ; v++ ) {
+        TriangleOffsets[ v ] = Offset;
+        Offset += TriangleCounts[ v ];
+        TriangleCounts[ v ] = 0;
+    }
+
+    // Vertex -> triangle adjacency
+    VertexTriangles.Resize( NumTriangles * 3 );
+    for ( int t = 0 ; t < NumTriangles ; t++ ) {
+        for ( int k = 0 ; k < 3 ; k++ ) {
+            int v = _Indices[ t * 3 + k ] - MinIndex;
+            VertexTriangles[ TriangleOffsets[ v ] + TriangleCounts[ v ]++ ] = t;
+        }
+    }
+
+    for ( int v = 0 ; v < NumVertices ; v++ ) {
+        VertexScores[ v ] = ForsythVertexScore( -1, TriangleCounts[ v ] );
+    }
+
+    TriangleScores.Resize( NumTriangles );
+    Emitted.Resize( NumTriangles );
+    for ( int t = 0 ; t < NumTriangles ; t++ ) {
+        TriangleScores[ t ] = VertexScores[ _Indices[ t * 3 ] - MinIndex ]
+                            + VertexScores[ _Indices[ t * 3 + 1 ] - MinIndex ]
+                            + VertexScores[ _Indices[ t * 3 + 2 ] - MinIndex ];
+        Emitted[ t ] = 0;
+    }
+
+    Optimized.Resize( NumTriangles * 3 );
+
+    int Cache[ FORSYTH_CACHE_SIZE + 3 ];
+    int CacheCount = 0;
+    int NewCache[ FORSYTH_CACHE_SIZE + 3 ];
+
+    int BestTriangle = 0;
+    int InputCursor = 0;
+
+    for ( int OutputTriangle = 0 ; OutputTriangle < NumTriangles ; OutputTriangle++ ) {
+        if ( BestTriangle < 0 ) {
+            // No candidates in cache: take next triangle in input order
+            while ( Emitted[ InputCursor ] ) {
+                InputCursor++;
+            }
+            BestTriangle = InputCursor;
+        }
+
+        const unsigned int * Triangle = &_Indices[ BestTriangle * 3 ];
+
+        Optimized[ OutputTriangle * 3 + 0 ] = Triangle[ 0 ];
+        Optimized[ OutputTriangle * 3 + 1 ] = Triangle[ 1 ];
+        Optimized[ OutputTriangle * 3 + 2 ] = Triangle[ 2 ];
+        Emitted[ BestTriangle ] = 1;
+
+        // Put triangle vertices in front of the LRU cache
+        int NewCacheCount = 0;
+        for ( int k = 0 ; k < 3 ; k++ ) {
+            int v = Triangle[ k ] - MinIndex;
+            NewCache[ NewCacheCount++ ] = v;
+
+            // Remove emitted triangle from vertex adjacency
+            int * Adjacency = &VertexTriangles[ TriangleOffsets[ v ] ];
+            int Count = TriangleCounts[ v ];
+            for ( int j = 0 ; j < Count ; j++ ) {
+                if ( Adjacency[ j ] == BestTriangle ) {
+                    Adjacency[ j ] = Adjacency[ Count - 1 ];
+                    break;
+                }
+            }
+            TriangleCounts[ v ] = Count - 1;
+        }
+        for ( int j = 0 ; j < CacheCount ; j++ ) {
+            int v = Cache[ j ];
+            if ( v != NewCache[ 0 ] && v != NewCache[ 1 ] && v != NewCache[ 2 ] ) {
+                NewCache[ NewCacheCount++ ] = v;
+            }
+        }
+
+        // Update scores of cached vertices and find the best triangle among their neighbours
+        BestTriangle = -1;
+        float BestScore = -1.0f;
+
+        for ( int j = 0 ; j < NewCacheCount ; j++ ) {
+            int v = NewCache[ j ];
+            int CachePosition = j < FORSYTH_CACHE_SIZE ? j : -1;
+
+            CachePositions[ v ] = CachePosition;
+
+            float Score = ForsythVertexScore( CachePosition, TriangleCounts[ v ] );
+            float Delta = Score - VertexScores[ v ];
+            VertexScores[ v ] = Score;
+
+            const int * Adjacency = &VertexTriangles[ TriangleOffsets[ v ] ];
+            for ( int n = 0 ; n < TriangleCounts[ v ] ; n++ ) {
+                int t = Adjacency[ n ];
+                TriangleScores[ t ] += Delta;
+            }
+        }
+
+        for ( int j = 0 ; j < NewCacheCount ; j++ ) {
+            int v = NewCache[ j ];
+            const int * Adjacency = &VertexTriangles[ TriangleOffsets[ v ] ];
+            for ( int n = 0 ; n < TriangleCounts[ v ] ; n++ ) {
+                int t = Adjacency[ n ];
+                // Ties are resolved by triangle index to keep the result independent of adjacency order
+                if ( TriangleScores[ t ] > BestScore || ( TriangleScores[ t ] == BestScore && t < BestTriangle ) ) {
+                    BestScore = TriangleScores[ t ];
+                    BestTriangle = t;
+                }
+            }
+        }
+
+        CacheCount = FMath::Min( NewCacheCount, ( int )FORSYTH_CACHE_SIZE );
+        memcpy( Cache, NewCache, CacheCount * sizeof( Cache[ 0 ] ) );
+    }
+
+    memcpy( _Indices, Optimized.ToPtr(), NumTriangles * 3 * sizeof( _Indices[ 0 ] ) );
+}
+
+int OptimizeVertexFetch( TArray< FMeshVertex > & _Vertices, unsigned int * _Indices, int _NumIndices ) {
+    const int NumVertices = _Vertices.Length();
+
+    TPodArray< unsigned int > Remap;
+    TArray< FMeshVertex > Reordered;
+
+    Remap.Resize( NumVertices );
+    for ( int i = 0 ; i < NumVertices ; i++ ) {
+        Remap[ i ] = ~0u;
+    }
+    Reordered.Reserve( NumVertices );
+
+    for ( int i = 0 ; i < _NumIndices ; i++ ) {
+        unsigned int Index = _Indices[ i ];
+
+        assert( Index < ( unsigned int )NumVertices );
+
+        if ( Remap[ Index ] == ~0u ) {
+            Remap[ Index ] = Reordered.Length();
+            Reordered.Append( _Vertices[ Index ] );
+        }
+
+        _Indices[ i ] = Remap[ Index ];
+    }
+
+    _Vertices = Reordered;
+
+    return _Vertices.Length();
+}
+
+FVertexCacheStats AnalyzeVertexCache( const unsigned int * _Indices, int _NumIndices, int _NumVertices, int _CacheSize ) {
+    FVertexCacheStats Stats;
+
+    Stats.ACMR = 0;
+    Stats.ATVR = 0;
+
+    if ( _NumIndices < 3 || _NumVertices == 0 ) {
+        return Stats;
+    }
+
+    // Timestamp of the moment the vertex entered the FIFO cache
+    TPodArray< int > CacheTimestamps;
+    TPodArray< byte > Referenced;
+    CacheTimestamps.Resize( _NumVertices );
+    Referenced.Resize( _NumVertices );
+    for ( int i = 0 ; i < _NumVertices ; i++ ) {
+        CacheTimestamps[ i ] = 0;
+        Referenced[ i ] = 0;
+    }
+
+    int Timestamp = _CacheSize + 1;
+    int NumTransformed = 0;
+    int NumReferenced = 0;
+
+    for ( int i = 0 ; i < _NumIndices ; i++ ) {
+        unsigned int Index = _Indices[ i ];
+
+        if ( Timestamp - CacheTimestamps[ Index ] > _CacheSize ) {
+            CacheTimestamps[ Index ] = Timestamp++;
+            NumTransformed++;
+        }
+
+        if ( !Referenced[ Index ] ) {
+            Referenced[ Index ] = 1;
+            NumReferenced++;
+        }
+    }
+
+    Stats.ACMR = ( float )NumTransformed / ( _NumIndices / 3 );
+    Stats.ATVR = ( float )NumTransformed / NumReferenced;
+
+    return Stats;
+}
@@ -0,0 +1,50 @@
+/*
+
+Blade Of Darkness Remake GPL Source Code
+
+Copyright (C) 2017 Alexander Samusev.
+
+This file is part of the Blade Of Darkness Remake GPL Source Code (BladeRemake Source Code).
+
+BladeRemake is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+#pragma once
+
+#include <Engine/Renderer/Public/StaticMeshResource.h>
+
+// World mesh optimization passes
+
+// Merge bitwise identical vertices and rewrite indices to use the shared copies. Vertices are
+// compacted in order of first use, unreferenced vertices are removed. If _VertexGroups is not NULL,
+// only vertices of the same group are merged. Returns new vertex count.
+int WeldVertices( TArray< FMeshVertex > & _Vertices, unsigned int * _Indices, int _NumIndices, const int * _VertexGroups );
+
+// Reorder triangles for post-transform vertex cache locality (Tom Forsyth's linear-speed algorithm).
+// Indices are reordered in place, the result depends only on the input.
+void OptimizeVertexCache( unsigned int * _Indices, int _NumIndices );
+
+// Reorder vertices in order of first use by the index buffer to improve vertex fetch locality.
+// Indices are rewritten, unreferenced vertices are removed. Returns new vertex count.
+int OptimizeVertexFetch( TArray< FMeshVertex > & _Vertices, unsigned int * _Indices, int _NumIndices );
+
+struct FVertexCacheStats {
+    float ACMR;     // Transformed vertices per triangle
+    float ATVR;     // Transformed vertices per referenced vertex
+};
+
+// Simulate a FIFO post-transform cache of _CacheSize entries
+FVertexCacheStats AnalyzeVertexCache( const unsigned int * _Indices, int _NumIndices, int _NumVertices, int _CacheSize );
@@ -0,0 +1,151 @@
+/*
+
+Blade Of Darkness Remake GPL Source Code
+
+Copyright (C) 2017 Alexander Samusev.
+
+This file is part of the Blade Of Darkness Remake GPL Source Code (BladeRemake Source Code).
+
+BladeRemake is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+#include "SectorPlanes.h"
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#define SECTOR_PLANES_SSE2
+#include <emmintrin.h>
+#endif
+
+void FSectorPlanes::Clear() {
+    FirstPlane.Clear();
+    NormalX.Clear();
+    NormalY.Clear();
+    NormalZ.Clear();
+    Dist.Clear();
+}
+
+size_t FSectorPlanes::GetMemoryBytes() const {
+    return FirstPlane.Length() * sizeof( int ) + NormalX.Length() * sizeof( float ) * 4;
+}
+
+void FSectorPlanes::AddSector( const PlaneF * _Planes, int _NumPlanes ) {
+    if ( FirstPlane.Length() == 0 ) {
+        FirstPlane.Append( 0 );
+    }
+
+    const int First = FirstPlane.Last();
+
+    // Padding planes accept all points. A sector without planes gets one plane that rejects all points.
+    const int NumPlanes = _NumPlanes > 0 ? ( _NumPlanes + 3 ) & ~3 : 4;
+
+    NormalX.Resize( First + NumPlanes );
+    NormalY.Resize( First + NumPlanes );
+    NormalZ.Resize( First + NumPlanes );
+    Dist.Resize( First + NumPlanes );
+
+    for ( int k = 0 ; k < NumPlanes ; k++ ) {
+        if ( k < _NumPlanes ) {
+            NormalX[ First + k ] = _Planes[ k ].Normal.X;
+            NormalY[ First + k ] = _Planes[ k ].Normal.Y;
+            NormalZ[ First + k ] = _Planes[ k ].Normal.Z;
+            Dist[ First + k ] = _Planes[ k ].D;
+        } else {
+            NormalX[ First + k ] = 0.0f;
+            NormalY[ First + k ] = 0.0f;
+            NormalZ[ First + k ] = 0.0f;
+            Dist[ First + k ] = _NumPlanes > 0 ? 1.0f : -1.0f;
+        }
+    }
+
+    FirstPlane.Append( First + NumPlanes );
+}
+
+PlaneF FSectorPlanes::GetPlane( int _PlaneIndex ) const {
+    PlaneF Plane;
+    Plane.Normal.X = NormalX[ _PlaneIndex ];
+    Plane.Normal.Y = NormalY[ _PlaneIndex ];
+    Plane.Normal.Z = NormalZ[ _PlaneIndex ];
+    Plane.D = Dist[ _PlaneIndex ];
+    return Plane;
+}
+
+bool FSectorPlanes::IsInside( int _SectorIndex, const Float3 & _Point ) const {
+    const int First = FirstPlane[ _SectorIndex ];
+    const int Last = FirstPlane[ _SectorIndex + 1 ];
+
+#ifdef SECTOR_PLANES_SSE2
+    const __m128 PX = _mm_set1_ps( _Point.X );
+    const __m128 PY = _mm_set1_ps( _Point.Y );
+    const __m128 PZ = _mm_set1_ps( _Point.Z );
+    const __m128 Zero = _mm_setzero_ps();
+
+    for ( int k = First ; k < Last ; k += 4 ) {
+        const __m128 D = _mm_add_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( _mm_loadu_ps( NormalX.ToPtr() + k ), PX ),
+                                                             _mm_mul_ps( _mm_loadu_ps( NormalY.ToPtr() + k ), PY ) ),
+                                                 _mm_mul_ps( _mm_loadu_ps( NormalZ.ToPtr() + k ), PZ ) ),
+                                     _mm_loadu_ps( Dist.ToPtr() + k ) );
+
+        // Same as PlaneF::SideOffset with zero epsilon: NaN distances are not in front
+        if ( _mm_movemask_ps( _mm_cmpgt_ps( D, Zero ) ) != 0xf ) {
+            return false;
+        }
+    }
+#else
+    for ( int k = First ; k < Last ; k++ ) {
+        const float D = NormalX[ k ] * _Point.X + NormalY[ k ] * _Point.Y + NormalZ[ k ] * _Point.Z + Dist[ k ];
+        if ( !( D > 0.0f ) ) {
+            return false;
+        }
+    }
+#endif
+
+    return true;
+}
+
+int FSectorPlanes::IsInside4( int _SectorIndex, const float * _X, const float * _Y, const float * _Z, int _Mask ) const {
+    const int First = FirstPlane[ _SectorIndex ];
+    const int Last = FirstPlane[ _SectorIndex + 1 ];
+
+#ifdef SECTOR_PLANES_SSE2
+    const __m128 PX = _mm_loadu_ps( _X );
+    const __m128 PY = _mm_loadu_ps( _Y );
+    const __m128 PZ = _mm_loadu_ps( _Z );
+    const __m128 Zero = _mm_setzero_ps();
+
+    int Mask = _Mask & 0xf;
+
+    for ( int k = First ; k < Last && Mask ; k++ ) {
+        const __m128 D = _mm_add_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( _mm_set1_ps( NormalX[ k ] ), PX ),
+                                                             _mm_mul_ps( _mm_set1_ps( NormalY[ k ] ), PY ) ),
+                                                 _mm_mul_ps( _mm_set1_ps( NormalZ[ k ] ), PZ ) ),
+                                     _mm_set1_ps( Dist[ k ] ) );
+
+        Mask &= _mm_movemask_ps( _mm_cmpgt_ps( D, Zero ) );
+    }
+
+    return Mask;
+#else
+    int Mask = 0;
+
+    for ( int i = 0 ; i < 4 ; i++ ) {
+        if ( ( _Mask & ( 1 << i ) ) && IsInside( _SectorIndex, Float3( _X[ i ], _Y[ i ], _Z[ i ] ) ) ) {
+            Mask |= 1 << i;
+        }
+    }
+
+    return Mask;
+#endif
+}
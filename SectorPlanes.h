@@ -0,0 +1,61 @@
+/*
+
+Blade Of Darkness Remake GPL Source Code
+
+Copyright (C) 2017 Alexander Samusev.
+
+This file is part of the Blade Of Darkness Remake GPL Source Code (BladeRemake Source Code).
+
+BladeRemake is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+#pragma once
+
+#include <Engine/Renderer/Public/StaticMeshResource.h>
+
+// Bounding planes of convex sectors in structure of arrays layout. Planes of each sector are padded to
+// groups of 4, so one SSE instruction tests 4 planes against a point or one plane against 4 points.
+class FSectorPlanes {
+public:
+    void Clear();
+
+    // Sectors are added in order. Sectors without planes (not known yet) contain no points.
+    void AddSector( const PlaneF * _Planes, int _NumPlanes );
+
+    int GetNumSectors() const { return FirstPlane.Length() > 0 ? FirstPlane.Length() - 1 : 0; }
+
+    // The point is inside if it is in front of all sector planes
+    bool IsInside( int _SectorIndex, const Float3 & _Point ) const;
+
+    // Test 4 points at once. Returns mask of points inside the sector, bit i for point i.
+    // Only points of _Mask are tested.
+    int IsInside4( int _SectorIndex, const float * _X, const float * _Y, const float * _Z, int _Mask = 0xf ) const;
+
+    // Planes of sector i are GetPlane( k ) for k in [ GetFirstPlane(i), GetFirstPlane(i+1) ). Padding
+    // planes have zero normals.
+    int GetFirstPlane( int _SectorIndex ) const { return FirstPlane[ _SectorIndex ]; }
+
+    PlaneF GetPlane( int _PlaneIndex ) const;
+
+    size_t GetMemoryBytes() const;
+
+private:
+    TPodArray< int > FirstPlane;    // Planes of sector i are in [ FirstPlane[i], FirstPlane[i+1] )
+    TPodArray< float > NormalX;
+    TPodArray< float > NormalY;
+    TPodArray< float > NormalZ;
+    TPodArray< float > Dist;
+};
@@ -0,0 +1,144 @@
+/*
+
+Blade Of Darkness Remake GPL Source Code
+
+Copyright (C) 2017 Alexander Samusev.
+
+This file is part of the Blade Of Darkness Remake GPL Source Code (BladeRemake Source Code).
+
+BladeRemake is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+#include "SectorTree.h"
+
+#include <algorithm>
+
+// Sectors per leaf
+static const int LEAF_SIZE = 4;
+
+void FSectorTree::Clear() {
+    Nodes.Clear();
+    SectorIndices.Clear();
+}
+
+void FSectorTree::GetBounds( Float3 & _Mins, Float3 & _Maxs ) const {
+    if ( Nodes.Length() == 0 ) {
+        _Mins = _Maxs = Float3( 0.0f );
+        return;
+    }
+
+    _Mins = Nodes[ 0 ].Mins;
+    _Maxs = Nodes[ 0 ].Maxs;
+}
+
+size_t FSectorTree::GetMemoryBytes() const {
+    return Nodes.Length() * sizeof( FNode ) + SectorIndices.Length() * sizeof( int );
+}
+
+// Top-down build with median split of sector centers along the longest axis. Subtrees are built
+// with an explicit stack in pre-order.
+void FSectorTree::Build( const BvAxisAlignedBox * _Bounds, int _NumSectors ) {
+    struct FBuildStackEntry {
+        int Begin;
+        int End;
+        int Parent;     // Node whose second child is built, -1 for first children
+    };
+
+    Clear();
+
+    for ( int i = 0 ; i < _NumSectors ; i++ ) {
+        const BvAxisAlignedBox & Bounds = _Bounds[ i ];
+        if ( Bounds.Mins.X <= Bounds.Maxs.X && Bounds.Mins.Y <= Bounds.Maxs.Y && Bounds.Mins.Z <= Bounds.Maxs.Z ) {
+            SectorIndices.Append( i );
+        }
+    }
+
+    if ( SectorIndices.Length() == 0 ) {
+        return;
+    }
+
+    TPodArray< FBuildStackEntry > Stack;
+
+    FBuildStackEntry Entry;
+    Entry.Begin = 0;
+    Entry.End = SectorIndices.Length();
+    Entry.Parent = -1;
+    Stack.Append( Entry );
+
+    while ( Stack.Length() > 0 ) {
+        FBuildStackEntry Top = Stack.Last();
+        Stack.Resize( Stack.Length() - 1 );
+
+        const int NodeIndex = Nodes.Length();
+
+        if ( Top.Parent >= 0 ) {
+            Nodes[ Top.Parent ].First = NodeIndex;
+        }
+
+        Nodes.Append( FNode() );
+
+        BvAxisAlignedBox NodeBounds;
+        BvAxisAlignedBox Centers;
+        NodeBounds.Clear();
+        Centers.Clear();
+        for ( int i = Top.Begin ; i < Top.End ; i++ ) {
+            NodeBounds.AddAABB( _Bounds[ SectorIndices[ i ] ] );
+            Centers.AddPoint( _Bounds[ SectorIndices[ i ] ].Center() );
+        }
+
+        FNode & Node = Nodes[ NodeIndex ];
+        Node.Mins = NodeBounds.Mins;
+        Node.Maxs = NodeBounds.Maxs;
+
+        const int Count = Top.End - Top.Begin;
+
+        if ( Count <= LEAF_SIZE || Stack.Length() + 2 >= MAX_DEPTH ) {
+            Node.First = Top.Begin;
+            Node.Count = Count;
+            continue;
+        }
+
+        Node.First = -1;
+        Node.Count = 0;
+
+        const Float3 Extents = Centers.Maxs - Centers.Mins;
+        int Axis = 0;
+        if ( Extents.Y > Extents[ Axis ] ) {
+            Axis = 1;
+        }
+        if ( Extents.Z > Extents[ Axis ] ) {
+            Axis = 2;
+        }
+
+        const int Middle = Top.Begin + Count / 2;
+
+        std::nth_element( SectorIndices.ToPtr() + Top.Begin, SectorIndices.ToPtr() + Middle, SectorIndices.ToPtr() + Top.End,
+                          [_Bounds, Axis]( int _A, int _B ) {
+            return _Bounds[ _A ].Center()[ Axis ] < _Bounds[ _B ].Center()[ Axis ];
+        } );
+
+        // Second child is pushed first, so the first child is built right after the node
+        Entry.Begin = Middle;
+        Entry.End = Top.End;
+        Entry.Parent = NodeIndex;
+        Stack.Append( Entry );
+
+        Entry.Begin = Top.Begin;
+        Entry.End = Middle;
+        Entry.Parent = -1;
+        Stack.Append( Entry );
+    }
+}
@@ -0,0 +1,102 @@
+/*
+
+Blade Of Darkness Remake GPL Source Code
+
+Copyright (C) 2017 Alexander Samusev.
+
+This file is part of the Blade Of Darkness Remake GPL Source Code (BladeRemake Source Code).
+
+BladeRemake is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+#pragma once
+
+#include <Engine/Renderer/Public/StaticMeshResource.h>
+
+// Bounding volume hierarchy over sector bounds for point location. Sectors are convex, so a point is
+// located by exact plane tests of the few sectors whose bounds contain it.
+class FSectorTree {
+public:
+    // Sectors with empty bounds are not added
+    void Build( const BvAxisAlignedBox * _Bounds, int _NumSectors );
+
+    void Clear();
+
+    bool IsEmpty() const { return Nodes.Length() == 0; }
+
+    // Call _Test for sectors whose bounds contain the point, until it returns true.
+    // Returns the sector accepted by _Test or -1.
+    template< typename TTest >
+    int Find( const Float3 & _Point, TTest _Test ) const;
+
+    // Bounds of all sectors in the tree
+    void GetBounds( Float3 & _Mins, Float3 & _Maxs ) const;
+
+    size_t GetMemoryBytes() const;
+
+private:
+    // Nodes are stored in pre-order, the first child of a node follows the node
+    struct FNode {
+        Float3 Mins;
+        Float3 Maxs;
+        int First;      // Leaf: first sector in SectorIndices. Node: index of the second child
+        int Count;      // Leaf: number of sectors, 0 for nodes
+    };
+
+    enum { MAX_DEPTH = 64 };
+
+    TPodArray< FNode > Nodes;
+    TPodArray< int > SectorIndices;
+};
+
+template< typename TTest >
+int FSectorTree::Find( const Float3 & _Point, TTest _Test ) const {
+    if ( Nodes.Length() == 0 ) {
+        return -1;
+    }
+
+    int Stack[ MAX_DEPTH ];
+    int StackSize = 0;
+    int NodeIndex = 0;
+
+    for ( ;; ) {
+        const FNode & Node = Nodes[ NodeIndex ];
+
+        const bool bInside = _Point.X >= Node.Mins.X && _Point.X <= Node.Maxs.X
+                          && _Point.Y >= Node.Mins.Y && _Point.Y <= Node.Maxs.Y
+                          && _Point.Z >= Node.Mins.Z && _Point.Z <= Node.Maxs.Z;
+
+        if ( bInside ) {
+            if ( Node.Count == 0 ) {
+                Stack[ StackSize++ ] = Node.First;
+                NodeIndex++;
+                continue;
+            }
+
+            for ( int i = Node.First ; i < Node.First + Node.Count ; i++ ) {
+                if ( _Test( SectorIndices[ i ] ) ) {
+                    return SectorIndices[ i ];
+                }
+            }
+        }
+
+        if ( StackSize == 0 ) {
+            return -1;
+        }
+
+        NodeIndex = Stack[ --StackSize ];
+    }
+}
@@ -0,0 +1,191 @@
+/*
+
+Blade Of Darkness Remake GPL Source Code
+
+Copyright (C) 2017 Alexander Samusev.
+
+This file is part of the Blade Of Darkness Remake GPL Source Code (BladeRemake Source Code).
+
+BladeRemake is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+#include "TexCoordGen.h"
+
+#include <cmath>
+#include <cfloat>
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#define TEXCOORD_GEN_SSE2
+#include <emmintrin.h>
+#endif
+
+void FTexCoordBatch::Clear() {
+    Faces.Clear();
+    X.Clear();
+    Y.Clear();
+    Z.Clear();
+}
+
+FTexCoordFace & FTexCoordBatch::AddFace( int _FirstVertex ) {
+    Faces.Append( FTexCoordFace() );
+    FTexCoordFace & Face = Faces.Last();
+    Face.FirstPosition = X.Length();
+    Face.FirstVertex = _FirstVertex;
+    Face.NumVertices = 0;
+    return Face;
+}
+
+void FTexCoordBatch::AddPosition( const Double3 & _Position ) {
+    X.Append( _Position.X );
+    Y.Append( _Position.Y );
+    Z.Append( _Position.Z );
+    Faces.Last().NumVertices++;
+}
+
+// Write coordinates of the face shifted by the floored minimum
+static void StoreTexCoords( const FTexCoordFace & _Face, const double * _U, const double * _V, double _MinU, double _MinV, FMeshVertex * _Vertices ) {
+    const double ShiftU = std::floor( _MinU );
+    const double ShiftV = std::floor( _MinV );
+
+    FMeshVertex * Vertices = _Vertices + _Face.FirstVertex;
+
+    for ( int k = 0 ; k < _Face.NumVertices ; k++ ) {
+        Vertices[ k ].TexCoord.X = float( _U[ k ] - ShiftU );
+        Vertices[ k ].TexCoord.Y = float( _V[ k ] - ShiftV );
+    }
+}
+
+static int MaxFaceVertices( const FTexCoordBatch & _Batch ) {
+    int MaxVertices = 0;
+    for ( int i = 0 ; i < _Batch.Faces.Length() ; i++ ) {
+        if ( _Batch.Faces[ i ].NumVertices > MaxVertices ) {
+            MaxVertices = _Batch.Faces[ i ].NumVertices;
+        }
+    }
+    return MaxVertices;
+}
+
+void GenerateTexCoordsScalar( const FTexCoordBatch & _Batch, FMeshVertex * _Vertices ) {
+    TPodArray< double > U;
+    TPodArray< double > V;
+
+    U.Resize( MaxFaceVertices( _Batch ) );
+    V.Resize( U.Length() );
+
+    for ( int i = 0 ; i < _Batch.Faces.Length() ; i++ ) {
+        const FTexCoordFace & Face = _Batch.Faces[ i ];
+        const double * X = _Batch.X.ToPtr() + Face.FirstPosition;
+        const double * Y = _Batch.Y.ToPtr() + Face.FirstPosition;
+        const double * Z = _Batch.Z.ToPtr() + Face.FirstPosition;
+
+        double MinU = DBL_MAX;
+        double MinV = DBL_MAX;
+
+        for ( int k = 0 ; k < Face.NumVertices ; k++ ) {
+            U[ k ] = ( X[ k ] * Face.Axis[ 0 ][ 0 ] + Y[ k ] * Face.Axis[ 0 ][ 1 ] + Z[ k ] * Face.Axis[ 0 ][ 2 ] + Face.Offset[ 0 ] ) * Face.Scale[ 0 ];
+            V[ k ] = ( X[ k ] * Face.Axis[ 1 ][ 0 ] + Y[ k ] * Face.Axis[ 1 ][ 1 ] + Z[ k ] * Face.Axis[ 1 ][ 2 ] + Face.Offset[ 1 ] ) * Face.Scale[ 1 ];
+
+            MinU = U[ k ] < MinU ? U[ k ] : MinU;
+            MinV = V[ k ] < MinV ? V[ k ] : MinV;
+        }
+
+        StoreTexCoords( Face, U.ToPtr(), V.ToPtr(), MinU, MinV, _Vertices );
+    }
+}
+
+#ifdef TEXCOORD_GEN_SSE2
+
+// Two vertices per step. Texture mapping needs double precision: file space positions are large and
+// coordinates are shifted by the minimum only after projection.
+void GenerateTexCoords( const FTexCoordBatch & _Batch, FMeshVertex * _Vertices ) {
+    TPodArray< double > U;
+    TPodArray< double > V;
+
+    U.Resize( MaxFaceVertices( _Batch ) );
+    V.Resize( U.Length() );
+
+    for ( int i = 0 ; i < _Batch.Faces.Length() ; i++ ) {
+        const FTexCoordFace & Face = _Batch.Faces[ i ];
+        const double * X = _Batch.X.ToPtr() + Face.FirstPosition;
+        const double * Y = _Batch.Y.ToPtr() + Face.FirstPosition;
+        const double * Z = _Batch.Z.ToPtr() + Face.FirstPosition;
+
+        const __m128d AxisU0 = _mm_set1_pd( Face.Axis[ 0 ][ 0 ] );
+        const __m128d AxisU1 = _mm_set1_pd( Face.Axis[ 0 ][ 1 ] );
+        const __m128d AxisU2 = _mm_set1_pd( Face.Axis[ 0 ][ 2 ] );
+        const __m128d AxisV0 = _mm_set1_pd( Face.Axis[ 1 ][ 0 ] );
+        const __m128d AxisV1 = _mm_set1_pd( Face.Axis[ 1 ][ 1 ] );
+        const __m128d AxisV2 = _mm_set1_pd( Face.Axis[ 1 ][ 2 ] );
+        const __m128d OffsetU = _mm_set1_pd( Face.Offset[ 0 ] );
+        const __m128d OffsetV = _mm_set1_pd( Face.Offset[ 1 ] );
+        const __m128d ScaleU = _mm_set1_pd( Face.Scale[ 0 ] );
+        const __m128d ScaleV = _mm_set1_pd( Face.Scale[ 1 ] );
+
+        __m128d MinU = _mm_set1_pd( DBL_MAX );
+        __m128d MinV = _mm_set1_pd( DBL_MAX );
+
+        int k = 0;
+        for ( ; k + 2 <= Face.NumVertices ; k += 2 ) {
+            const __m128d PX = _mm_loadu_pd( X + k );
+            const __m128d PY = _mm_loadu_pd( Y + k );
+            const __m128d PZ = _mm_loadu_pd( Z + k );
+
+            __m128d TU = _mm_add_pd( _mm_add_pd( _mm_add_pd( _mm_mul_pd( PX, AxisU0 ), _mm_mul_pd( PY, AxisU1 ) ), _mm_mul_pd( PZ, AxisU2 ) ), OffsetU );
+            __m128d TV = _mm_add_pd( _mm_add_pd( _mm_add_pd( _mm_mul_pd( PX, AxisV0 ), _mm_mul_pd( PY, AxisV1 ) ), _mm_mul_pd( PZ, AxisV2 ) ), OffsetV );
+
+            TU = _mm_mul_pd( TU, ScaleU );
+            TV = _mm_mul_pd( TV, ScaleV );
+
+            MinU = _mm_min_pd( MinU, TU );
+            MinV = _mm_min_pd( MinV, TV );
+
+            _mm_storeu_pd( U.ToPtr() + k, TU );
+            _mm_storeu_pd( V.ToPtr() + k, TV );
+        }
+
+        // Odd vertex
+        if ( k < Face.NumVertices ) {
+            const __m128d PX = _mm_load_sd( X + k );
+            const __m128d PY = _mm_load_sd( Y + k );
+            const __m128d PZ = _mm_load_sd( Z + k );
+
+            __m128d TU = _mm_add_sd( _mm_add_sd( _mm_add_sd( _mm_mul_sd( PX, AxisU0 ), _mm_mul_sd( PY, AxisU1 ) ), _mm_mul_sd( PZ, AxisU2 ) ), OffsetU );
+            __m128d TV = _mm_add_sd( _mm_add_sd( _mm_add_sd( _mm_mul_sd( PX, AxisV0 ), _mm_mul_sd( PY, AxisV1 ) ), _mm_mul_sd( PZ, AxisV2 ) ), OffsetV );
+
+            TU = _mm_mul_sd( TU, ScaleU );
+            TV = _mm_mul_sd( TV, ScaleV );
+
+            MinU = _mm_min_sd( MinU, TU );
+            MinV = _mm_min_sd( MinV, TV );
+
+            _mm_store_sd( U.ToPtr() + k, TU );
+            _mm_store_sd( V.ToPtr() + k, TV );
+        }
+
+        MinU = _mm_min_sd( MinU, _mm_unpackhi_pd( MinU, MinU ) );
+        MinV = _mm_min_sd( MinV, _mm_unpackhi_pd( MinV, MinV ) );
+
+        StoreTexCoords( Face, U.ToPtr(), V.ToPtr(), _mm_cvtsd_f64( MinU ), _mm_cvtsd_f64( MinV ), _Vertices );
+    }
+}
+
+#else
+
+void GenerateTexCoords( const FTexCoordBatch & _Batch, FMeshVertex * _Vertices ) {
+    GenerateTexCoordsScalar( _Batch, _Vertices );
+}
+
+#endif
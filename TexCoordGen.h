@@ -0,0 +1,63 @@
+/*
+
+Blade Of Darkness Remake GPL Source Code
+
+Copyright (C) 2017 Alexander Samusev.
+
+This file is part of the Blade Of Darkness Remake GPL Source Code (BladeRemake Source Code).
+
+BladeRemake is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+#pragma once
+
+#include <Engine/Renderer/Public/StaticMeshResource.h>
+
+// Batch texture coordinate generation for world faces
+
+// Affine texture mapping of a face: coordinate = ( dot( Axis, Position ) + Offset ) * Scale, Scale is inverse
+// texture size. Face vertices are [ FirstVertex, FirstVertex + NumVertices ) in the output vertex array,
+// their positions start at FirstPosition in the batch.
+struct FTexCoordFace {
+    double Axis[ 2 ][ 3 ];
+    double Offset[ 2 ];
+    double Scale[ 2 ];
+    int FirstPosition;
+    int FirstVertex;
+    int NumVertices;
+};
+
+// Faces and positions of their vertices in structure of arrays layout
+struct FTexCoordBatch {
+    TPodArray< FTexCoordFace > Faces;
+    TPodArray< double > X;
+    TPodArray< double > Y;
+    TPodArray< double > Z;
+
+    void Clear();
+
+    // Start new face. Positions of its vertices follow with AddPosition.
+    FTexCoordFace & AddFace( int _FirstVertex );
+
+    void AddPosition( const Double3 & _Position );
+};
+
+// Generate texture coordinates of all faces of the batch in one sweep. Coordinates of each face are shifted
+// by their floored minimum to keep them close to zero. Uses SSE2 when the target has it.
+void GenerateTexCoords( const FTexCoordBatch & _Batch, FMeshVertex * _Vertices );
+
+// Scalar reference version of GenerateTexCoords
+void GenerateTexCoordsScalar( const FTexCoordBatch & _Batch, FMeshVertex * _Vertices );
@@ -28,28 +28,5 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 AN_SCENE_COMPONENT_DECL( FWorldComponent, CCF_ROOT | CCF_HIDDEN_IN_EDITOR )
 
 int FWorldComponent::FindSpatialArea( const Float3 & _Position ) {
-    bool Inside;
-    int SectorIndex = -1;
-    EPlaneSide Offset;
-    Double3 Pos(_Position);
-    for ( int i = 0 ; i < World.Sectors.Length() ; i++ ) {
-        FBladeWorld::FSector & Sector = World.Sectors[i];
-
-        Inside = true;
-        for ( int f = 0 ; f < Sector.Faces.Length() ; f++ ) {
-            FBladeWorld::FFace * Face = Sector.Faces[f];
-
-            Offset = Face->Plane.SideOffset( Pos, 0.0 );
-            if ( Offset != EPlaneSide::Front ) {
-                Inside = false;
-                break;
-            }
-        }
-
-        if ( Inside ) {
-            SectorIndex = i;
-            break;
-        }
-    }
-    return SectorIndex;
+    return World ? World->LocateSector( _Position ) : -1;
 }
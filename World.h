@@ -24,9 +24,21 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include <Engine/Renderer/Public/SpatialTreeComponent.h>
 
+#include <memory>
+
+struct FBladeWorld;
+
 class FWorldComponent : public FSpatialTreeComponent {
     AN_FACTORY_OBJECT( FWorldComponent, FSpatialTreeComponent )
 
 public:
     int FindSpatialArea( const Float3 & _Position ) override;
+
+    // Level world. The scene keeps it alive, worlds can also be shared with GWorldCache.
+    void SetWorld( std::shared_ptr< FBladeWorld > _World ) { World = _World; }
+
+    FBladeWorld * GetWorld() const { return World.get(); }
+
+private:
+    std::shared_ptr< FBladeWorld > World;
 };
@@ -0,0 +1,512 @@
+/*
+
+Blade Of Darkness Remake GPL Source Code
+
+Copyright (C) 2017 Alexander Samusev.
+
+This file is part of the Blade Of Darkness Remake GPL Source Code (BladeRemake Source Code).
+
+BladeRemake is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+#include "WorldQuery.h"
+#include "BladeWorld.h"
+#include "JobPool.h"
+
+// Points per job of a parallel LocateSectors batch
+static const int LOCATE_JOB_SIZE = 512;
+
+// Grid of a LocateSectors batch: points per cell and cells per axis at most
+static const int LOCATE_POINTS_PER_CELL = 4;
+static const int LOCATE_MAX_RESOLUTION = 64;
+
+// Segments per job of a parallel RaycastBatch
+static const int RAYCAST_JOB_SIZE = 64;
+
+// Neighbors of a sector are tested this far behind the point where a segment leaves the sector, world units
+static const float SECTOR_STEP_OVER = 0.001f;
+
+FWorldQuery::FWorldQuery( const FBladeWorld & _World ) {
+    const int NumSectors = _World.Sectors.Length();
+
+    std::shared_ptr< FSectorGraph > NewGraph = std::make_shared< FSectorGraph >();
+
+    NewGraph->SectorBounds.Resize( NumSectors );
+    for ( int SectorIndex = 0 ; SectorIndex < NumSectors ; SectorIndex++ ) {
+        if ( SectorIndex < _World.SectorBounds.Length() ) {
+            NewGraph->SectorBounds[ SectorIndex ] = _World.SectorBounds[ SectorIndex ];
+        } else {
+            NewGraph->SectorBounds[ SectorIndex ].Clear();
+        }
+    }
+
+    NewGraph->SectorTree.Build( NewGraph->SectorBounds.ToPtr(), NumSectors );
+
+    for ( int SectorIndex = 0 ; SectorIndex < NumSectors ; SectorIndex++ ) {
+        const PlaneF * SectorPlanes;
+        int NumPlanes;
+
+        if ( !_World.GetSectorPlanes( SectorIndex, SectorPlanes, NumPlanes ) ) {
+            SectorPlanes = NULL;
+            NumPlanes = 0;
+        }
+
+        NewGraph->PackedPlanes.AddSector( SectorPlanes, NumPlanes );
+    }
+
+    // Links to sectors dropped on read errors are not copied
+    NewGraph->FirstLink.Resize( NumSectors + 1 );
+    for ( int SectorIndex = 0 ; SectorIndex < NumSectors ; SectorIndex++ ) {
+        NewGraph->FirstLink[ SectorIndex ] = NewGraph->Links.Length();
+
+        if ( _World.SectorFirstLink.Length() != NumSectors + 1 ) {
+            continue;
+        }
+
+        for ( int i = _World.SectorFirstLink[ SectorIndex ] ; i < _World.SectorFirstLink[ SectorIndex + 1 ] ; i++ ) {
+            if ( _World.SectorLinks[ i ] < NumSectors ) {
+                NewGraph->Links.Append( _World.SectorLinks[ i ] );
+            }
+        }
+    }
+    NewGraph->FirstLink[ NumSectors ] = NewGraph->Links.Length();
+
+    Graph = NewGraph;
+
+    // Triangles of sector draw ranges in the world mesh
+    Triangles.Resize( NumSectors );
+    for ( int SectorIndex = 0 ; SectorIndex < NumSectors ; SectorIndex++ ) {
+        Triangles[ SectorIndex ] = MakeSectorTriangles( _World, SectorIndex );
+    }
+}
+
+FWorldQuery::FWorldQuery( const FWorldQuery & _Query, int _SectorIndex, const std::shared_ptr< const FWorldSectorTriangles > & _Triangles )
+    : Graph( _Query.Graph )
+    , Triangles( _Query.Triangles ) {
+    Triangles[ _SectorIndex ] = _Triangles;
+}
+
+std::shared_ptr< const FWorldSectorTriangles > FWorldQuery::MakeSectorTriangles( const FBladeWorld & _World, int _SectorIndex ) {
+    const FBladeWorld::FSector & Sector = _World.Sectors[ _SectorIndex ];
+
+    if ( Sector.NumMeshOffsets[ 0 ] + Sector.NumMeshOffsets[ 1 ] == 0 ) {
+        return std::shared_ptr< const FWorldSectorTriangles >();
+    }
+
+    std::shared_ptr< FWorldSectorTriangles > SectorTriangles = std::make_shared< FWorldSectorTriangles >();
+
+    for ( int Group = 0 ; Group < 2 ; Group++ ) {
+        for ( int i = Sector.FirstMeshOffset[ Group ] ; i < Sector.FirstMeshOffset[ Group ] + Sector.NumMeshOffsets[ Group ] ; i++ ) {
+            const int Face = i < _World.MeshFaces.Length() ? _World.MeshFaces[ i ] : -1;
+
+            SectorTriangles->Append( _World.MeshVertices.ToPtr(), _World.MeshIndices.ToPtr(), _World.MeshOffsets[ i ], Face );
+        }
+    }
+
+    return SectorTriangles;
+}
+
+// Only the vertices referenced by the draw range are copied
+void FWorldSectorTriangles::Append( const FMeshVertex * _Vertices, const unsigned int * _Indices, const FMeshOffset & _MeshOffset, int _Face ) {
+    if ( _MeshOffset.IndexCount == 0 ) {
+        return;
+    }
+
+    const unsigned int * SrcIndices = _Indices + _MeshOffset.StartIndexLocation;
+
+    unsigned int MinIndex = SrcIndices[ 0 ];
+    unsigned int MaxIndex = SrcIndices[ 0 ];
+    for ( unsigned int k = 1 ; k < _MeshOffset.IndexCount ; k++ ) {
+        MinIndex = FMath::Min( MinIndex, SrcIndices[ k ] );
+        MaxIndex = FMath::Max( MaxIndex, SrcIndices[ k ] );
+    }
+
+    const int FirstVertex = Vertices.Length();
+    const FMeshVertex * SrcVertices = _Vertices + _MeshOffset.BaseVertexLocation + MinIndex;
+
+    Vertices.Resize( FirstVertex + MaxIndex - MinIndex + 1 );
+    for ( unsigned int k = 0 ; k <= MaxIndex - MinIndex ; k++ ) {
+        Vertices[ FirstVertex + k ] = SrcVertices[ k ].Position;
+    }
+
+    const int FirstIndex = Indices.Length();
+
+    Indices.Resize( FirstIndex + _MeshOffset.IndexCount );
+    for ( unsigned int k = 0 ; k < _MeshOffset.IndexCount ; k++ ) {
+        Indices[ FirstIndex + k ] = FirstVertex + SrcIndices[ k ] - MinIndex;
+    }
+
+    for ( unsigned int k = 0 ; k < _MeshOffset.IndexCount / 3 ; k++ ) {
+        Faces.Append( _Face );
+    }
+}
+
+size_t FWorldSectorTriangles::GetMemoryBytes() const {
+    return Vertices.Length() * sizeof( Float3 ) + Indices.Length() * sizeof( unsigned int ) + Faces.Length() * sizeof( int );
+}
+
+const int * FWorldQuery::GetSectorLinks( int _SectorIndex, int & _NumLinks ) const {
+    _NumLinks = Graph->FirstLink[ _SectorIndex + 1 ] - Graph->FirstLink[ _SectorIndex ];
+    return Graph->Links.ToPtr() + Graph->FirstLink[ _SectorIndex ];
+}
+
+size_t FWorldQuery::GetMemoryBytes() const {
+    size_t Bytes = Graph->SectorBounds.Length() * sizeof( BvAxisAlignedBox )
+                 + Graph->SectorTree.GetMemoryBytes()
+                 + Graph->PackedPlanes.GetMemoryBytes()
+                 + ( Graph->FirstLink.Length() + Graph->Links.Length() ) * sizeof( int );
+
+    for ( int i = 0 ; i < Triangles.Length() ; i++ ) {
+        if ( Triangles[ i ] ) {
+            Bytes += Triangles[ i ]->GetMemoryBytes();
+        }
+    }
+
+    return Bytes;
+}
+
+int FWorldQuery::LocateSector( const Float3 & _Position ) const {
+    return Graph->SectorTree.Find( _Position, [this, &_Position]( int _SectorIndex ) {
+        return Graph->PackedPlanes.IsInside( _SectorIndex, _Position );
+    } );
+}
+
+float FWorldQuery::CalcSectorExit( int _SectorIndex, const Float3 & _Start, const Float3 & _Dir ) const {
+    float Exit = 1.0f;
+
+    // Padding planes are skipped, their normals are zero
+    for ( int f = Graph->PackedPlanes.GetFirstPlane( _SectorIndex ) ; f < Graph->PackedPlanes.GetFirstPlane( _SectorIndex + 1 ) ; f++ ) {
+        const PlaneF Plane = Graph->PackedPlanes.GetPlane( f );
+        const float DirDist = FMath::Dot( Plane.Normal, _Dir );
+        if ( DirDist < 0.0f ) {
+            Exit = FMath::Min( Exit, -Plane.Dist( _Start ) / DirDist );
+        }
+    }
+
+    return Exit;
+}
+
+int FWorldQuery::FindNeighbor( int _SectorIndex, const Float3 & _Position ) const {
+    for ( int i = Graph->FirstLink[ _SectorIndex ] ; i < Graph->FirstLink[ _SectorIndex + 1 ] ; i++ ) {
+        if ( Graph->PackedPlanes.IsInside( Graph->Links[ i ], _Position ) ) {
+            return Graph->Links[ i ];
+        }
+    }
+    return -1;
+}
+
+// Walk from sector to sector along the segment. The segment leaves a convex sector at the nearest plane
+// it crosses to the back, the next sector is the neighbor that contains a point just behind that plane.
+int FWorldQuery::TrackSector( int _SectorIndex, const Float3 & _From, const Float3 & _To ) const {
+    const int MaxSteps = 32;
+
+    if ( _SectorIndex < 0 || _SectorIndex >= GetNumSectors() ) {
+        return LocateSector( _To );
+    }
+
+    if ( Graph->PackedPlanes.IsInside( _SectorIndex, _To ) ) {
+        return _SectorIndex;
+    }
+
+    const Float3 Dir = _To - _From;
+    const float Length = FMath::Length( Dir );
+    if ( Length < SECTOR_STEP_OVER ) {
+        return LocateSector( _To );
+    }
+
+    const Float3 StepOverVec = Dir * ( SECTOR_STEP_OVER / Length );
+
+    int SectorIndex = _SectorIndex;
+    float Enter = 0.0f;
+
+    for ( int Step = 0 ; Step < MaxSteps ; Step++ ) {
+        const float Exit = CalcSectorExit( SectorIndex, _From, Dir );
+
+        if ( Exit <= Enter || Exit >= 1.0f ) {
+            // No progress or the segment ends in the sector, but the end point failed the plane test
+            break;
+        }
+
+        const int Next = FindNeighbor( SectorIndex, _From + Dir * Exit + StepOverVec );
+        if ( Next < 0 ) {
+            // Crossed a wall or a portal edge
+            break;
+        }
+
+        if ( Graph->PackedPlanes.IsInside( Next, _To ) ) {
+            return Next;
+        }
+
+        SectorIndex = Next;
+        Enter = Exit;
+    }
+
+    return LocateSector( _To );
+}
+
+// Two-sided segment/triangle intersection (Moller-Trumbore). Returns segment parameter of the hit in _T.
+static bool IntersectTriangle( const Float3 & _Start, const Float3 & _Dir, const Float3 & _V0, const Float3 & _V1, const Float3 & _V2, float & _T ) {
+    const Float3 Edge1 = _V1 - _V0;
+    const Float3 Edge2 = _V2 - _V0;
+    const Float3 P = FMath::Cross( _Dir, Edge2 );
+    const float Det = FMath::Dot( Edge1, P );
+
+    if ( Det == 0.0f ) {
+        return false;
+    }
+
+    const float InvDet = 1.0f / Det;
+    const Float3 S = _Start - _V0;
+
+    const float U = FMath::Dot( S, P ) * InvDet;
+    if ( U < 0.0f || U > 1.0f ) {
+        return false;
+    }
+
+    const Float3 Q = FMath::Cross( S, Edge1 );
+
+    const float V = FMath::Dot( _Dir, Q ) * InvDet;
+    if ( V < 0.0f || U + V > 1.0f ) {
+        return false;
+    }
+
+    _T = FMath::Dot( Edge2, Q ) * InvDet;
+    return true;
+}
+
+bool FWorldQuery::Raycast( const Float3 & _Start, const Float3 & _End, FWorldRaycastResult & _Result ) const {
+    return Raycast( LocateSector( _Start ), _Start, _End, _Result );
+}
+
+// Triangles of a sector lie on its boundary, so the nearest hit in the sector is the nearest hit of the
+// whole segment if there is one. Otherwise the segment continues in the sector behind the exit point.
+bool FWorldQuery::Raycast( int _SectorIndex, const Float3 & _Start, const Float3 & _End, FWorldRaycastResult & _Result ) const {
+    if ( _SectorIndex < 0 || _SectorIndex >= GetNumSectors() ) {
+        return false;
+    }
+
+    const Float3 Dir = _End - _Start;
+    const float Length = FMath::Length( Dir );
+    if ( Length <= 0.0f ) {
+        return false;
+    }
+
+    const Float3 StepOverVec = Dir * ( SECTOR_STEP_OVER / Length );
+
+    int SectorIndex = _SectorIndex;
+    float Enter = 0.0f;
+
+    // The walk moves forward along the segment, so each sector is visited once
+    for ( int Step = 0 ; Step < GetNumSectors() ; Step++ ) {
+        const FWorldSectorTriangles * SectorTriangles = Triangles[ SectorIndex ].get();
+        const int NumTriangles = SectorTriangles ? SectorTriangles->Faces.Length() : 0;
+
+        int HitTriangle = -1;
+        float Fraction = 1.0f;
+
+        for ( int i = 0 ; i < NumTriangles ; i++ ) {
+            const Float3 & V0 = SectorTriangles->Vertices[ SectorTriangles->Indices[ i * 3 + 0 ] ];
+            const Float3 & V1 = SectorTriangles->Vertices[ SectorTriangles->Indices[ i * 3 + 1 ] ];
+            const Float3 & V2 = SectorTriangles->Vertices[ SectorTriangles->Indices[ i * 3 + 2 ] ];
+            float T;
+
+            if ( IntersectTriangle( _Start, Dir, V0, V1, V2, T ) && T >= 0.0f && T <= Fraction ) {
+                Fraction = T;
+                HitTriangle = i;
+            }
+        }
+
+        if ( HitTriangle >= 0 ) {
+            const Float3 & V0 = SectorTriangles->Vertices[ SectorTriangles->Indices[ HitTriangle * 3 + 0 ] ];
+            const Float3 & V1 = SectorTriangles->Vertices[ SectorTriangles->Indices[ HitTriangle * 3 + 1 ] ];
+            const Float3 & V2 = SectorTriangles->Vertices[ SectorTriangles->Indices[ HitTriangle * 3 + 2 ] ];
+
+            _Result.Face = SectorTriangles->Faces[ HitTriangle ];
+            _Result.Sector = SectorIndex;
+            _Result.Fraction = Fraction;
+            _Result.Position = _Start + Dir * Fraction;
+            _Result.Normal = FMath::Cross( V1 - V0, V2 - V0 );
+            _Result.Normal.NormalizeSelf();
+            if ( FMath::Dot( _Result.Normal, Dir ) > 0.0f ) {
+                _Result.Normal = -_Result.Normal;
+            }
+            return true;
+        }
+
+        const float Exit = CalcSectorExit( SectorIndex, _Start, Dir );
+        if ( Exit <= Enter || Exit >= 1.0f ) {
+            return false;
+        }
+
+        SectorIndex = FindNeighbor( SectorIndex, _Start + Dir * Exit + StepOverVec );
+        if ( SectorIndex < 0 ) {
+            return false;
+        }
+
+        Enter = Exit;
+    }
+
+    return false;
+}
+
+void FWorldQuery::RaycastBatch( const FWorldRay * _Rays, int _Count, bool * _Hits, FWorldRaycastResult * _Results ) const {
+    auto CastRange = [this, _Rays, _Hits, _Results]( int _First, int _Last ) {
+        FWorldRaycastResult Result;
+
+        for ( int i = _First ; i < _Last ; i++ ) {
+            const FWorldRay & Ray = _Rays[ i ];
+            const int SectorIndex = Ray.Sector >= 0 ? Ray.Sector : LocateSector( Ray.Start );
+
+            _Hits[ i ] = Raycast( SectorIndex, Ray.Start, Ray.End, _Results ? _Results[ i ] : Result );
+        }
+    };
+
+    if ( _Count < RAYCAST_JOB_SIZE * 2 ) {
+        CastRange( 0, _Count );
+        return;
+    }
+
+    GJobPool.ParallelFor( ( _Count + RAYCAST_JOB_SIZE - 1 ) / RAYCAST_JOB_SIZE, [&CastRange, _Count]( int _Index, int _WorkerIndex ) {
+        const int First = _Index * RAYCAST_JOB_SIZE;
+        CastRange( First, FMath::Min( First + RAYCAST_JOB_SIZE, _Count ) );
+    } );
+}
+
+// Points of a LocateSectors batch are bucketed by cells of a grid over the world, so that packets of
+// 4 points from a cell share sectors. Candidate sectors of a packet are the sector of the previous packet
+// and its neighbors, they are tested with IsInside4. Points outside of the candidates walk the tree.
+// The order of points in the batch doesn't matter.
+void FWorldQuery::LocateSectors( const Float3 * _Positions, int _Count, int * _Sectors ) const {
+    Float3 Mins, Maxs;
+    Graph->SectorTree.GetBounds( Mins, Maxs );
+
+    // About LOCATE_POINTS_PER_CELL points per cell if the points cover the world
+    int Resolution = 1;
+    while ( Resolution < LOCATE_MAX_RESOLUTION && Resolution * Resolution * Resolution * LOCATE_POINTS_PER_CELL < _Count ) {
+        Resolution *= 2;
+    }
+
+    Float3 Scale;
+    for ( int Axis = 0 ; Axis < 3 ; Axis++ ) {
+        const float Size = Maxs[ Axis ] - Mins[ Axis ];
+        Scale[ Axis ] = Size > 0.0f ? Resolution / Size : 0.0f;
+    }
+
+    // Counting sort by cell. Points of cell i are in [ FirstInCell[i], FirstInCell[i+1] ) of Order.
+    const int NumCells = Resolution * Resolution * Resolution;
+
+    TPodArray< int > Cells;
+    TPodArray< int > FirstInCell;
+    TPodArray< int > Order;
+    Cells.Resize( _Count );
+    FirstInCell.Resize( NumCells + 1 );
+    Order.Resize( _Count );
+    memset( FirstInCell.ToPtr(), 0, FirstInCell.Length() * sizeof( int ) );
+
+    for ( int i = 0 ; i < _Count ; i++ ) {
+        int Cell[ 3 ];
+        for ( int Axis = 0 ; Axis < 3 ; Axis++ ) {
+            const float t = ( _Positions[ i ][ Axis ] - Mins[ Axis ] ) * Scale[ Axis ];
+            // Also catches NaN
+            Cell[ Axis ] = t > 0.0f ? FMath::Min( int( t ), Resolution - 1 ) : 0;
+        }
+        Cells[ i ] = Cell[ 0 ] + Resolution * ( Cell[ 1 ] + Resolution * Cell[ 2 ] );
+        FirstInCell[ Cells[ i ] + 1 ]++;
+    }
+    for ( int c = 0 ; c < NumCells ; c++ ) {
+        FirstInCell[ c + 1 ] += FirstInCell[ c ];
+    }
+    for ( int i = 0 ; i < _Count ; i++ ) {
+        Order[ FirstInCell[ Cells[ i ] ]++ ] = i;
+    }
+
+    auto LocateRange = [this, _Positions, _Count, _Sectors, &Order]( int _Index, int _WorkerIndex ) {
+        const int Last = FMath::Min( ( _Index + 1 ) * LOCATE_JOB_SIZE, _Count );
+        int Hint = -1;
+
+        for ( int i = _Index * LOCATE_JOB_SIZE ; i < Last ; i += 4 ) {
+            const int Count = FMath::Min( 4, Last - i );
+
+            // A packet of less than 4 points repeats the first one
+            float X[ 4 ], Y[ 4 ], Z[ 4 ];
+            for ( int k = 0 ; k < 4 ; k++ ) {
+                const Float3 & Position = _Positions[ Order[ k < Count ? i + k : i ] ];
+                X[ k ] = Position.X;
+                Y[ k ] = Position.Y;
+                Z[ k ] = Position.Z;
+            }
+
+            auto TestSector = [this, &X, &Y, &Z, _Sectors, &Order, i, &Hint]( int _SectorIndex, int _Mask ) {
+                const int Inside = Graph->PackedPlanes.IsInside4( _SectorIndex, X, Y, Z, _Mask );
+                for ( int k = 0 ; k < 4 ; k++ ) {
+                    if ( Inside & ( 1 << k ) ) {
+                        _Sectors[ Order[ i + k ] ] = _SectorIndex;
+                        Hint = _SectorIndex;
+                    }
+                }
+                return _Mask & ~Inside;
+            };
+
+            // Sector of the previous packet and its neighbors first
+            int Mask = ( 1 << Count ) - 1;
+            if ( Hint >= 0 ) {
+                const int HintSector = Hint;
+                Mask = TestSector( HintSector, Mask );
+                for ( int l = Graph->FirstLink[ HintSector ] ; l < Graph->FirstLink[ HintSector + 1 ] && Mask ; l++ ) {
+                    Mask = TestSector( Graph->Links[ l ], Mask );
+                }
+            }
+
+            // The rest walks the tree one point at a time, a packet walk costs more than separate walks
+            // when the points are in different sectors
+            for ( int k = 0 ; k < Count ; k++ ) {
+                if ( Mask & ( 1 << k ) ) {
+                    _Sectors[ Order[ i + k ] ] = LocateSector( _Positions[ Order[ i + k ] ] );
+                    if ( _Sectors[ Order[ i + k ] ] >= 0 ) {
+                        Hint = _Sectors[ Order[ i + k ] ];
+                    }
+                }
+            }
+        }
+    };
+
+    const int NumJobs = ( _Count + LOCATE_JOB_SIZE - 1 ) / LOCATE_JOB_SIZE;
+    if ( NumJobs < 2 ) {
+        for ( int i = 0 ; i < NumJobs ; i++ ) {
+            LocateRange( i, 0 );
+        }
+    } else {
+        GJobPool.ParallelFor( NumJobs, LocateRange );
+    }
+}
+
+int FSectorTracker::Update( const std::shared_ptr< const FWorldQuery > & _Query, const Float3 & _Position ) {
+    if ( Query != _Query ) {
+        if ( !Query || !_Query || !Query->HasSameSectors( *_Query ) ) {
+            SectorIndex = -1;
+        }
+        Query = _Query;
+    }
+
+    if ( !Query ) {
+        return -1;
+    }
+
+    SectorIndex = SectorIndex >= 0 ? Query->TrackSector( SectorIndex, Position, _Position ) : Query->LocateSector( _Position );
+    Position = _Position;
+
+    return SectorIndex;
+}
@@ -0,0 +1,163 @@
+/*
+
+Blade Of Darkness Remake GPL Source Code
+
+Copyright (C) 2017 Alexander Samusev.
+
+This file is part of the Blade Of Darkness Remake GPL Source Code (BladeRemake Source Code).
+
+BladeRemake is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+#pragma once
+
+#include "SectorTree.h"
+#include "SectorPlanes.h"
+
+#include <memory>
+
+struct FBladeWorld;
+
+struct FWorldRaycastResult {
+    int Face;           // Face table row of the hit triangle
+    int Sector;         // Sector of the hit face
+    float Fraction;     // Hit position on the segment, 0 at start, 1 at end
+    Float3 Position;
+    Float3 Normal;      // Triangle normal, faces the segment start
+};
+
+// Segment of a batch raycast. Sector of the start point, -1 if it is not known.
+struct FWorldRay {
+    Float3 Start;
+    Float3 End;
+    int Sector;
+};
+
+// Triangles of one sector. Snapshots share them, a new snapshot replaces triangles of the sector that
+// was loaded or evicted.
+struct FWorldSectorTriangles {
+    TPodArray< Float3 > Vertices;
+    TPodArray< unsigned int > Indices;      // 3 per triangle
+    TPodArray< int > Faces;                 // Face table row of each triangle, -1 for streamed sectors
+
+    // Append triangles of a draw range. _Face is the face table row of the triangles or -1.
+    void Append( const FMeshVertex * _Vertices, const unsigned int * _Indices, const FMeshOffset & _MeshOffset, int _Face );
+
+    size_t GetMemoryBytes() const;
+};
+
+// Read-only snapshot of the world data used by spatial queries: sector planes, bounds, portal links and
+// triangles of the world mesh. The snapshot owns copies of the data and never changes after construction,
+// so any thread that holds a reference can query it without locks. FBladeWorld publishes a new snapshot
+// when a world is loaded and when a sector is loaded or evicted, see FBladeWorld::GetQuery.
+class FWorldQuery {
+public:
+    // Call when sector planes, bounds and links of the world are ready
+    explicit FWorldQuery( const FBladeWorld & _World );
+
+    // Copy of _Query with triangles of one sector replaced, _Triangles can be NULL. Sector planes, bounds,
+    // links and triangles of other sectors are shared with _Query.
+    FWorldQuery( const FWorldQuery & _Query, int _SectorIndex, const std::shared_ptr< const FWorldSectorTriangles > & _Triangles );
+
+    // Triangles of the sector draw ranges in the world mesh, NULL if the sector has none
+    static std::shared_ptr< const FWorldSectorTriangles > MakeSectorTriangles( const FBladeWorld & _World, int _SectorIndex );
+
+    int GetNumSectors() const { return Graph->SectorBounds.Length(); }
+
+    // True if both snapshots are of the same opened world: sector planes, bounds and links are shared,
+    // only triangles of loaded and evicted sectors can differ
+    bool HasSameSectors( const FWorldQuery & _Query ) const { return Graph == _Query.Graph; }
+
+    const BvAxisAlignedBox & GetSectorBounds( int _SectorIndex ) const { return Graph->SectorBounds[ _SectorIndex ]; }
+
+    // Sectors behind portals of the sector
+    const int * GetSectorLinks( int _SectorIndex, int & _NumLinks ) const;
+
+    // Triangles of the sector, NULL if the sector has none. Sectors of a streamed world have triangles
+    // while they are resident, see FBladeWorld::SetSectorTriangles.
+    const FWorldSectorTriangles * GetSectorTriangles( int _SectorIndex ) const { return Triangles[ _SectorIndex ].get(); }
+
+    // Find sector that contains the point. Returns -1 if the point is outside of the world.
+    // Candidate sectors are found with a bounding volume tree, then tested with sector planes.
+    int LocateSector( const Float3 & _Position ) const;
+
+    // Find sector of a point that moved from _From in sector _SectorIndex to _To. Follows portals crossed
+    // by the segment and falls back to LocateSector if the walk fails. See FSectorTracker.
+    int TrackSector( int _SectorIndex, const Float3 & _From, const Float3 & _To ) const;
+
+    // Locate many points at once, _Sectors receives sector of each point or -1. Points don't need to be
+    // coherent, they are bucketed by location. Large batches are split between job pool workers.
+    void LocateSectors( const Float3 * _Positions, int _Count, int * _Sectors ) const;
+
+    // Find the first world triangle hit by the segment. Starts in the sector of _Start and tests triangles
+    // of one sector at a time, crossing to the next sector through the portal where the segment leaves
+    // the sector. Returns false if nothing is hit, if _Start is outside of the world, or if the segment
+    // leaves the world through a face without triangles.
+    bool Raycast( const Float3 & _Start, const Float3 & _End, FWorldRaycastResult & _Result ) const;
+
+    // Same as Raycast, _Start is known to be in the sector
+    bool Raycast( int _SectorIndex, const Float3 & _Start, const Float3 & _End, FWorldRaycastResult & _Result ) const;
+
+    // Cast many segments, for example line of sight tests. _Hits receives true for segments that hit
+    // the world, _Results may be NULL. Large batches are split between job pool workers.
+    void RaycastBatch( const FWorldRay * _Rays, int _Count, bool * _Hits, FWorldRaycastResult * _Results ) const;
+
+    size_t GetMemoryBytes() const;
+
+private:
+    FWorldQuery( const FWorldQuery & ) = delete;
+    FWorldQuery & operator=( const FWorldQuery & ) = delete;
+
+    // Segment parameter where the segment leaves the convex sector, 1 if it ends in the sector
+    float CalcSectorExit( int _SectorIndex, const Float3 & _Start, const Float3 & _Dir ) const;
+
+    // Neighbor of the sector that contains the point, -1 if none
+    int FindNeighbor( int _SectorIndex, const Float3 & _Position ) const;
+
+    // Data that doesn't change after the world is opened, shared by all snapshots of the world
+    struct FSectorGraph {
+        TPodArray< BvAxisAlignedBox > SectorBounds;
+        FSectorTree SectorTree;
+        FSectorPlanes PackedPlanes;     // Containment tests and exit planes of the portal walk
+        TPodArray< int > FirstLink;
+        TPodArray< int > Links;
+    };
+
+    std::shared_ptr< const FSectorGraph > Graph;
+    TArray< std::shared_ptr< const FWorldSectorTriangles > > Triangles;
+};
+
+// Sector of a moving point: camera, listener or object. Consecutive positions are usually in the same
+// sector or in a neighbor, so the sector is found by a short portal walk from the previous one.
+// The tracker keeps the snapshot of its last update alive.
+class FSectorTracker {
+public:
+    FSectorTracker() : SectorIndex( -1 ) {}
+
+    // Returns -1 if the point is outside of the world. Tracking restarts when the snapshot is of another
+    // world, snapshots republished for streamed sectors keep the previous sector.
+    int Update( const std::shared_ptr< const FWorldQuery > & _Query, const Float3 & _Position );
+
+    // Forget the previous position, next update searches the whole world
+    void Reset() { Query.reset(); SectorIndex = -1; }
+
+    int GetSector() const { return SectorIndex; }
+
+private:
+    std::shared_ptr< const FWorldQuery > Query;
+    int SectorIndex;
+    Float3 Position;
+};